@@ -0,0 +1,626 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ycc.h"
+
+// Binary AST files written by --emit-ast and read by --load-ast, so that
+// tools compiling the same program many times parse it once. The file is
+// a header followed by arrays of fixed-size records of 32-bit integers in
+// host byte order, one array per kind of object, then the string pool:
+//
+//   header   magic, number of records in each array, size of the pool
+//   types    kind, base, array size
+//   vars     name, type, is local, initial values
+//   nodes    one field per field of Node set by the parser
+//   funcs    name, body, params, locals
+//   refs     variables of the parameter, local and global lists
+//   inits    initial values of the globals
+//   strings  names, each ending with '\0' and stored once
+//
+// Objects refer to each other by their index in their array, or -1 for
+// NULL, and to strings by their offset in the pool. Nothing in the file
+// depends on where it is loaded, so it's mapped and turned into the
+// structures of the parser in one pass over each array, with the names
+// pointing into the mapping. The children of a node and the base of a type
+// come before it, which the loader checks to rule out cycles in a corrupted
+// file. It also checks that each node has the operands and type its kind
+// needs, so that a corrupted file is rejected instead of crashing a later
+// pass.
+//
+// The file holds the program as parsed. What optimization does depends on
+// the options given when the file is loaded, and the frame layout and
+// profile counters depend on the optimized code, so the loaded program goes
+// through optimize() and layout_frame() like a parsed one. Stack offsets,
+// live ranges and counters are not stored.
+
+#define AST_MAGIC "YCCAST3\n"
+
+typedef struct {
+    char magic[8];
+    int32_t ntypes;
+    int32_t nvars;
+    int32_t nnodes;
+    int32_t nfuncs;
+    int32_t nrefs;
+    int32_t ninits;
+    int32_t globals;   // First ref of the global variables
+    int32_t nglobals;  // Number of global variables
+    int32_t strings_len;
+} AstHeader;
+
+typedef struct {
+    int32_t kind;
+    int32_t base;
+    int32_t array_size;
+} AstType;
+
+typedef struct {
+    int32_t name;
+    int32_t ty;
+    int32_t is_local;
+    int32_t init;  // First of the initial values, or -1
+    int32_t init_len;
+} AstVar;
+
+typedef struct {
+    int32_t kind;
+    int32_t lhs;
+    int32_t rhs;
+    int32_t val;
+    int32_t var;
+    int32_t cond;
+    int32_t then;
+    int32_t els;
+    int32_t init;
+    int32_t inc;
+    int32_t next;
+    int32_t ty;
+    int32_t body;
+    int32_t args;
+    int32_t funcname;
+    int32_t argnum;
+} AstNode;
+
+typedef struct {
+    int32_t name;
+    int32_t node;
+    int32_t params;  // First ref of the parameters
+    int32_t nparams;
+    int32_t locals;  // First ref of the locals
+    int32_t nlocals;
+} AstFunc;
+
+// Open addressing table numbering the objects written to the file, keyed
+// by address, or by contents for strings
+typedef struct {
+    void** keys;
+    int* vals;
+    int cap;
+    int len;
+    bool by_string;  // Whether keys are strings compared by contents
+} AstMap;
+
+unsigned long ast_hash(AstMap* map, void* key) {
+    if (!map->by_string) return ((uintptr_t)key >> 3) * 0x9e3779b97f4a7c15UL;
+    unsigned long h = 0xcbf29ce484222325UL;  // FNV-1a
+    for (char* s = key; *s; s++) h = (h ^ (unsigned char)*s) * 0x100000001b3UL;
+    return h;
+}
+
+bool ast_same_key(AstMap* map, void* a, void* b) {
+    return map->by_string ? !strcmp(a, b) : a == b;
+}
+
+// Slot of `key` in `map`, which is either free or holds `key`
+int ast_find_slot(AstMap* map, void* key) {
+    int i = ast_hash(map, key) & (map->cap - 1);
+    while (map->keys[i] && !ast_same_key(map, map->keys[i], key))
+        i = (i + 1) & (map->cap - 1);
+    return i;
+}
+
+void ast_map_put(AstMap* map, void* key, int val) {
+    if ((map->len + 1) * 2 > map->cap) {
+        AstMap old = *map;
+        map->cap = old.cap ? old.cap * 2 : 64;
+        map->keys = counted_calloc(map->cap, sizeof(void*));
+        map->vals = counted_malloc(sizeof(int) * map->cap);
+        for (int i = 0; i < old.cap; i++) {
+            if (!old.keys[i]) continue;
+            int j = ast_find_slot(map, old.keys[i]);
+            map->keys[j] = old.keys[i];
+            map->vals[j] = old.vals[i];
+        }
+        free(old.keys);
+        free(old.vals);
+    }
+    int i = ast_find_slot(map, key);
+    if (!map->keys[i]) map->len++;
+    map->keys[i] = key;
+    map->vals[i] = val;
+}
+
+// Value of `key` in `map`, or -1
+int ast_map_get(AstMap* map, void* key) {
+    if (!map->cap) return -1;
+    int i = ast_find_slot(map, key);
+    return map->keys[i] ? map->vals[i] : -1;
+}
+
+// Objects numbered so far, in the order of their records
+typedef struct {
+    void** data;
+    int len;
+    int cap;
+    AstMap map;
+} AstList;
+
+AstList ast_types;
+AstList ast_vars;
+AstList ast_nodes;
+AstMap ast_strings = {.by_string = true};
+char* ast_pool;  // String pool
+int ast_pool_len;
+int ast_pool_cap;
+int32_t* ast_refs;  // Variables of the variable lists
+int ast_refs_len;
+int ast_refs_cap;
+int32_t* ast_inits;  // Initial values of the globals
+int ast_inits_len;
+int ast_inits_cap;
+
+// Index of `obj` in `list`, numbering it if it's new, or -1 for NULL
+int32_t ast_number(AstList* list, void* obj) {
+    if (!obj) return -1;
+    int i = ast_map_get(&list->map, obj);
+    if (i >= 0) return i;
+    if (list->len == list->cap) {
+        list->cap = list->cap ? list->cap * 2 : 64;
+        list->data = counted_realloc(list->data, sizeof(void*) * list->cap);
+    }
+    list->data[list->len] = obj;
+    ast_map_put(&list->map, obj, list->len);
+    return list->len++;
+}
+
+// Offset of `s` in the string pool, adding it if it's new, or -1 for NULL
+int32_t ast_intern(char* s) {
+    if (!s) return -1;
+    int off = ast_map_get(&ast_strings, s);
+    if (off >= 0) return off;
+    int len = strlen(s) + 1;
+    while (ast_pool_len + len > ast_pool_cap) {
+        ast_pool_cap = ast_pool_cap ? ast_pool_cap * 2 : 4096;
+        ast_pool = counted_realloc(ast_pool, ast_pool_cap);
+    }
+    off = ast_pool_len;
+    memcpy(ast_pool + off, s, len);
+    ast_pool_len += len;
+    ast_map_put(&ast_strings, s, off);
+    return off;
+}
+
+// Append the variables of `vl` to the refs and return where they start.
+int32_t ast_add_refs(VarList* vl, int32_t* len) {
+    int32_t start = ast_refs_len;
+    for (; vl; vl = vl->next) {
+        if (ast_refs_len == ast_refs_cap) {
+            ast_refs_cap = ast_refs_cap ? ast_refs_cap * 2 : 64;
+            ast_refs =
+                counted_realloc(ast_refs, sizeof(int32_t) * ast_refs_cap);
+        }
+        ast_refs[ast_refs_len++] = ast_number(&ast_vars, vl->var);
+    }
+    *len = ast_refs_len - start;
+    return start;
+}
+
+// Append the initial values of `var` and return where they start, or -1.
+int32_t ast_add_init(Var* var) {
+    if (!var->init_len) return -1;
+    while (ast_inits_len + var->init_len > ast_inits_cap) {
+        ast_inits_cap = ast_inits_cap ? ast_inits_cap * 2 : 64;
+        ast_inits = counted_realloc(ast_inits, sizeof(int32_t) * ast_inits_cap);
+    }
+    memcpy(ast_inits + ast_inits_len, var->init, sizeof(int) * var->init_len);
+    ast_inits_len += var->init_len;
+    return ast_inits_len - var->init_len;
+}
+
+void write_section(FILE* fp, char* path, void* data, size_t size, int len) {
+    if (len && fwrite(data, size, len, fp) != (size_t)len)
+        error("Cannot write AST file '%s'", path);
+}
+
+Node** ast_stack;     // Nodes left to number by number_tree()
+bool* ast_expanded;   // Whether their children have been pushed
+int ast_stack_len;
+int ast_stack_cap;
+
+void push_ast_node(Node* node, bool expanded) {
+    if (!node) return;
+    if (ast_stack_len == ast_stack_cap) {
+        ast_stack_cap = ast_stack_cap ? ast_stack_cap * 2 : 64;
+        ast_stack = counted_realloc(ast_stack, sizeof(Node*) * ast_stack_cap);
+        ast_expanded =
+            counted_realloc(ast_expanded, sizeof(bool) * ast_stack_cap);
+    }
+    ast_stack[ast_stack_len] = node;
+    ast_expanded[ast_stack_len++] = expanded;
+}
+
+// Index of the numbered node `node`, or -1 for NULL
+int32_t node_index(Node* node) {
+    return node ? ast_map_get(&ast_nodes.map, node) : -1;
+}
+
+// Number the nodes under `root`, each after its children, and return the
+// index of `root`. Statement lists can be long, so this uses an explicit
+// stack.
+int32_t number_tree(Node* root) {
+    push_ast_node(root, false);
+    while (ast_stack_len > 0) {
+        Node* node = ast_stack[--ast_stack_len];
+        if (ast_map_get(&ast_nodes.map, node) >= 0) continue;
+        if (ast_expanded[ast_stack_len]) {
+            ast_number(&ast_nodes, node);
+            continue;
+        }
+        push_ast_node(node, true);
+        push_ast_node(node->lhs, false);
+        push_ast_node(node->rhs, false);
+        push_ast_node(node->cond, false);
+        push_ast_node(node->then, false);
+        push_ast_node(node->els, false);
+        push_ast_node(node->init, false);
+        push_ast_node(node->inc, false);
+        push_ast_node(node->next, false);
+        push_ast_node(node->body, false);
+        push_ast_node(node->args, false);
+    }
+    return node_index(root);
+}
+
+// Number the type `ty` and the types it's built on, each after its base,
+// and return the index of `ty`.
+int32_t number_type(Type* ty) {
+    if (!ty) return -1;
+    int len = 0;
+    for (Type* t = ty; t && ast_map_get(&ast_types.map, t) < 0; t = t->base)
+        len++;
+    for (int i = len - 1; i >= 0; i--) {
+        Type* t = ty;
+        for (int j = 0; j < i; j++) t = t->base;
+        ast_number(&ast_types, t);
+    }
+    return ast_map_get(&ast_types.map, ty);
+}
+
+// Write `prog` to the AST file `path`.
+void emit_ast(Program* prog, char* path) {
+    int nfuncs = 0;
+    for (Function* fn = prog->funcs; fn; fn = fn->next) nfuncs++;
+    AstFunc* funcs = counted_calloc(nfuncs, sizeof(AstFunc));
+
+    AstHeader hdr = {AST_MAGIC};
+    hdr.globals = ast_add_refs(prog->globals, &hdr.nglobals);
+    int i = 0;
+    for (Function* fn = prog->funcs; fn; fn = fn->next, i++) {
+        AstFunc* f = &funcs[i];
+        f->name = ast_intern(fn->name);
+        f->node = number_tree(fn->node);
+        f->params = ast_add_refs(fn->params, &f->nparams);
+        f->locals = ast_add_refs(fn->locals, &f->nlocals);
+    }
+
+    // Variables and types are numbered as the records referring to them
+    // are filled in.
+    AstNode* nodes = counted_malloc(sizeof(AstNode) * ast_nodes.len);
+    for (int i = 0; i < ast_nodes.len; i++) {
+        Node* node = ast_nodes.data[i];
+        nodes[i] = (AstNode){
+            .kind = node->kind,
+            .lhs = node_index(node->lhs),
+            .rhs = node_index(node->rhs),
+            .val = node->val,
+            .var = ast_number(&ast_vars, node->var),
+            .cond = node_index(node->cond),
+            .then = node_index(node->then),
+            .els = node_index(node->els),
+            .init = node_index(node->init),
+            .inc = node_index(node->inc),
+            .next = node_index(node->next),
+            .ty = number_type(node->ty),
+            .body = node_index(node->body),
+            .args = node_index(node->args),
+            .funcname = ast_intern(node->funcname),
+            .argnum = node->argnum,
+        };
+    }
+
+    AstVar* vars = counted_malloc(sizeof(AstVar) * ast_vars.len);
+    for (int i = 0; i < ast_vars.len; i++) {
+        Var* var = ast_vars.data[i];
+        vars[i] = (AstVar){
+            .name = ast_intern(var->name),
+            .ty = number_type(var->ty),
+            .is_local = var->is_local,
+            .init = ast_add_init(var),
+            .init_len = var->init_len,
+        };
+    }
+
+    AstType* types = counted_malloc(sizeof(AstType) * ast_types.len);
+    for (int i = 0; i < ast_types.len; i++) {
+        Type* ty = ast_types.data[i];
+        types[i] = (AstType){
+            .kind = ty->kind,
+            .base = ty->base ? ast_map_get(&ast_types.map, ty->base) : -1,
+            .array_size = ty->array_size,
+        };
+    }
+
+    hdr.ntypes = ast_types.len;
+    hdr.nvars = ast_vars.len;
+    hdr.nnodes = ast_nodes.len;
+    hdr.nfuncs = nfuncs;
+    hdr.nrefs = ast_refs_len;
+    hdr.ninits = ast_inits_len;
+    hdr.strings_len = ast_pool_len;
+
+    FILE* fp = fopen(path, "wb");
+    if (!fp) error("Cannot open AST file '%s'", path);
+    write_section(fp, path, &hdr, sizeof(hdr), 1);
+    write_section(fp, path, types, sizeof(AstType), hdr.ntypes);
+    write_section(fp, path, vars, sizeof(AstVar), hdr.nvars);
+    write_section(fp, path, nodes, sizeof(AstNode), hdr.nnodes);
+    write_section(fp, path, funcs, sizeof(AstFunc), hdr.nfuncs);
+    write_section(fp, path, ast_refs, sizeof(int32_t), hdr.nrefs);
+    write_section(fp, path, ast_inits, sizeof(int32_t), hdr.ninits);
+    write_section(fp, path, ast_pool, 1, hdr.strings_len);
+    if (fclose(fp)) error("Cannot write AST file '%s'", path);
+
+    free(types);
+    free(vars);
+    free(nodes);
+    free(funcs);
+}
+
+char* ast_path;         // AST file being loaded
+AstHeader* ast_header;  // Its header
+
+void invalid_ast() { error("Invalid AST file '%s'", ast_path); }
+
+// Check that `i` is -1 or the index of a record before the record `end`.
+int32_t ast_index(int32_t i, int32_t end) {
+    if (i != -1 && (i < 0 || i >= end)) invalid_ast();
+    return i;
+}
+
+// String at offset `off` of the pool, or NULL for -1
+char* ast_string(char* strings, int32_t off) {
+    if (off == -1) return NULL;
+    if (off < 0 || off >= ast_header->strings_len) invalid_ast();
+    return strings + off;
+}
+
+// Linked list of the `len` variables from the ref `start`
+VarList* load_refs(int32_t* refs, Var* vars, int32_t start, int32_t len) {
+    if (start < 0 || len < 0 || len > ast_header->nrefs - start) invalid_ast();
+    if (!len) return NULL;
+    VarList* cells = counted_calloc(len, sizeof(VarList));
+    for (int i = 0; i < len; i++) {
+        int32_t var = refs[start + i];
+        if (var < 0 || var >= ast_header->nvars) invalid_ast();
+        cells[i].var = &vars[var];
+        cells[i].next = i + 1 < len ? &cells[i + 1] : NULL;
+    }
+    return cells;
+}
+
+// Whether `node` is an expression, which the parser gives a type
+bool is_expr(Node* node) {
+    switch (node->kind) {
+        case NODE_RETURN:
+        case NODE_IF:
+        case NODE_WHILE:
+        case NODE_FOR:
+        case NODE_BLOCK:
+        case NODE_EXPR_STMT:
+        case NODE_NULL:
+            return false;
+        default:
+            return true;
+    }
+}
+
+bool expr_or_null(Node* node) { return !node || is_expr(node); }
+
+// Whether each node of the list `list` is a statement
+bool stmts_or_null(Node* list) {
+    for (Node* n = list; n; n = n->next)
+        if (is_expr(n)) return false;
+    return true;
+}
+
+// Whether `node` is a variable or a dereference, which can be assigned
+bool is_lvalue(Node* node) {
+    return node->kind == NODE_VAR || node->kind == NODE_DEREF;
+}
+
+// Whether the loaded node `node` has the operands its kind needs and the
+// type the parser would give it. Its children were checked before it.
+bool valid_node(Node* node) {
+    Node* lhs = node->lhs;
+    Node* rhs = node->rhs;
+    Type* ty = node->ty;
+    if (is_expr(node) != (ty != NULL) || !expr_or_null(lhs) ||
+        !expr_or_null(rhs) || !expr_or_null(node->cond) ||
+        !stmts_or_null(node->then) || !stmts_or_null(node->els) ||
+        !stmts_or_null(node->init) || !stmts_or_null(node->inc) ||
+        !stmts_or_null(node->body))
+        return false;
+
+    switch (node->kind) {
+        case NODE_ADD:
+        case NODE_SUB:
+            return lhs && rhs && !rhs->ty->base && same_type(ty, lhs->ty);
+        case NODE_MUL:
+        case NODE_DIV:
+        case NODE_EQ:
+        case NODE_NE:
+        case NODE_LT:
+        case NODE_LE:
+            return lhs && rhs && ty->kind == TYPE_INT;
+        case NODE_ASSIGN:
+            return lhs && rhs && is_lvalue(lhs) && same_type(ty, lhs->ty);
+        case NODE_NUM:
+            return ty->kind == TYPE_INT;
+        case NODE_VAR:
+            return node->var && same_type(ty, node->var->ty);
+        case NODE_FUNCALL: {
+            int args = 0;
+            for (Node* arg = node->args; arg; arg = arg->next) {
+                if (!is_expr(arg)) return false;
+                args++;
+            }
+            return node->funcname && node->argnum == args &&
+                   ty->kind == TYPE_INT;
+        }
+        case NODE_ADDR: {
+            if (!lhs || !is_lvalue(lhs) || ty->kind != TYPE_PTR) return false;
+            Type* base = lhs->ty->kind == TYPE_ARRAY ? lhs->ty->base : lhs->ty;
+            return same_type(ty->base, base);
+        }
+        case NODE_DEREF:
+            return lhs && lhs->ty->base && same_type(ty, lhs->ty->base);
+        case NODE_RETURN:
+        case NODE_EXPR_STMT:
+            return lhs != NULL;
+        case NODE_IF:
+        case NODE_WHILE:
+            return node->cond && node->then;
+        case NODE_FOR:
+            return node->then != NULL;
+        default:
+            return true;
+    }
+}
+
+// Read the program in the AST file `path`.
+Program* load_ast(char* path) {
+    ast_path = path;
+    FILE* fp = fopen(path, "rb");
+    if (!fp) error("Cannot open AST file '%s'", path);
+    struct stat st;
+    if (fstat(fileno(fp), &st) || st.st_size < (off_t)sizeof(AstHeader))
+        invalid_ast();
+    size_t size = st.st_size;
+    char* base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                      fileno(fp), 0);
+    fclose(fp);
+    if (base == MAP_FAILED) invalid_ast();
+
+    AstHeader* hdr = ast_header = (AstHeader*)base;
+    if (memcmp(hdr->magic, AST_MAGIC, 8) || hdr->ntypes < 0 ||
+        hdr->nvars < 0 || hdr->nnodes < 0 || hdr->nfuncs < 0 ||
+        hdr->nrefs < 0 || hdr->ninits < 0 || hdr->strings_len < 0)
+        invalid_ast();
+    size_t expected = sizeof(AstHeader) + sizeof(AstType) * hdr->ntypes +
+                      sizeof(AstVar) * hdr->nvars +
+                      sizeof(AstNode) * hdr->nnodes +
+                      sizeof(AstFunc) * hdr->nfuncs +
+                      sizeof(int32_t) * hdr->nrefs +
+                      sizeof(int32_t) * hdr->ninits + hdr->strings_len;
+    if (size != expected) invalid_ast();
+    AstType* ast_types = (AstType*)(hdr + 1);
+    AstVar* ast_vars = (AstVar*)(ast_types + hdr->ntypes);
+    AstNode* ast_nodes = (AstNode*)(ast_vars + hdr->nvars);
+    AstFunc* ast_funcs = (AstFunc*)(ast_nodes + hdr->nnodes);
+    int32_t* refs = (int32_t*)(ast_funcs + hdr->nfuncs);
+    int32_t* inits = refs + hdr->nrefs;
+    char* strings = (char*)(inits + hdr->ninits);
+    if (hdr->strings_len && strings[hdr->strings_len - 1]) invalid_ast();
+
+    Type* types = counted_calloc(hdr->ntypes, sizeof(Type));
+    for (int i = 0; i < hdr->ntypes; i++) {
+        AstType* t = &ast_types[i];
+        if (t->kind < TYPE_INT || t->kind > TYPE_ARRAY) invalid_ast();
+        int32_t base = ast_index(t->base, i);
+        if ((t->kind == TYPE_INT) != (base < 0) || t->array_size < 0)
+            invalid_ast();
+        types[i].kind = t->kind;
+        types[i].base = base < 0 ? NULL : &types[base];
+        types[i].array_size = t->array_size;
+    }
+
+    Var* vars = counted_calloc(hdr->nvars, sizeof(Var));
+    for (int i = 0; i < hdr->nvars; i++) {
+        AstVar* v = &ast_vars[i];
+        int32_t ty = ast_index(v->ty, hdr->ntypes);
+        vars[i].name = ast_string(strings, v->name);
+        if (ty < 0 || !vars[i].name) invalid_ast();
+        vars[i].ty = &types[ty];
+        vars[i].is_local = v->is_local;
+        if (v->init != -1) {
+            if (v->init < 0 || v->init_len < 1 ||
+                v->init_len > hdr->ninits - v->init)
+                invalid_ast();
+            vars[i].init = (int*)inits + v->init;
+            vars[i].init_len = v->init_len;
+        }
+    }
+
+    Node* nodes = counted_calloc(hdr->nnodes, sizeof(Node));
+#define CHILD(field) (ast_index(n->field, i) < 0 ? NULL : &nodes[n->field])
+    for (int i = 0; i < hdr->nnodes; i++) {
+        AstNode* n = &ast_nodes[i];
+        if (n->kind < 0 || n->kind > NODE_NULL) invalid_ast();
+        int32_t var = ast_index(n->var, hdr->nvars);
+        int32_t ty = ast_index(n->ty, hdr->ntypes);
+        Node* node = &nodes[i];
+        node->kind = n->kind;
+        node->lhs = CHILD(lhs);
+        node->rhs = CHILD(rhs);
+        node->val = n->val;
+        node->var = var < 0 ? NULL : &vars[var];
+        node->cond = CHILD(cond);
+        node->then = CHILD(then);
+        node->els = CHILD(els);
+        node->init = CHILD(init);
+        node->inc = CHILD(inc);
+        node->next = CHILD(next);
+        node->ty = ty < 0 ? NULL : &types[ty];
+        node->body = CHILD(body);
+        node->args = CHILD(args);
+        node->funcname = ast_string(strings, n->funcname);
+        node->argnum = n->argnum;
+        if (!valid_node(node)) invalid_ast();
+    }
+#undef CHILD
+
+    Program* prog = counted_calloc(1, sizeof(Program));
+    prog->globals = load_refs(refs, vars, hdr->globals, hdr->nglobals);
+    Function* funcs = counted_calloc(hdr->nfuncs, sizeof(Function));
+    for (int i = 0; i < hdr->nfuncs; i++) {
+        AstFunc* f = &ast_funcs[i];
+        Function* fn = &funcs[i];
+        int32_t node = ast_index(f->node, hdr->nnodes);
+        fn->name = ast_string(strings, f->name);
+        if (!fn->name) invalid_ast();
+        fn->node = node < 0 ? NULL : &nodes[node];
+        fn->params = load_refs(refs, vars, f->params, f->nparams);
+        fn->locals = load_refs(refs, vars, f->locals, f->nlocals);
+        if (!stmts_or_null(fn->node)) invalid_ast();
+        fn->next = i + 1 < hdr->nfuncs ? &funcs[i + 1] : NULL;
+    }
+    prog->funcs = hdr->nfuncs ? funcs : NULL;
+
+    stats.nodes += hdr->nnodes;
+    stats.types += hdr->ntypes;
+    stats.vars += hdr->nvars;
+    return prog;
+}
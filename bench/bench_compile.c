@@ -0,0 +1,326 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+// Compile-speed benchmark. Generates synthetic programs with bench_gen,
+// compiles them with `ycc -ftime-report=json` and reports the time of each
+// compiler phase, tokens/sec and lines/sec. Results are compared against a
+// stored baseline so that regressions show up. A second table compares the
+// throughput of the tokenizer fast paths selected with --lexer and of the
+// multi-threaded tokenizer, and a third one the time of reading a program
+// back from its --emit-ast file with --load-ast against parsing it again.
+
+typedef struct {
+    char* shape;  // Shape passed to bench_gen
+    int size;     // Size passed to bench_gen
+} Case;
+
+Case cases[] = {
+    {"expr", 1000},    {"expr", 10000},    {"expr", 100000},
+    {"nest", 100},     {"nest", 1000},     {"nest", 3000},
+    {"locals", 100},   {"locals", 1000},   {"locals", 5000},
+    {"globals", 100},  {"globals", 1000},  {"globals", 5000},
+    {"funcs", 100},    {"funcs", 1000},    {"funcs", 5000},
+};
+
+// Inputs and tokenizer options of the tokenizer throughput table
+Case lexer_cases[] = {{"expr", 100000}, {"funcs", 5000}, {"lexer", 100000}};
+
+// Inputs of the AST load table
+Case ast_cases[] = {{"expr", 100000},  {"nest", 3000},    {"locals", 5000},
+                    {"globals", 5000}, {"funcs", 5000}};
+
+typedef struct {
+    char* name;  // Column header
+    char* opts;  // Options passed to ycc
+} LexerConfig;
+
+LexerConfig lexer_configs[] = {
+    {"scalar", "--lexer=scalar"},
+    {"sse2", "--lexer=sse2"},
+    {"avx2", "--lexer=avx2"},
+    {"4 threads", "--lex-threads=4"},
+};
+
+char* phase_names[] = {"tokenize", "parse",  "type",
+                       "opt",      "layout", "codegen"};
+#define NUM_PHASES (sizeof(phase_names) / sizeof(*phase_names))
+
+typedef struct {
+    double phase[NUM_PHASES];  // Wall time of each phase in seconds
+    double total;              // Total wall time in seconds
+    long tokens;               // Number of tokens
+} Result;
+
+char* baseline_path = "./bench/baseline.txt";
+int repeat = 5;
+double tolerance = 0.3;
+int update_baseline = 0;
+
+int execute_command(const char* command) {
+    int status = system(command);
+    if (WIFEXITED(status)) {
+        return WEXITSTATUS(status);
+    }
+    return -1;
+}
+
+char* read_file(char* path) {
+    FILE* fp = fopen(path, "r");
+    if (!fp) return NULL;
+    fseek(fp, 0, SEEK_END);
+    long len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char* buf = calloc(1, len + 1);
+    fread(buf, 1, len, fp);
+    fclose(fp);
+    return buf;
+}
+
+int count_lines(char* s) {
+    int n = 0;
+    for (; *s; s++)
+        if (*s == '\n') n++;
+    return n;
+}
+
+// Extract the numbers we need from the JSON written by -ftime-report=json.
+int parse_report(char* json, Result* res) {
+    char key[64];
+    for (int i = 0; i < NUM_PHASES; i++) {
+        snprintf(key, sizeof(key), "\"name\": \"%s\", \"wall\": ",
+                 phase_names[i]);
+        // Phases that did not run (e.g. type without --verify-types) are
+        // not in the report.
+        char* p = strstr(json, key);
+        res->phase[i] = p ? strtod(p + strlen(key), NULL) : 0;
+    }
+
+    char* total = strstr(json, "\"total\": {\"wall\": ");
+    if (!total) return -1;
+    res->total = strtod(total + strlen("\"total\": {\"wall\": "), NULL);
+
+    char* tokens = strstr(total, "\"tokens\": ");
+    if (!tokens) return -1;
+    res->tokens = strtol(tokens + strlen("\"tokens\": "), NULL, 10);
+    return 0;
+}
+
+// Compile `repeat` times with extra options `opts` and keep the fastest
+// run. The program is read from bench_tmp.in unless `opts` loads an AST.
+int run_case(char* opts, Result* best) {
+    char cmd[256];
+    snprintf(cmd, sizeof(cmd),
+             "./ycc -ftime-report=json %s %s > /dev/null 2> bench_tmp.json",
+             opts, strstr(opts, "--load-ast") ? "" : "- < bench_tmp.in");
+    for (int i = 0; i < repeat; i++) {
+        if (execute_command(cmd) != 0) return -1;
+
+        char* json = read_file("bench_tmp.json");
+        Result res;
+        if (!json || parse_report(json, &res)) return -1;
+        free(json);
+
+        if (i == 0 || res.total < best->total) *best = res;
+    }
+    return 0;
+}
+
+// Write the program of shape `c` to bench_tmp.in and return its size.
+long generate(Case* c) {
+    char cmd[256];
+    snprintf(cmd, sizeof(cmd), "./bench_gen %s %d > bench_tmp.in", c->shape,
+             c->size);
+    if (execute_command(cmd) != 0) return -1;
+
+    char* src = read_file("bench_tmp.in");
+    if (!src) return -1;
+    long len = strlen(src);
+    free(src);
+    return len;
+}
+
+// Print the tokenize throughput of each tokenizer configuration in MB/s.
+// Levels the CPU does not support make ycc fail and are shown as "-".
+int bench_lexers() {
+    int nconfigs = sizeof(lexer_configs) / sizeof(*lexer_configs);
+    printf("\n%-8s %7s %9s", "shape", "size", "bytes");
+    for (int j = 0; j < nconfigs; j++) printf(" %9s", lexer_configs[j].name);
+    printf("   (tokenize MB/s)\n");
+
+    for (int i = 0; i < sizeof(lexer_cases) / sizeof(*lexer_cases); i++) {
+        Case* c = &lexer_cases[i];
+        long bytes = generate(c);
+        if (bytes < 0) {
+            fprintf(stderr, "Failed to generate %s %d\n", c->shape, c->size);
+            return -1;
+        }
+
+        printf("%-8s %7d %9ld", c->shape, c->size, bytes);
+        for (int j = 0; j < nconfigs; j++) {
+            Result res;
+            if (run_case(lexer_configs[j].opts, &res))
+                printf(" %9s", "-");
+            else
+                printf(" %9.1f", bytes / res.phase[0] / 1e6);
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+    return 0;
+}
+
+long file_size(char* path) {
+    FILE* fp = fopen(path, "r");
+    if (!fp) return -1;
+    fseek(fp, 0, SEEK_END);
+    long len = ftell(fp);
+    fclose(fp);
+    return len;
+}
+
+// Print the time of tokenizing and parsing each program against loading
+// it from the AST file written by --emit-ast, and the sizes of both files.
+int bench_ast() {
+    printf("\n%-8s %7s %9s %9s %9s %9s %7s\n", "shape", "size", "bytes",
+           "ast", "reparse", "load", "speedup");
+
+    for (int i = 0; i < sizeof(ast_cases) / sizeof(*ast_cases); i++) {
+        Case* c = &ast_cases[i];
+        long bytes = generate(c);
+        Result parsed, loaded;
+        if (bytes < 0 ||
+            execute_command("./ycc --emit-ast=bench_tmp.ast - "
+                            "< bench_tmp.in") ||
+            run_case("", &parsed) ||
+            run_case("--load-ast=bench_tmp.ast", &loaded)) {
+            fprintf(stderr, "Failed to load the AST of %s %d\n", c->shape,
+                    c->size);
+            return -1;
+        }
+
+        // Loading is timed as the parse phase.
+        double reparse = parsed.phase[0] + parsed.phase[1];
+        double load = loaded.phase[1];
+        printf("%-8s %7d %9ld %9ld %8.3fm %8.3fm %6.1fx\n", c->shape, c->size,
+               bytes, file_size("bench_tmp.ast"), reparse * 1000, load * 1000,
+               reparse / load);
+        fflush(stdout);
+    }
+    return 0;
+}
+
+double lookup_baseline(char* baseline, char* shape, int size) {
+    if (!baseline) return 0;
+
+    char key[64];
+    snprintf(key, sizeof(key), "\n%s %d ", shape, size);
+    char* p = strstr(baseline, key);
+    if (!p) return 0;
+    return strtod(p + strlen(key), NULL);
+}
+
+void parse_args(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--update-baseline"))
+            update_baseline = 1;
+        else if (!strncmp(argv[i], "--baseline=", 11))
+            baseline_path = argv[i] + 11;
+        else if (!strncmp(argv[i], "--repeat=", 9))
+            repeat = atoi(argv[i] + 9);
+        else if (!strncmp(argv[i], "--tolerance=", 12))
+            tolerance = atof(argv[i] + 12);
+        else {
+            fprintf(stderr,
+                    "Usage: %s [--update-baseline] [--baseline=path] "
+                    "[--repeat=N] [--tolerance=R]\n",
+                    argv[0]);
+            exit(1);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    parse_args(argc, argv);
+
+    char* baseline = read_file(baseline_path);
+    FILE* out = NULL;
+    if (update_baseline) {
+        out = fopen(baseline_path, "w");
+        if (!out) {
+            fprintf(stderr, "Cannot open %s\n", baseline_path);
+            return 1;
+        }
+        fprintf(out, "# shape size tokens/sec\n");
+    }
+
+    printf("Running YCC Compile-Speed Benchmarks...\n\n");
+    printf("%-8s %7s %8s %8s", "shape", "size", "lines", "tokens");
+    for (int j = 0; j < NUM_PHASES; j++) printf(" %9s", phase_names[j]);
+    printf(" %11s %11s %7s\n", "tokens/s", "lines/s", "vs.base");
+
+    int regressions = 0;
+    for (int i = 0; i < sizeof(cases) / sizeof(*cases); i++) {
+        Case* c = &cases[i];
+
+        if (generate(c) < 0) {
+            fprintf(stderr, "Failed to generate %s %d\n", c->shape, c->size);
+            return 1;
+        }
+
+        char* src = read_file("bench_tmp.in");
+        int lines = count_lines(src);
+        free(src);
+
+        Result res;
+        if (run_case("", &res)) {
+            fprintf(stderr, "Failed to compile %s %d\n", c->shape, c->size);
+            return 1;
+        }
+
+        double tokens_per_sec = res.tokens / res.total;
+        double lines_per_sec = lines / res.total;
+
+        printf("%-8s %7d %8d %8ld", c->shape, c->size, lines, res.tokens);
+        for (int j = 0; j < NUM_PHASES; j++)
+            printf(" %8.3fm", res.phase[j] * 1000);
+        printf(" %11.0f %11.0f", tokens_per_sec, lines_per_sec);
+
+        double base = lookup_baseline(baseline, c->shape, c->size);
+        if (base > 0) {
+            double ratio = tokens_per_sec / base;
+            printf(" %6.2fx", ratio);
+            if (ratio < 1 - tolerance) {
+                printf("  REGRESSION");
+                regressions++;
+            }
+        }
+        printf("\n");
+        fflush(stdout);
+
+        if (out)
+            fprintf(out, "%s %d %.0f\n", c->shape, c->size, tokens_per_sec);
+    }
+
+    if (out) {
+        fclose(out);
+        printf("\nBaseline written to %s\n", baseline_path);
+    }
+
+    if (bench_lexers() || bench_ast()) return 1;
+
+    execute_command("rm -f bench_tmp.in bench_tmp.json bench_tmp.ast");
+
+    printf("\n========================================\n");
+    if (regressions) {
+        printf("NG - %d regression(s) beyond %.0f%% of the baseline\n",
+               regressions, tolerance * 100);
+        printf("========================================\n");
+        return 1;
+    }
+    printf("OK - No regressions beyond %.0f%% of the baseline\n",
+           tolerance * 100);
+    printf("========================================\n");
+    return 0;
+}
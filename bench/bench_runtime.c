@@ -0,0 +1,222 @@
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Runtime benchmark of the code generated by ycc. Each kernel in
+// bench/kernels is compiled by ycc and by gcc at several optimization
+// levels, run several times, and the fastest run of each binary is reported
+// together with its ratio to ycc. Cycles, instructions and branches are
+// counted with perf_event_open(2) when the kernel allows it.
+
+char* kernels[] = {"loop", "array_sum", "fib", "matmul", "pointer_walk",
+                   "sieve"};
+
+typedef struct {
+    char* name;     // Name in the report
+    char* command;  // Command to build ./bench_rt_bin from bench_rt.c
+} Variant;
+
+Variant variants[] = {
+    {"ycc",
+     "./ycc - < bench_rt.c > bench_rt.s && cc -o bench_rt_bin bench_rt.s"},
+    {"ycc nounroll",
+     "./ycc -O2 -funroll-factor=1 - < bench_rt.c > bench_rt.s && "
+     "cc -o bench_rt_bin bench_rt.s"},
+    {"ycc novec",
+     "./ycc -O2 -fno-vectorize - < bench_rt.c > bench_rt.s && "
+     "cc -o bench_rt_bin bench_rt.s"},
+    {"ycc -O2",
+     "./ycc -O2 - < bench_rt.c > bench_rt.s && cc -o bench_rt_bin bench_rt.s"},
+    {"gcc -O0", "gcc -w -O0 -o bench_rt_bin bench_rt.c"},
+    {"gcc -O1", "gcc -w -O1 -o bench_rt_bin bench_rt.c"},
+    {"gcc -O2", "gcc -w -O2 -o bench_rt_bin bench_rt.c"},
+};
+
+#define NUM_VARIANTS (sizeof(variants) / sizeof(*variants))
+
+typedef struct {
+    double wall;        // Wall time in seconds
+    uint64_t cycles;    // CPU cycles
+    uint64_t insns;     // Retired instructions
+    uint64_t branches;  // Retired branch instructions
+    int status;         // Exit status of the kernel
+} Measure;
+
+int repeat = 5;
+int use_perf = 1;
+
+int execute_command(const char* command) {
+    int status = system(command);
+    if (WIFEXITED(status)) {
+        return WEXITSTATUS(status);
+    }
+    return -1;
+}
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Open a user-space hardware counter for `pid`, enabled when it execs.
+int open_counter(pid_t pid, uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.enable_on_exec = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, pid, -1, -1, 0);
+}
+
+uint64_t read_counter(int fd) {
+    uint64_t val = 0;
+    if (fd < 0 || read(fd, &val, sizeof(val)) != sizeof(val)) return 0;
+    close(fd);
+    return val;
+}
+
+// Run ./bench_rt_bin once. The child waits on a pipe until the counters are
+// attached, so that only the kernel itself is measured.
+int run_once(Measure* m) {
+    int fds[2];
+    if (pipe(fds)) return -1;
+
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) {
+        char c;
+        close(fds[1]);
+        if (read(fds[0], &c, 1) != 1) _exit(127);
+        execl("./bench_rt_bin", "./bench_rt_bin", (char*)NULL);
+        _exit(127);
+    }
+
+    close(fds[0]);
+    int cycles = -1, insns = -1, branches = -1;
+    if (use_perf) {
+        cycles = open_counter(pid, PERF_COUNT_HW_CPU_CYCLES);
+        insns = open_counter(pid, PERF_COUNT_HW_INSTRUCTIONS);
+        branches = open_counter(pid, PERF_COUNT_HW_BRANCH_INSTRUCTIONS);
+        if (cycles < 0) use_perf = 0;
+    }
+
+    double start = now();
+    write(fds[1], "x", 1);
+    close(fds[1]);
+
+    int status;
+    waitpid(pid, &status, 0);
+    m->wall = now() - start;
+    m->status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    m->cycles = read_counter(cycles);
+    m->insns = read_counter(insns);
+    m->branches = read_counter(branches);
+    return 0;
+}
+
+// Run the binary `repeat` times and keep the fastest run.
+int measure(Measure* best) {
+    for (int i = 0; i < repeat; i++) {
+        Measure m;
+        if (run_once(&m)) return -1;
+        if (i > 0 && m.status != best->status) return -1;
+
+        uint64_t key = use_perf ? m.cycles : 0;
+        uint64_t best_key = use_perf ? best->cycles : 0;
+        if (i == 0 || (use_perf ? key < best_key : m.wall < best->wall))
+            *best = m;
+    }
+    return 0;
+}
+
+double ratio(double a, double b) { return b > 0 ? a / b : 0; }
+
+void print_counter(uint64_t val) {
+    if (use_perf)
+        printf(" %14llu", (unsigned long long)val);
+    else
+        printf(" %14s", "-");
+}
+
+void parse_args(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        if (!strncmp(argv[i], "--repeat=", 9))
+            repeat = atoi(argv[i] + 9);
+        else if (!strcmp(argv[i], "--no-perf"))
+            use_perf = 0;
+        else {
+            fprintf(stderr, "Usage: %s [--repeat=N] [--no-perf]\n", argv[0]);
+            exit(1);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    parse_args(argc, argv);
+
+    printf("Running YCC Runtime Benchmarks...\n");
+
+    for (int i = 0; i < sizeof(kernels) / sizeof(*kernels); i++) {
+        char cmd[256];
+        snprintf(cmd, sizeof(cmd), "cp ./bench/kernels/%s.c bench_rt.c",
+                 kernels[i]);
+        if (execute_command(cmd) != 0) {
+            fprintf(stderr, "Failed to copy kernel %s\n", kernels[i]);
+            return 1;
+        }
+
+        Measure m[NUM_VARIANTS];
+        for (int j = 0; j < NUM_VARIANTS; j++) {
+            snprintf(cmd, sizeof(cmd), "(%s) 2> /dev/null",
+                     variants[j].command);
+            if (execute_command(cmd) != 0) {
+                fprintf(stderr, "Failed to build %s with %s\n", kernels[i],
+                        variants[j].name);
+                return 1;
+            }
+            if (measure(&m[j])) {
+                fprintf(stderr, "Failed to run %s built with %s\n",
+                        kernels[i], variants[j].name);
+                return 1;
+            }
+            if (m[j].status != m[0].status) {
+                fprintf(stderr, "%s: %s exited with %d, but %s with %d\n",
+                        kernels[i], variants[j].name, m[j].status,
+                        variants[0].name, m[0].status);
+                return 1;
+            }
+        }
+
+        printf("\n%s (exit status %d)\n", kernels[i], m[0].status);
+        printf("  %-12s %10s %14s %14s %14s %10s\n", "variant", "wall(ms)",
+               "cycles", "instructions", "branches", "ycc/this");
+        for (int j = 0; j < NUM_VARIANTS; j++) {
+            double r = use_perf ? ratio(m[0].cycles, m[j].cycles)
+                                : ratio(m[0].wall, m[j].wall);
+            printf("  %-12s %10.2f", variants[j].name, m[j].wall * 1000);
+            print_counter(m[j].cycles);
+            print_counter(m[j].insns);
+            print_counter(m[j].branches);
+            printf(" %9.2fx\n", r);
+        }
+        fflush(stdout);
+    }
+
+    if (!use_perf)
+        printf("\nperf_event_open(2) is not available; ratios use wall time\n");
+
+    execute_command("rm -f bench_rt.c bench_rt.s bench_rt_bin");
+    return 0;
+}
@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Generator of large synthetic programs in the subset of C accepted by ycc.
+// Usage: bench_gen <expr|nest|locals|globals|funcs|lexer> <size>
+
+// A single expression chain of `n` terms.
+void gen_expr(int n) {
+    char ops[] = "+-*";
+    printf("int main() {\n");
+    printf("    int x;\n");
+    printf("    x = 1\n");
+    for (int i = 1; i < n; i++) printf("        %c %d\n", ops[i % 3], i % 7);
+    printf("    ;\n");
+    printf("    return x;\n");
+    printf("}\n");
+}
+
+// `n` levels of nested if/while/for statements.
+void gen_nest(int n) {
+    printf("int main() {\n");
+    printf("    int x;\n");
+    printf("    x = 0;\n");
+    for (int i = 0; i < n; i++) {
+        switch (i % 3) {
+            case 0:
+                printf("if (x < %d) {\n", i);
+                break;
+            case 1:
+                printf("while (x < %d) {\n", i);
+                break;
+            case 2:
+                printf("for (x = x; x < %d; x = x + 1) {\n", i);
+                break;
+        }
+    }
+    printf("x = x + 1;\n");
+    for (int i = 0; i < n; i++) printf("}\n");
+    printf("    return x;\n");
+    printf("}\n");
+}
+
+// A function with `n` local variables.
+void gen_locals(int n) {
+    printf("int main() {\n");
+    for (int i = 0; i < n; i++) printf("    int v%d = %d;\n", i, i % 11);
+    printf("    int sum = 0;\n");
+    for (int i = 0; i < n; i++) printf("    sum = sum + v%d;\n", i);
+    printf("    return sum;\n");
+    printf("}\n");
+}
+
+// `n` global variables, half of them arrays.
+void gen_globals(int n) {
+    for (int i = 0; i < n; i++) {
+        if (i % 2)
+            printf("int g%d[%d];\n", i, i % 16 + 1);
+        else
+            printf("int g%d;\n", i);
+    }
+    printf("int main() {\n");
+    for (int i = 0; i < n; i += 2) printf("    g%d = %d;\n", i, i % 11);
+    printf("    return g0;\n");
+    printf("}\n");
+}
+
+// `n` small functions and a main calling each of them.
+void gen_funcs(int n) {
+    for (int i = 0; i < n; i++) {
+        printf("int f%d(int a, int b) {\n", i);
+        printf("    int c = a * %d;\n", i % 13);
+        printf("    return c + b;\n");
+        printf("}\n");
+    }
+    printf("int main() {\n");
+    printf("    int sum = 0;\n");
+    for (int i = 0; i < n; i++) printf("    sum = f%d(sum, %d);\n", i, i);
+    printf("    return sum;\n");
+    printf("}\n");
+}
+
+// `n` statements with long identifiers, numbers and indentation, which
+// exercise the whitespace, identifier and digit scanners of the tokenizer.
+void gen_lexer(int n) {
+    printf("int main() {\n");
+    printf("    int a_rather_long_variable_name_for_the_tokenizer = 0;\n");
+    for (int i = 0; i < n; i++) {
+        printf("                                ");
+        printf("a_rather_long_variable_name_for_the_tokenizer = ");
+        printf("a_rather_long_variable_name_for_the_tokenizer + %d;\n",
+               1234567 + i);
+    }
+    printf("    return 0;\n");
+    printf("}\n");
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        fprintf(stderr,
+                "Usage: %s <expr|nest|locals|globals|funcs|lexer> <size>\n",
+                argv[0]);
+        return 1;
+    }
+
+    int n = atoi(argv[2]);
+    if (!strcmp(argv[1], "expr"))
+        gen_expr(n);
+    else if (!strcmp(argv[1], "nest"))
+        gen_nest(n);
+    else if (!strcmp(argv[1], "locals"))
+        gen_locals(n);
+    else if (!strcmp(argv[1], "globals"))
+        gen_globals(n);
+    else if (!strcmp(argv[1], "funcs"))
+        gen_funcs(n);
+    else if (!strcmp(argv[1], "lexer"))
+        gen_lexer(n);
+    else {
+        fprintf(stderr, "Unknown shape: %s\n", argv[1]);
+        return 1;
+    }
+    return 0;
+}
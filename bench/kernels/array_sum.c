@@ -0,0 +1,18 @@
+int a[10000];
+
+int sum(int n) {
+    int s = 0;
+    int i;
+    for (i = 0; i < n; i = i + 1) s = s + a[i];
+    return s;
+}
+
+int main() {
+    int i;
+    for (i = 0; i < 10000; i = i + 1) a[i] = i - (i / 100) * 100;
+
+    int total = 0;
+    int k;
+    for (k = 0; k < 500; k = k + 1) total = total + sum(10000) - 495000;
+    return total + 7;
+}
@@ -0,0 +1,9 @@
+int fib(int x) {
+    if (x <= 1) return 1;
+    return fib(x - 1) + fib(x - 2);
+}
+
+int main() {
+    int r = fib(32);
+    return r - (r / 256) * 256;
+}
@@ -0,0 +1,11 @@
+int main() {
+    int sum = 0;
+    int i;
+    int j;
+    for (i = 0; i < 3000; i = i + 1) {
+        for (j = 0; j < 3000; j = j + 1) {
+            sum = sum + i * j - (sum / 4096) * 4096;
+        }
+    }
+    return sum - (sum / 256) * 256;
+}
@@ -0,0 +1,33 @@
+int a[64][64];
+int b[64][64];
+int c[64][64];
+
+int matmul() {
+    int i;
+    int j;
+    int k;
+    for (i = 0; i < 64; i = i + 1) {
+        for (j = 0; j < 64; j = j + 1) {
+            int s = 0;
+            for (k = 0; k < 64; k = k + 1) s = s + a[i][k] * b[k][j];
+            c[i][j] = s;
+        }
+    }
+    return c[7][9];
+}
+
+int main() {
+    int i;
+    int j;
+    for (i = 0; i < 64; i = i + 1) {
+        for (j = 0; j < 64; j = j + 1) {
+            a[i][j] = i + j;
+            b[i][j] = i - j;
+        }
+    }
+
+    int r = 0;
+    int n;
+    for (n = 0; n < 40; n = n + 1) r = r + matmul();
+    return r - (r / 256) * 256;
+}
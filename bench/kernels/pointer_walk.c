@@ -0,0 +1,18 @@
+int next[4096];
+
+int walk(int* p, int steps) {
+    int pos = 0;
+    int i;
+    for (i = 0; i < steps; i = i + 1) pos = *(p + pos);
+    return pos;
+}
+
+int main() {
+    int i;
+    for (i = 0; i < 4096; i = i + 1) {
+        int n = i * 1237 + 17;
+        next[i] = n - (n / 4096) * 4096;
+    }
+    int r = walk(next, 20000000);
+    return r - (r / 256) * 256;
+}
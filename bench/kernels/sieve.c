@@ -0,0 +1,22 @@
+int flags[100000];
+
+int sieve(int n) {
+    int count = 0;
+    int i;
+    int j;
+    for (i = 0; i < n; i = i + 1) flags[i] = 1;
+    for (i = 2; i < n; i = i + 1) {
+        if (flags[i]) {
+            count = count + 1;
+            for (j = i + i; j < n; j = j + i) flags[j] = 0;
+        }
+    }
+    return count;
+}
+
+int main() {
+    int r = 0;
+    int k;
+    for (k = 0; k < 30; k = k + 1) r = sieve(100000);
+    return r - (r / 256) * 256;
+}
@@ -0,0 +1,332 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include "ycc.h"
+
+// Cache of the assembly of functions, kept in the --cache directory
+// across compilations. A function is looked up after parsing by a 64-bit
+// FNV-1a hash of everything its code depends on:
+//
+//   - the compiler executable (its device, inode, size, modification and
+//     status change times) and the options that change code,
+//   - the tokens of the function,
+//   - the name and type of each global variable it uses,
+//   - the key of each function it calls, whose code may be inlined.
+//
+// Functions calling each other recursively are never inlined into each
+// other, so a call back into a function whose key is being computed only
+// hashes that function's own tokens. Functions found in the cache are
+// left out of the passes after inlining, of frame layout and of code
+// generation, and their cached assembly is output instead. Labels are
+// numbered per function, so the code of a function is the same wherever
+// it is in the program.
+//
+// Each entry is a file named by its key starting with a line of the key
+// and the function name, which are checked when the entry is read. Entries
+// are written to a temporary file first and renamed, so that compilations
+// running at the same time never see a partial entry. Reading an entry
+// updates its modification time, and when new entries take the cache over
+// --cache-size, the least recently used ones are removed until it's down
+// to 3/4 of that. Removing an entry that another compilation is about to
+// read just makes that a miss.
+//
+// Profile counters are numbered across the whole program, so the cache is
+// off with -fprofile-generate, -fprofile-use and -finstrument-functions.
+// It's also off with --load-ast, which gives no tokens to hash.
+
+#define FNV_OFFSET 0xcbf29ce484222325UL
+#define FNV_PRIME 0x100000001b3UL
+
+typedef struct {
+    int hits;
+    int misses;
+    int stored;
+    int evicted;
+    long size;  // Bytes in the cache after eviction, or -1 if not scanned
+    int entries;
+} CacheStats;
+
+CacheStats cache_stats = {.size = -1};
+
+unsigned long hash_bytes(unsigned long h, void* p, long len) {
+    unsigned char* s = p;
+    for (long i = 0; i < len; i++) h = (h ^ s[i]) * FNV_PRIME;
+    return h;
+}
+
+unsigned long hash_long(unsigned long h, long val) {
+    return hash_bytes(h, &val, sizeof(val));
+}
+
+unsigned long hash_string(unsigned long h, char* s) {
+    int len = strlen(s);
+    return hash_bytes(hash_long(h, len), s, len);
+}
+
+unsigned long hash_type(unsigned long h, Type* ty) {
+    for (; ty; ty = ty->base)
+        h = hash_long(hash_long(h, ty->kind), ty->array_size);
+    return h;
+}
+
+// Hash of the compiler executable and the options that change the code
+// of functions. Hashing the contents of the executable would cost every
+// compilation a read of the whole file, so it's identified by its file
+// instead: installing or rebuilding ycc gives it a new inode or new
+// times. Without the executable, the cache is off.
+bool hash_compiler(unsigned long* h) {
+    struct stat st;
+    if (stat("/proc/self/exe", &st)) return false;
+    long file[] = {st.st_dev, st.st_ino, st.st_size, st.st_mtime,
+                   st.st_ctime};
+    *h = hash_bytes(FNV_OFFSET, file, sizeof(file));
+
+    long opts[] = {opt_level,  opt_omit_frame_pointer, opt_inline,
+                   opt_inline_limit, unroll_factor(), opt_vectorize,
+                   opt_avx2};
+    *h = hash_bytes(*h, opts, sizeof(opts));
+    return true;
+}
+
+bool cache_enabled() {
+    return opt_cache_dir && !opt_profile_generate && !opt_profile_use &&
+           !opt_instrument_functions && !opt_load_ast;
+}
+
+// Functions defined in the program that each function calls, as indices
+// into funcs[]
+int* callees;
+int callees_len;
+int callees_cap;
+unsigned long visit_hash;  // Hash being computed by hash_node()
+
+void hash_node(Node* node, void* arg) {
+    if (node->kind == NODE_VAR && !node->var->is_local) {
+        visit_hash = hash_string(visit_hash, node->var->name);
+        visit_hash = hash_type(visit_hash, node->var->ty);
+    }
+    if (node->kind != NODE_FUNCALL) return;
+    int callee = find_function(node->funcname);
+    if (callee < 0) return;
+    if (callees_len == callees_cap) {
+        callees_cap = callees_cap ? callees_cap * 2 : 64;
+        callees = realloc(callees, sizeof(int) * callees_cap);
+    }
+    callees[callees_len++] = callee;
+}
+
+// Compute the cache key of each function in `keys`, indexed like funcs[].
+void compute_keys(unsigned long compiler, unsigned long* keys) {
+    // Hash the tokens and globals of each function, collecting its calls.
+    unsigned long* own = malloc(sizeof(long) * funcs_len);
+    int* first = malloc(sizeof(int) * (funcs_len + 1));
+    callees_len = 0;
+    for (int i = 0; i < funcs_len; i++) {
+        Function* fn = funcs[i];
+        unsigned long h = compiler;
+        for (int j = 0; j < fn->ntoks; j++) {
+            Token* tok = &fn->tok[j];
+            h = hash_long(h, tok->kind);
+            h = hash_long(h, tok->len);
+            h = hash_bytes(h, tok->str, tok->len);
+        }
+        visit_hash = h;
+        first[i] = callees_len;
+        visit_nodes(fn->node, hash_node, NULL);
+        own[i] = visit_hash;
+    }
+    first[funcs_len] = callees_len;
+
+    // Add the keys of the callees after computing them, depth first. A
+    // callee still on the stack calls back into its caller.
+    int* state = calloc(funcs_len, sizeof(int));  // 0 new, 1 on stack, 2 done
+    int* pos = malloc(sizeof(int) * funcs_len);   // Next callee to visit
+    int* stack = malloc(sizeof(int) * funcs_len);
+    for (int root = 0; root < funcs_len; root++) {
+        if (state[root]) continue;
+        int len = 0;
+        stack[len++] = root;
+        state[root] = 1;
+        pos[root] = first[root];
+        while (len > 0) {
+            int i = stack[len - 1];
+            if (pos[i] < first[i + 1]) {
+                int c = callees[pos[i]++];
+                if (state[c]) continue;
+                state[c] = 1;
+                pos[c] = first[c];
+                stack[len++] = c;
+                continue;
+            }
+            unsigned long h = own[i];
+            for (int e = first[i]; e < first[i + 1]; e++) {
+                int c = callees[e];
+                h = hash_long(h, state[c] == 2 ? keys[c] : own[c]);
+            }
+            keys[i] = h;
+            state[i] = 2;
+            len--;
+        }
+    }
+    free(stack);
+    free(pos);
+    free(state);
+    free(first);
+    free(own);
+}
+
+char* entry_path(unsigned long key) {
+    char* path = malloc(strlen(opt_cache_dir) + 24);
+    sprintf(path, "%s/%016lx.s", opt_cache_dir, key);
+    return path;
+}
+
+// Cached assembly of `fn` with key `key`, or NULL
+char* read_entry(Function* fn, unsigned long key) {
+    char* path = entry_path(key);
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        free(path);
+        return NULL;
+    }
+    char* text = NULL;
+    unsigned long found;
+    char name[256];
+    struct stat st;
+    if (fscanf(fp, "%lx %255s", &found, name) == 2 && found == key &&
+        !strcmp(name, fn->name) && fgetc(fp) == '\n' &&
+        !fstat(fileno(fp), &st)) {
+        long start = ftell(fp);
+        long len = st.st_size - start;
+        text = malloc(len + 1);
+        if (fread(text, 1, len, fp) == (size_t)len) {
+            text[len] = '\0';
+            utime(path, NULL);
+        } else {
+            free(text);
+            text = NULL;
+        }
+    }
+    fclose(fp);
+    free(path);
+    return text;
+}
+
+void cache_lookup(Program* prog) {
+    unsigned long compiler;
+    if (!cache_enabled() || !hash_compiler(&compiler)) return;
+    mkdir(opt_cache_dir, 0777);
+
+    index_functions(prog);
+    unsigned long* keys = malloc(sizeof(long) * funcs_len);
+    compute_keys(compiler, keys);
+    for (int i = 0; i < funcs_len; i++) {
+        Function* fn = funcs[i];
+        fn->key = keys[i];
+        fn->cached = read_entry(fn, keys[i]);
+        if (fn->cached)
+            cache_stats.hits++;
+        else
+            cache_stats.misses++;
+    }
+    free(keys);
+}
+
+// Add the assembly `text` of `len` bytes of the function `fn` to the
+// cache, if it was looked up.
+void cache_store(Function* fn, char* text, int len) {
+    if (!fn->key) return;
+    char* path = entry_path(fn->key);
+    char* tmp = malloc(strlen(path) + 24);
+    sprintf(tmp, "%s.%d.tmp", path, (int)getpid());
+    FILE* fp = fopen(tmp, "wb");
+    if (fp) {
+        fprintf(fp, "%016lx %s\n", fn->key, fn->name);
+        fwrite(text, 1, len, fp);
+        if (fclose(fp) == 0 && rename(tmp, path) == 0)
+            cache_stats.stored++;
+        else
+            unlink(tmp);
+    }
+    free(tmp);
+    free(path);
+}
+
+typedef struct {
+    char* path;
+    long size;
+    time_t mtime;
+} CacheEntry;
+
+int compare_entries(const void* a, const void* b) {
+    time_t x = ((CacheEntry*)a)->mtime;
+    time_t y = ((CacheEntry*)b)->mtime;
+    return x < y ? -1 : x > y;
+}
+
+// Remove the least recently used entries if the cache is over
+// --cache-size.
+void evict() {
+    DIR* dir = opendir(opt_cache_dir);
+    if (!dir) return;
+    CacheEntry* entries = NULL;
+    int len = 0;
+    int cap = 0;
+    long total = 0;
+    struct dirent* de;
+    while ((de = readdir(dir))) {
+        int n = strlen(de->d_name);
+        if (n != 18 || strcmp(de->d_name + 16, ".s")) continue;
+        char* path = malloc(strlen(opt_cache_dir) + n + 2);
+        sprintf(path, "%s/%s", opt_cache_dir, de->d_name);
+        struct stat st;
+        if (stat(path, &st)) {
+            free(path);
+            continue;
+        }
+        if (len == cap) {
+            cap = cap ? cap * 2 : 64;
+            entries = realloc(entries, sizeof(CacheEntry) * cap);
+        }
+        entries[len++] = (CacheEntry){path, st.st_size, st.st_mtime};
+        total += st.st_size;
+    }
+    closedir(dir);
+
+    long limit = opt_cache_size * 1024L * 1024L;
+    if (total > limit) {
+        qsort(entries, len, sizeof(CacheEntry), compare_entries);
+        for (int i = 0; i < len && total > limit / 4 * 3; i++) {
+            if (unlink(entries[i].path) && errno != ENOENT) continue;
+            total -= entries[i].size;
+            cache_stats.evicted++;
+        }
+    }
+    cache_stats.size = total;
+    cache_stats.entries = len - cache_stats.evicted;
+    for (int i = 0; i < len; i++) free(entries[i].path);
+    free(entries);
+}
+
+// Evict entries if any were added, and print the statistics of this
+// compilation under --cache-stats.
+void cache_finish() {
+    if (!cache_enabled()) return;
+    if (cache_stats.stored) evict();
+    if (!opt_cache_stats) return;
+    int total = cache_stats.hits + cache_stats.misses;
+    fprintf(stderr, "cache: %d hits, %d misses (%.1f%% hit rate), ",
+            cache_stats.hits, cache_stats.misses,
+            total ? 100.0 * cache_stats.hits / total : 0.0);
+    fprintf(stderr, "%d stored, %d evicted", cache_stats.stored,
+            cache_stats.evicted);
+    if (cache_stats.size >= 0)
+        fprintf(stderr, ", %d entries in %ld KB", cache_stats.entries,
+                cache_stats.size / 1024);
+    fprintf(stderr, "\n");
+}
@@ -0,0 +1,96 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Thin client of `ycc --server`, used in place of ycc with the same
+// arguments. It connects to the socket $YCC_SERVER (ycc.sock by default),
+// passes the server its standard input, output and error, its working
+// directory and its arguments, and exits with the status of the
+// compilation. See server.c for the protocol.
+
+static int write_full(int fd, const void* buf, size_t len) {
+    const char* p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        p += n;
+        len -= n;
+    }
+    return 1;
+}
+
+static int send_string(int fd, const char* str) {
+    uint32_t len = strlen(str);
+    return write_full(fd, &len, sizeof(len)) && write_full(fd, str, len);
+}
+
+// Send one byte with our standard input, output and error.
+static int send_stdio(int fd) {
+    char byte = 0;
+    struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct msghdr msg = {.msg_iov = &iov,
+                         .msg_iovlen = 1,
+                         .msg_control = control.buf,
+                         .msg_controllen = sizeof(control.buf)};
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(3 * sizeof(int));
+    int fds[3] = {0, 1, 2};
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    return sendmsg(fd, &msg, 0) == 1;
+}
+
+int main(int argc, char** argv) {
+    char* path = getenv("YCC_SERVER");
+    if (!path || !*path) path = "ycc.sock";
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "ycc-client: socket path too long: %s\n", path);
+        return 1;
+    }
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr))) {
+        fprintf(stderr, "ycc-client: cannot connect to '%s': %s\n", path,
+                strerror(errno));
+        return 1;
+    }
+
+    char cwd[4096];
+    if (!getcwd(cwd, sizeof(cwd))) {
+        perror("ycc-client: getcwd");
+        return 1;
+    }
+    uint32_t nargs = argc;
+    int ok = send_stdio(fd) && send_string(fd, cwd) &&
+             write_full(fd, &nargs, sizeof(nargs));
+    for (int i = 0; ok && i < argc; i++) ok = send_string(fd, argv[i]);
+
+    // The status arrives once the worker is done with our output.
+    int32_t status;
+    ssize_t n = 0;
+    while (ok && n != sizeof(status)) {
+        n = read(fd, &status, sizeof(status));
+        if (n < 0 && errno == EINTR) continue;
+        if (n != sizeof(status)) ok = 0;
+    }
+    if (!ok) {
+        fprintf(stderr, "ycc-client: lost connection to '%s'\n", path);
+        return 1;
+    }
+    return status;
+}
@@ -3,20 +3,137 @@
 char* argreg4[] = {"edi", "esi", "edx", "ecx", "r8d", "r9d"};
 char* argreg8[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
 
+// Labels are numbered from 0 in each function and qualified by its name,
+// as in .Lend3.main, so that the code of a function doesn't depend on the
+// functions before it.
 int label_count = 0;
 char* funcname;
 
+// Frame of the function being generated. Without a frame pointer, locals
+// are addressed relative to RSP, which moves as the value stack grows, so
+// the number of values pushed since the prologue is tracked in `depth`.
+bool use_rbp;        // Whether the function sets up RBP
+int stack_size;      // Bytes of locals
+int depth;           // Values pushed on top of the locals
+int nparams;         // Number of parameters
+bool frame_escapes;  // Whether pointers into the frame may exist
+
+// Vector constants of the function being generated, emitted after it to a
+// mergeable section of the same size, so that the linker keeps one copy of
+// each across all functions.
+int* const_pool;  // Value of each int vector, all lanes being equal
+int const_pool_len;
+int const_pool_cap;
+
+// While the code of a function is kept for the cache, emit() appends to
+// this buffer instead of writing to stdout.
+bool emit_capture;
+char* emit_buf;
+int emit_len;
+int emit_cap;
+
+void emit(char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    if (emit_capture) {
+        va_list copy;
+        va_copy(copy, ap);
+        int len = vsnprintf(NULL, 0, fmt, copy);
+        va_end(copy);
+        if (emit_len + len + 1 > emit_cap) {
+            while (emit_len + len + 1 > emit_cap)
+                emit_cap = emit_cap ? emit_cap * 2 : 4096;
+            emit_buf = counted_realloc(emit_buf, emit_cap);
+        }
+        vsnprintf(emit_buf + emit_len, len + 1, fmt, ap);
+        emit_len += len;
+    } else {
+        vprintf(fmt, ap);
+    }
+    va_end(ap);
+
+    // Indented lines other than directives are instructions.
+    if (fmt[0] == ' ' && fmt[2] != '.') stats.insns++;
+}
+
+void push(char* reg) {
+    emit("  push %s\n", reg);
+    depth++;
+}
+
+void pop(char* reg) {
+    emit("  pop %s\n", reg);
+    depth--;
+}
+
+// Code is generated from an explicit stack of tasks rather than by recursion,
+// so that deeply nested trees don't exhaust the C stack. Generating a node
+// pushes tasks for its children and for the instructions between and after
+// them, in reverse order of execution.
+typedef enum {
+    TASK_GEN,         // Generate code pushing the node's value
+    TASK_ADDR,        // Generate code pushing the node's address
+    TASK_GEN_LIST,    // Generate the node and then its `next` siblings
+    TASK_LOAD,        // Load a value of the node's type
+    TASK_STORE,       // Store a value of the node's type
+    TASK_POP,         // Discard the value of an expression statement
+    TASK_RETURN,      // Return the value on top of the stack
+    TASK_BRANCH,      // Pop a condition and jump to the label if it is zero
+    TASK_BRANCH_NZ,   // Pop a condition and jump to the label unless zero
+    TASK_JUMP,        // Jump to the label
+    TASK_LABEL,       // Define the label
+    TASK_CALL,        // Call the function with arguments on the stack
+    TASK_TAIL_CALL,   // Jump to the function with arguments on the stack
+    TASK_BINARY,      // Apply the binary operator to the top two values
+    TASK_POP_RAX,     // Pop a value into RAX
+    TASK_INLINE_END,  // Push the value of the inlined call
+    TASK_COLD_BEGIN,  // Continue in the section of rarely run code
+    TASK_COLD_END,    // Go back to the previous section
+} TaskKind;
+
+typedef struct Task Task;
+struct Task {
+    TaskKind kind;  // Task kind
+    Node* node;     // Node the task works on
+    char* label;    // Label prefix (for branches, jumps and labels)
+    int seq;        // Label number (for branches, jumps and labels)
+};
+
+Task* tasks;    // Stack of pending tasks
+int tasks_len;  // Number of pending tasks
+int tasks_cap;  // Capacity of the stack
+
+void push_task(TaskKind kind, Node* node) {
+    if (tasks_len == tasks_cap) {
+        tasks_cap = tasks_cap ? tasks_cap * 2 : 64;
+        tasks = counted_realloc(tasks, sizeof(Task) * tasks_cap);
+    }
+    Task* t = &tasks[tasks_len++];
+    t->kind = kind;
+    t->node = node;
+    t->label = NULL;
+    t->seq = 0;
+}
+
+void push_label_task(TaskKind kind, char* label, int seq) {
+    push_task(kind, NULL);
+    tasks[tasks_len - 1].label = label;
+    tasks[tasks_len - 1].seq = seq;
+}
+
 void gen_addr(Node* node) {
     if (node->kind == NODE_VAR) {
-        if (node->var->is_local) {
-            printf("  lea rax, [rbp-%d]\n", node->var->offset);
-        } else {
-            printf("  lea rax, %s[rip]\n", node->var->name);
-        }
-        printf("  push rax\n");
+        if (!node->var->is_local)
+            emit("  lea rax, %s[rip]\n", node->var->name);
+        else if (use_rbp)
+            emit("  lea rax, [rbp-%d]\n", node->var->offset);
+        else
+            emit("  lea rax, [rsp+%d]\n",
+                 stack_size - node->var->offset + depth * 8);
+        push("rax");
         return;
     } else if (node->kind == NODE_DEREF) {
-        gen(node->lhs);
+        push_task(TASK_GEN, node->lhs);
         return;
     }
 
@@ -27,69 +144,486 @@ void gen_lval(Node* node) {
     if (node->ty->kind == TYPE_ARRAY) {
         error("Not an lvalue");
     }
-    gen_addr(node);
+    push_task(TASK_ADDR, node);
 }
 
 void load(Type* ty) {
-    printf("  pop rax\n");
+    pop("rax");
     if (ty->kind == TYPE_INT)
-        printf("  movsxd rax, dword ptr [rax]\n");
+        emit("  movsxd rax, dword ptr [rax]\n");
     else if (ty->kind == TYPE_PTR)
-        printf("  mov rax, [rax]\n");
-    printf("  push rax\n");
+        emit("  mov rax, [rax]\n");
+    push("rax");
 }
 
 void store(Type* ty) {
-    printf("  pop rdi\n");
-    printf("  pop rax\n");
+    pop("rdi");
+    pop("rax");
     if (ty->kind == TYPE_INT)
-        printf("  mov [rax], edi\n");
+        emit("  mov [rax], edi\n");
     else if (ty->kind == TYPE_PTR)
-        printf("  mov [rax], rdi\n");
-    printf("  push rdi\n");
+        emit("  mov [rax], rdi\n");
+    push("rdi");
 }
 
-void gen(Node* node) {
+void gen_call(Node* node) {
+    for (int i = 0; i < node->argnum && i < 6; i++) pop(argreg8[i]);
+
+    // The prologue leaves RSP 16-byte aligned, so the depth of the value
+    // stack tells whether the call needs padding.
+    emit("  mov rax, 0\n");
+    if (depth % 2) {
+        emit("  sub rsp, 8\n");
+        emit("  call %s\n", node->funcname);
+        emit("  add rsp, 8\n");
+    } else {
+        emit("  call %s\n", node->funcname);
+    }
+    push("rax");
+}
+
+// Whether the call `node` in return position can reuse or drop the frame
+// instead of returning through it. A pointer into the frame might be
+// passed to the callee, so functions with arrays or address-taken locals
+// keep real calls. So do calls with more than 6 arguments, and all calls
+// under -finstrument-functions, which times the return.
+bool is_tail_call(Node* node) {
+    return opt_level >= 2 && node->kind == NODE_FUNCALL &&
+           node->argnum <= 6 && !frame_escapes && !opt_instrument_functions;
+}
+
+void gen_tail_call(Node* node) {
+    for (int i = 0; i < node->argnum; i++) pop(argreg8[i]);
+
+    // A self call stores the arguments into the parameters again and
+    // restarts the body.
+    if (!strcmp(node->funcname, funcname) && node->argnum == nparams) {
+        if (!use_rbp && depth > 0) emit("  add rsp, %d\n", depth * 8);
+        emit("  jmp .Lentry%s\n", funcname);
+        return;
+    }
+
+    // Any other callee returns directly to our caller.
+    if (use_rbp) {
+        emit("  mov rsp, rbp\n");
+        emit("  pop rbp\n");
+    } else {
+        emit("  add rsp, %d\n", stack_size + 8 + depth * 8);
+    }
+    emit("  mov rax, 0\n");
+    emit("  jmp %s\n", node->funcname);
+}
+
+// Inlined calls being generated, innermost last. Returns in inlined code
+// leave their value in RAX and jump to the end of the innermost one.
+int* inline_labels;
+int inline_len;
+int inline_cap;
+
+void begin_inline() {
+    if (inline_len == inline_cap) {
+        inline_cap = inline_cap ? inline_cap * 2 : 16;
+        inline_labels =
+            counted_realloc(inline_labels, sizeof(int) * inline_cap);
+    }
+    inline_labels[inline_len++] = label_count++;
+}
+
+void end_inline() {
+    emit(".Linline%d.%s:\n", inline_labels[--inline_len], funcname);
+    push("rax");
+}
+
+// Memory operand of the variable `var`
+char* var_operand(Var* var) {
+    static char buf[64];
+    char* size = var->ty->kind == TYPE_INT ? "dword" : "qword";
+    if (!var->is_local)
+        snprintf(buf, sizeof(buf), "%s ptr %s[rip]", size, var->name);
+    else if (use_rbp)
+        snprintf(buf, sizeof(buf), "%s ptr [rbp-%d]", size, var->offset);
+    else
+        snprintf(buf, sizeof(buf), "%s ptr [rsp+%d]", size,
+                 stack_size - var->offset + depth * 8);
+    return buf;
+}
+
+// Generate the statement `var = var + c`, `var = var - c` or
+// `var = var + v` of an int or pointer `var`, whose value is discarded, as
+// one addition to memory. Such statements step loop counters and the
+// pointers of strength-reduced loops. Returns false for other expressions.
+bool gen_increment(Node* node) {
+    if (node->kind != NODE_ASSIGN || node->lhs->kind != NODE_VAR) return false;
+    Var* var = node->lhs->var;
+    Node* rhs = node->rhs;
+    if (var->ty->kind == TYPE_ARRAY ||
+        (rhs->kind != NODE_ADD && rhs->kind != NODE_SUB) ||
+        rhs->lhs->kind != NODE_VAR || rhs->lhs->var != var)
+        return false;
+
+    int scale = var->ty->base ? size_of(var->ty->base) : 1;
+    char* op = rhs->kind == NODE_ADD ? "add" : "sub";
+    Node* x = rhs->rhs;
+    if (x->kind == NODE_NUM) {
+        long val = (long)x->val * scale;
+        if (val != (int)val) return false;
+        emit("  %s %s, %ld\n", op, var_operand(var), val);
+        return true;
+    }
+    if (x->kind != NODE_VAR || x->var->ty->kind != TYPE_INT) return false;
+    emit("  movsxd rax, %s\n", var_operand(x->var));
+    if (scale != 1) emit("  imul rax, %d\n", scale);
+    emit("  %s %s, %s\n", op, var_operand(var),
+         var->ty->kind == TYPE_INT ? "eax" : "rax");
+    return true;
+}
+
+// Registers of a vectorized loop. The counter is kept in RCX and the limit
+// in RDX. Vector registers 0 to MAX_VECTOR_TEMPS - 1 hold intermediate
+// values, and the ones after them the invariant operands and then the
+// sums.
+char* vector_base_regs[] = {"r8", "r9", "r10", "r11", "rsi", "rdi"};
+VectorLoop vloop;
+
+// Generate code computing the element-wise expression `node` into vector
+// register `reg` and the ones after it, as counted by vector_regs().
+void gen_vector_expr(Node* node, int reg) {
+    char* r = opt_avx2 ? "ymm" : "xmm";
+    if (is_element(node, vloop.var)) {
+        int base = vector_base(&vloop, node->lhs->lhs);
+        emit("  %s %s%d, [%s+rcx*4]\n", opt_avx2 ? "vmovdqu" : "movdqu", r,
+             reg, vector_base_regs[base]);
+        return;
+    }
+    if (is_scalar_operand(node)) {
+        int fixed = MAX_VECTOR_TEMPS + vector_scalar(&vloop, node);
+        emit("  %s %s%d, %s%d\n", opt_avx2 ? "vmovdqa" : "movdqa", r, reg, r,
+             fixed);
+        return;
+    }
+
+    gen_vector_expr(node->lhs, reg);
+    bool sse_mul = node->kind == NODE_MUL && !opt_avx2;
+    int rhs = reg + 1;
+    if (is_scalar_operand(node->rhs) && !sse_mul)
+        rhs = MAX_VECTOR_TEMPS + vector_scalar(&vloop, node->rhs);
+    else
+        gen_vector_expr(node->rhs, rhs);
+
+    char* op = node->kind == NODE_ADD   ? "paddd"
+               : node->kind == NODE_SUB ? "psubd"
+                                        : "pmulld";
+    if (opt_avx2) {
+        emit("  v%s ymm%d, ymm%d, ymm%d\n", op, reg, reg, rhs);
+        return;
+    }
+    if (!sse_mul) {
+        emit("  %s xmm%d, xmm%d\n", op, reg, rhs);
+        return;
+    }
+
+    // SSE2 only multiplies the even lanes, so the odd ones are shifted
+    // down and multiplied separately, and the low halves are interleaved.
+    int tmp = reg + 2;
+    emit("  movdqa xmm%d, xmm%d\n", tmp, reg);
+    emit("  pmuludq xmm%d, xmm%d\n", tmp, rhs);
+    emit("  psrlq xmm%d, 32\n", reg);
+    emit("  psrlq xmm%d, 32\n", rhs);
+    emit("  pmuludq xmm%d, xmm%d\n", reg, rhs);
+    emit("  pshufd xmm%d, xmm%d, 8\n", tmp, tmp);
+    emit("  pshufd xmm%d, xmm%d, 8\n", reg, reg);
+    emit("  punpckldq xmm%d, xmm%d\n", tmp, reg);
+    emit("  movdqa xmm%d, xmm%d\n", reg, tmp);
+}
+
+// Add the lanes of the sum in vector register `reg` to `var`.
+void gen_vector_sum(int reg, Var* var) {
+    if (opt_avx2) {
+        emit("  vextracti128 xmm0, ymm%d, 1\n", reg);
+        emit("  vpaddd xmm%d, xmm%d, xmm0\n", reg, reg);
+        emit("  vpshufd xmm0, xmm%d, 0x4e\n", reg);
+        emit("  vpaddd xmm%d, xmm%d, xmm0\n", reg, reg);
+        emit("  vpshufd xmm0, xmm%d, 0xb1\n", reg);
+        emit("  vpaddd xmm%d, xmm%d, xmm0\n", reg, reg);
+        emit("  vmovd eax, xmm%d\n", reg);
+    } else {
+        emit("  pshufd xmm0, xmm%d, 0x4e\n", reg);
+        emit("  paddd xmm%d, xmm0\n", reg);
+        emit("  pshufd xmm0, xmm%d, 0xb1\n", reg);
+        emit("  paddd xmm%d, xmm0\n", reg);
+        emit("  movd eax, xmm%d\n", reg);
+    }
+    emit("  add %s, eax\n", var_operand(var));
+}
+
+// Number of the label of the vector of `val` in the constant pool
+int const_label(int val) {
+    for (int i = 0; i < const_pool_len; i++)
+        if (const_pool[i] == val) return i;
+    if (const_pool_len == const_pool_cap) {
+        const_pool_cap = const_pool_cap ? const_pool_cap * 2 : 8;
+        const_pool = counted_realloc(const_pool, sizeof(int) * const_pool_cap);
+    }
+    const_pool[const_pool_len] = val;
+    return const_pool_len++;
+}
+
+void emit_const_pool() {
+    if (!const_pool_len) return;
+    int size = vector_width() * 4;
+    emit(".section .rodata.cst%d,\"aM\",@progbits,%d\n", size, size);
+    emit(".align %d\n", size);
+    for (int i = 0; i < const_pool_len; i++) {
+        emit(".Lconst%d.%s:\n", i, funcname);
+        emit("  .long %d", const_pool[i]);
+        for (int j = 1; j < vector_width(); j++)
+            emit(", %d", const_pool[i]);
+        emit("\n");
+    }
+}
+
+// Generate the vectorized iterations of a loop, as described in
+// vectorize.c. A loop that no longer has the form vectorize() found is
+// left entirely to the scalar loop after it.
+void gen_vector_loop(Node* node) {
+    if (!analyze_vector_loop(node->cond, node->then, &vloop)) return;
+    int width = vector_width();
+    char* r = opt_avx2 ? "ymm" : "xmm";
+    int c = label_count++;
+
+    for (int i = 0; i < vloop.nbases; i++) gen(vloop.bases[i]);
+    gen(vloop.limit);
+    pop("rdx");
+    if (vloop.inclusive) emit("  add rdx, 1\n");
+    for (int i = vloop.nbases - 1; i >= 0; i--) pop(vector_base_regs[i]);
+    emit("  movsxd rcx, %s\n", var_operand(vloop.var));
+
+    // Arrays that may overlap must start at the same element or at least a
+    // vector apart.
+    for (int i = 0; i < vloop.nbases; i++) {
+        for (int j = 0; j < vloop.nbases; j++) {
+            Node* a = vloop.bases[i];
+            Node* b = vloop.bases[j];
+            if (i == j || !vloop.stored[i] ||
+                (vloop.stored[j] && j < i) ||
+                (a->kind == NODE_VAR && a->var->ty->kind == TYPE_ARRAY &&
+                 b->kind == NODE_VAR && b->var->ty->kind == TYPE_ARRAY))
+                continue;
+            int ok = label_count++;
+            emit("  mov rax, %s\n", vector_base_regs[i]);
+            emit("  sub rax, %s\n", vector_base_regs[j]);
+            emit("  je .Lvok%d.%s\n", ok, funcname);
+            emit("  add rax, %d\n", width * 4 - 1);
+            emit("  cmp rax, %d\n", width * 8 - 2);
+            emit("  jbe .Lvend%d.%s\n", c, funcname);
+            emit(".Lvok%d.%s:\n", ok, funcname);
+        }
+    }
+
+    for (int i = 0; i < vloop.nscalars; i++) {
+        Node* s = vloop.scalars[i];
+        int reg = MAX_VECTOR_TEMPS + i;
+        if (s->kind == NODE_NUM) {
+            emit("  %s %s%d, [rip+.Lconst%d.%s]\n",
+                 opt_avx2 ? "vmovdqa" : "movdqa", r, reg,
+                 const_label(s->val), funcname);
+            continue;
+        }
+        emit("  mov eax, %s\n", var_operand(s->var));
+        if (opt_avx2) {
+            emit("  vmovd xmm%d, eax\n", reg);
+            emit("  vpbroadcastd ymm%d, xmm%d\n", reg, reg);
+        } else {
+            emit("  movd xmm%d, eax\n", reg);
+            emit("  pshufd xmm%d, xmm%d, 0\n", reg, reg);
+        }
+    }
+    int sums = MAX_VECTOR_TEMPS + vloop.nscalars;
+    for (int i = sums; i < sums + vloop.nsums; i++) {
+        if (opt_avx2)
+            emit("  vpxor ymm%d, ymm%d, ymm%d\n", i, i, i);
+        else
+            emit("  pxor xmm%d, xmm%d\n", i, i);
+    }
+
+    emit("  lea rax, [rcx+%d]\n", width);
+    emit("  cmp rax, rdx\n");
+    emit("  jg .Lvdone%d.%s\n", c, funcname);
+    emit(".Lvloop%d.%s:\n", c, funcname);
+    int sum = sums;
+    for (Node* stmt = vloop.stmts; stmt; stmt = stmt->next) {
+        Var* var;
+        bool sub;
+        Node* expr = sum_operand(stmt, &var, &sub);
+        if (expr) {
+            gen_vector_expr(expr, 0);
+            if (opt_avx2)
+                emit("  %s ymm%d, ymm%d, ymm0\n", sub ? "vpsubd" : "vpaddd",
+                     sum, sum);
+            else
+                emit("  %s xmm%d, xmm0\n", sub ? "psubd" : "paddd", sum);
+            sum++;
+            continue;
+        }
+        gen_vector_expr(stmt->lhs->rhs, 0);
+        int base = vector_base(&vloop, stmt->lhs->lhs->lhs->lhs);
+        emit("  %s [%s+rcx*4], %s0\n", opt_avx2 ? "vmovdqu" : "movdqu",
+             vector_base_regs[base], r);
+    }
+    emit("  add rcx, %d\n", width);
+    emit("  lea rax, [rcx+%d]\n", width);
+    emit("  cmp rax, rdx\n");
+    emit("  jle .Lvloop%d.%s\n", c, funcname);
+    emit(".Lvdone%d.%s:\n", c, funcname);
+    emit("  mov %s, ecx\n", var_operand(vloop.var));
+
+    sum = sums;
+    for (Node* stmt = vloop.stmts; stmt; stmt = stmt->next) {
+        Var* var;
+        bool sub;
+        if (sum_operand(stmt, &var, &sub)) gen_vector_sum(sum++, var);
+    }
+    if (opt_avx2) emit("  vzeroupper\n");
+    emit(".Lvend%d.%s:\n", c, funcname);
+}
+
+// Push the tasks of the arm `arm` of an `if` placed after the other one,
+// which jumps over it to the end label .Lend`end`. A cold arm goes to
+// .text.unlikely instead and jumps back to the end label itself.
+void push_second_arm(Node* arm, char* label, int seq, int end, bool cold) {
+    if (cold) {
+        push_task(TASK_COLD_END, NULL);
+        push_label_task(TASK_JUMP, ".Lend", end);
+    }
+    push_task(TASK_GEN, arm);
+    push_label_task(TASK_LABEL, label, seq);
+    if (cold)
+        push_task(TASK_COLD_BEGIN, NULL);
+    else
+        push_label_task(TASK_JUMP, ".Lend", end);
+}
+
+// Generate the `if` `node` with labels .Lend`c` and .Lelse`e` laid out by
+// its profile, after the task defining .Lend`c`. The arm run most often
+// falls through from the condition.
+void gen_profiled_if(Node* node, int c, int e) {
+    bool cold_then = is_cold_arm(node, false);
+    bool cold_else = node->els && is_cold_arm(node, true);
+    bool else_first = node->els && !cold_else &&
+                      (cold_then || profile_count(node->counter + 1) >
+                                        profile_count(node->counter));
+
+    if (cold_then || else_first) {
+        // Branch to the then arm if the condition holds.
+        push_second_arm(node->then, ".Lthen", e, c, cold_then);
+        if (node->els) push_task(TASK_GEN, node->els);
+        push_label_task(TASK_BRANCH_NZ, ".Lthen", e);
+    } else {
+        // Branch to the else arm or the end if it doesn't.
+        if (node->els)
+            push_second_arm(node->els, ".Lelse", e, c, cold_else);
+        push_task(TASK_GEN, node->then);
+        push_label_task(TASK_BRANCH, node->els ? ".Lelse" : ".Lend",
+                        node->els ? e : c);
+    }
+    push_task(TASK_GEN, node->cond);
+}
+
+void gen_binary(Node* node) {
+    pop("rdi");
+    pop("rax");
+
+    switch (node->kind) {
+        case NODE_ADD:
+            if (node->ty->base)
+                emit("  imul rdi, %d\n", size_of(node->ty->base));
+            emit("  add rax, rdi\n");
+            break;
+        case NODE_SUB:
+            if (node->ty->base)
+                emit("  imul rdi, %d\n", size_of(node->ty->base));
+            emit("  sub rax, rdi\n");
+            break;
+        case NODE_MUL:
+            emit("  imul rax, rdi\n");
+            break;
+        case NODE_DIV:
+            emit("  cqo\n");
+            emit("  idiv rdi\n");
+            break;
+        case NODE_EQ:
+            emit("  cmp rax, rdi\n");
+            emit("  sete al\n");
+            emit("  movzb rax, al\n");
+            break;
+        case NODE_NE:
+            emit("  cmp rax, rdi\n");
+            emit("  setne al\n");
+            emit("  movzb rax, al\n");
+            break;
+        case NODE_LT:
+            emit("  cmp rax, rdi\n");
+            emit("  setl al\n");
+            emit("  movzb rax, al\n");
+            break;
+        case NODE_LE:
+            emit("  cmp rax, rdi\n");
+            emit("  setle al\n");
+            emit("  movzb rax, al\n");
+            break;
+        default:
+            error("Invalid node");
+            break;
+    }
+
+    push("rax");
+}
+
+// Expand a TASK_GEN. Tasks are pushed in reverse order of execution.
+void gen_node(Node* node) {
     switch (node->kind) {
         case NODE_ADDR: {
-            gen_addr(node->lhs);
+            push_task(TASK_ADDR, node->lhs);
             return;
         }
         case NODE_ASSIGN: {
+            push_task(TASK_STORE, node);
+            push_task(TASK_GEN, node->rhs);
             gen_lval(node->lhs);
-            gen(node->rhs);
-            store(node->ty);
             return;
         }
         case NODE_BLOCK: {
-            for (Node* n = node->body; n; n = n->next) gen(n);
+            if (node->body) push_task(TASK_GEN_LIST, node->body);
             return;
         }
         case NODE_DEREF: {
-            gen(node->lhs);
-            if (node->ty->kind != TYPE_ARRAY) load(node->ty);
+            if (node->ty->kind != TYPE_ARRAY) push_task(TASK_LOAD, node);
+            push_task(TASK_GEN, node->lhs);
+            return;
+        }
+        case NODE_VECTOR_LOOP: {
+            gen_vector_loop(node);
             return;
         }
         case NODE_EXPR_STMT: {
-            gen(node->lhs);
-            printf("  add rsp, 8\n");
+            if (opt_level >= 1 && gen_increment(node->lhs)) return;
+            push_task(TASK_POP, node);
+            push_task(TASK_GEN, node->lhs);
             return;
         }
         case NODE_FOR: {
             int c = label_count++;
             int e = label_count++;
-            if (node->init) gen(node->init);
-            printf(".Lbegin%d:\n", c);
+            push_label_task(TASK_LABEL, ".Lend", e);
+            push_label_task(TASK_JUMP, ".Lbegin", c);
+            if (node->inc) push_task(TASK_GEN, node->inc);
+            push_task(TASK_GEN, node->then);
             if (node->cond) {
-                gen(node->cond);
-                printf("  pop rax\n");
-                printf("  cmp rax, 0\n");
-                printf("  je .Lend%d\n", e);
+                push_label_task(TASK_BRANCH, ".Lend", e);
+                push_task(TASK_GEN, node->cond);
             }
-            gen(node->then);
-            if (node->inc) gen(node->inc);
-            printf("  jmp .Lbegin%d\n", c);
-            printf(".Lend%d:\n", e);
+            push_label_task(TASK_LABEL, ".Lbegin", c);
+            if (node->init) push_task(TASK_GEN, node->init);
             return;
         }
         case NODE_FUNCALL: {
@@ -99,74 +633,81 @@ void gen(Node* node) {
                 args[count++] = arg;
             }
 
-            for (int i = count - 1; i >= 0; i--) {
-                gen(args[i]);
-            }
-
-            for (int i = 0; i < count && i < 6; i++) {
-                printf("  pop %s\n", argreg8[i]);
-            }
-            // Align stack to 16 bytes
-            int seq = label_count++;
-            printf("  mov rax, rsp\n");
-            printf("  and rax, 15\n");
-            printf("  jnz .Lcall%d\n", seq);
-            printf("  mov rax, 0\n");
-            printf("  call %s\n", node->funcname);
-            printf("  jmp .Lend%d\n", seq);
-            printf(".Lcall%d:\n", seq);
-            printf("  sub rsp, 8\n");
-            printf("  mov rax, 0\n");
-            printf("  call %s\n", node->funcname);
-            printf("  add rsp, 8\n");
-            printf(".Lend%d:\n", seq);
-            printf("  push rax\n");
+            // Arguments are evaluated from the last one.
+            push_task(TASK_CALL, node);
+            for (int i = 0; i < count; i++) push_task(TASK_GEN, args[i]);
+            return;
+        }
+        case NODE_INLINE: {
+            // Statements leave the value stack as they found it, so it has
+            // the same depth at every return.
+            begin_inline();
+            push_task(TASK_INLINE_END, node);
+            if (node->body) push_task(TASK_GEN_LIST, node->body);
+            return;
+        }
+        case NODE_INLINE_RETURN: {
+            push_label_task(TASK_JUMP, ".Linline",
+                            inline_labels[inline_len - 1]);
+            push_task(TASK_POP_RAX, node);
+            push_task(TASK_GEN, node->lhs);
             return;
         }
         case NODE_IF: {
             int c = label_count++;
             int e = label_count++;
-            gen(node->cond);
-            printf("  pop rax\n");
-            printf("  cmp rax, 0\n");
-            if (node->els) {
-                printf("  je .Lelse%d\n", e);
-            } else {
-                printf("  je .Lend%d\n", c);
+            push_label_task(TASK_LABEL, ".Lend", c);
+            if (node->counter && profile_count(node->counter) >= 0) {
+                gen_profiled_if(node, c, e);
+                return;
             }
-            gen(node->then);
-            printf("  jmp .Lend%d\n", c);
             if (node->els) {
-                printf(".Lelse%d:\n", e);
-                gen(node->els);
+                push_task(TASK_GEN, node->els);
+                push_label_task(TASK_LABEL, ".Lelse", e);
             }
-            printf(".Lend%d:\n", c);
+            push_label_task(TASK_JUMP, ".Lend", c);
+            push_task(TASK_GEN, node->then);
+            if (node->els)
+                push_label_task(TASK_BRANCH, ".Lelse", e);
+            else
+                push_label_task(TASK_BRANCH, ".Lend", c);
+            push_task(TASK_GEN, node->cond);
+            return;
+        }
+        case NODE_COUNTER: {
+            emit("  inc qword ptr [rip+.Lprof_counts+%d]\n", node->counter * 8);
             return;
         }
         case NODE_NULL: {
             return;
         }
         case NODE_NUM: {
-            printf("  push %d\n", node->val);
+            emit("  push %d\n", node->val);
+            depth++;
             return;
         }
         case NODE_RETURN: {
-            gen(node->lhs);
-            printf("  pop rax\n");
-            printf("  jmp .Lreturn%s\n", funcname);
+            if (is_tail_call(node->lhs)) {
+                push_task(TASK_TAIL_CALL, node->lhs);
+                for (Node* arg = node->lhs->args; arg; arg = arg->next)
+                    push_task(TASK_GEN, arg);
+                return;
+            }
+            push_task(TASK_RETURN, node);
+            push_task(TASK_GEN, node->lhs);
             return;
         }
         case NODE_WHILE: {
             int c = label_count++;
             int e = label_count++;
-            printf(".Lbegin%d:\n", c);
-            gen(node->cond);
-            printf("  pop rax\n");
-            printf("  cmp rax, 0\n");
-            printf("  je .Lend%d\n", e);
-            gen(node->then);
-            printf("  jmp .Lbegin%d\n", c);
-            printf(".Lend%d:\n", e);
+            emit(".Lbegin%d.%s:\n", c, funcname);
+            push_label_task(TASK_LABEL, ".Lend", e);
+            push_label_task(TASK_JUMP, ".Lbegin", c);
+            push_task(TASK_GEN, node->then);
+            if (node->cond) {
+                push_label_task(TASK_BRANCH, ".Lend", e);
+                push_task(TASK_GEN, node->cond);
+            }
             return;
         }
         case NODE_VAR: {
@@ -176,103 +717,467 @@ void gen(Node* node) {
         }
     }
 
-    gen(node->lhs);
-    gen(node->rhs);
+    push_task(TASK_BINARY, node);
+    push_task(TASK_GEN, node->rhs);
+    push_task(TASK_GEN, node->lhs);
+}
 
-    printf("  pop rdi\n");
-    printf("  pop rax\n");
+void gen(Node* node) {
+    int base = tasks_len;
+    push_task(TASK_GEN, node);
 
-    switch (node->kind) {
-        case NODE_ADD:
-            if (node->ty->base)
-                printf("  imul rdi, %d\n", size_of(node->ty->base));
-            printf("  add rax, rdi\n");
-            break;
-        case NODE_SUB:
-            if (node->ty->base)
-                printf("  imul rdi, %d\n", size_of(node->ty->base));
-            printf("  sub rax, rdi\n");
-            break;
-        case NODE_MUL:
-            printf("  imul rax, rdi\n");
-            break;
-        case NODE_DIV:
-            printf("  cqo\n");
-            printf("  idiv rdi\n");
-            break;
-        case NODE_EQ:
-            printf("  cmp rax, rdi\n");
-            printf("  sete al\n");
-            printf("  movzb rax, al\n");
-            break;
-        case NODE_NE:
-            printf("  cmp rax, rdi\n");
-            printf("  setne al\n");
-            printf("  movzb rax, al\n");
-            break;
-        case NODE_LT:
-            printf("  cmp rax, rdi\n");
-            printf("  setl al\n");
-            printf("  movzb rax, al\n");
-            break;
-        case NODE_LE:
-            printf("  cmp rax, rdi\n");
-            printf("  setle al\n");
-            printf("  movzb rax, al\n");
-            break;
-        default:
-            error("Invalid node");
-            break;
+    while (tasks_len > base) {
+        Task t = tasks[--tasks_len];
+        switch (t.kind) {
+            case TASK_GEN:
+                gen_node(t.node);
+                break;
+            case TASK_ADDR:
+                gen_addr(t.node);
+                break;
+            case TASK_GEN_LIST:
+                if (t.node->next) push_task(TASK_GEN_LIST, t.node->next);
+                push_task(TASK_GEN, t.node);
+                break;
+            case TASK_LOAD:
+                load(t.node->ty);
+                break;
+            case TASK_STORE:
+                store(t.node->ty);
+                break;
+            case TASK_POP:
+                emit("  add rsp, 8\n");
+                depth--;
+                break;
+            case TASK_RETURN:
+                pop("rax");
+                // Values left by calls with more than 6 arguments
+                if (!use_rbp && depth > 0)
+                    emit("  add rsp, %d\n", depth * 8);
+                emit("  jmp .Lreturn%s\n", funcname);
+                break;
+            case TASK_BRANCH:
+                pop("rax");
+                emit("  cmp rax, 0\n");
+                emit("  je %s%d.%s\n", t.label, t.seq, funcname);
+                break;
+            case TASK_BRANCH_NZ:
+                pop("rax");
+                emit("  cmp rax, 0\n");
+                emit("  jne %s%d.%s\n", t.label, t.seq, funcname);
+                break;
+            case TASK_JUMP:
+                emit("  jmp %s%d.%s\n", t.label, t.seq, funcname);
+                break;
+            case TASK_LABEL:
+                emit("%s%d.%s:\n", t.label, t.seq, funcname);
+                break;
+            case TASK_CALL:
+                gen_call(t.node);
+                break;
+            case TASK_TAIL_CALL:
+                gen_tail_call(t.node);
+                break;
+            case TASK_BINARY:
+                gen_binary(t.node);
+                break;
+            case TASK_POP_RAX:
+                pop("rax");
+                break;
+            case TASK_INLINE_END:
+                end_inline();
+                break;
+            case TASK_COLD_BEGIN:
+                emit(".pushsection .text.unlikely,\"ax\",@progbits\n");
+                break;
+            case TASK_COLD_END:
+                emit(".popsection\n");
+                break;
+        }
     }
+}
+
+// Alignment of the global `var`. Arrays of 16 bytes or more are aligned
+// to 16 as the ABI requires, and larger ones to 32 or 64 so that vector
+// loads of their start don't cross a cache line.
+int data_align(Var* var) {
+    Type* ty = var->ty;
+    int size = size_of(ty);
+    if (ty->kind == TYPE_ARRAY && size >= 16)
+        return size >= 64 ? 64 : size >= 32 ? 32 : 16;
+    while (ty->kind == TYPE_ARRAY) ty = ty->base;
+    return size_of(ty);
+}
 
-    printf("  push rax\n");
+// Whether the global `var` starts with a nonzero value
+bool has_init(Var* var) {
+    for (int i = 0; i < var->init_len; i++)
+        if (var->init[i]) return true;
+    return false;
 }
 
+// Emit the globals with a nonzero initial value to .data and the others to
+// .bss, which takes no space in the executable.
 void emit_data(Program* prog) {
-    printf(".data\n");
+    emit(".data\n");
+    for (VarList* vl = prog->globals; vl; vl = vl->next) {
+        Var* var = vl->var;
+        if (!has_init(var)) continue;
+        int len = var->init_len;
+        while (!var->init[len - 1]) len--;
+        emit(".align %d\n", data_align(var));
+        emit("%s:\n", var->name);
+        for (int i = 0; i < len; i += 8) {
+            emit("  .long %d", var->init[i]);
+            for (int j = i + 1; j < len && j < i + 8; j++)
+                emit(", %d", var->init[j]);
+            emit("\n");
+        }
+        if (size_of(var->ty) > len * 4)
+            emit("  .zero %d\n", size_of(var->ty) - len * 4);
+    }
+
+    emit(".bss\n");
     for (VarList* vl = prog->globals; vl; vl = vl->next) {
         Var* var = vl->var;
-        printf("%s:\n", var->name);
-        printf("  .zero %d\n", size_of(var->ty));
+        if (has_init(var)) continue;
+        emit(".align %d\n", data_align(var));
+        emit("%s:\n", var->name);
+        emit("  .zero %d\n", size_of(var->ty));
     }
 }
 
+void find_call(Node* node, void* has_call) {
+    if (node->kind == NODE_FUNCALL) *(bool*)has_call = true;
+}
+
+// Whether `fn` makes no calls
+bool is_leaf(Function* fn) {
+    bool has_call = false;
+    visit_nodes(fn->node, find_call, &has_call);
+    return !has_call;
+}
+
+// Slot `i` of the two frame slots of -finstrument-functions, below the
+// locals
+char* instrument_slot(int i) {
+    static char buf[32];
+    if (use_rbp)
+        sprintf(buf, "[rbp-%d]", stack_size - i * 8);
+    else
+        sprintf(buf, "[rsp+%d]", i * 8);
+    return buf;
+}
+
+// Start timing the function with entry `index` in .Linstr_table. The first
+// frame slot keeps the time stamp at entry and the second one the cycles
+// of callees of the caller so far, while .Linstr_callees counts those of
+// our own callees.
+void emit_instrument_entry(int index) {
+    emit("  inc qword ptr [rip+.Linstr_table+%d]\n", index * 32);
+    emit("  inc qword ptr [rip+.Linstr_table+%d]\n", index * 32 + 24);
+    emit("  mov rax, [rip+.Linstr_callees]\n");
+    emit("  mov %s, rax\n", instrument_slot(1));
+    emit("  mov qword ptr [rip+.Linstr_callees], 0\n");
+    emit("  rdtsc\n");
+    emit("  shl rdx, 32\n");
+    emit("  or rax, rdx\n");
+    emit("  mov %s, rax\n", instrument_slot(0));
+}
+
+// Add the cycles since entry to the function with entry `index`, keeping
+// the return value in RAX. Inclusive cycles are only added when the
+// outermost activation of a recursive function returns, so that they
+// aren't counted twice.
+void emit_instrument_exit(int index) {
+    int seq = label_count++;
+    emit("  mov rcx, rax\n");
+    emit("  rdtsc\n");
+    emit("  shl rdx, 32\n");
+    emit("  or rax, rdx\n");
+    emit("  sub rax, %s\n", instrument_slot(0));
+    emit("  mov rdx, rax\n");
+    emit("  sub rdx, [rip+.Linstr_callees]\n");
+    emit("  add [rip+.Linstr_table+%d], rdx\n", index * 32 + 16);
+    emit("  dec qword ptr [rip+.Linstr_table+%d]\n", index * 32 + 24);
+    emit("  jnz .Linstr_nested%d.%s\n", seq, funcname);
+    emit("  add [rip+.Linstr_table+%d], rax\n", index * 32 + 8);
+    emit(".Linstr_nested%d.%s:\n", seq, funcname);
+    emit("  add rax, %s\n", instrument_slot(1));
+    emit("  mov [rip+.Linstr_callees], rax\n");
+    emit("  mov rax, rcx\n");
+}
+
 void emit_text(Program* prog) {
-    printf(".text\n");
-    for (Function* fn = prog->funcs; fn; fn = fn->next) {
+    int index = 0;
+    for (Function* fn = prog->funcs; fn; fn = fn->next, index++) {
+        if (fn->cached) {
+            fputs(fn->cached, stdout);
+            continue;
+        }
         funcname = fn->name;
-        printf(".global %s\n", funcname);
-        printf("%s:\n", funcname);
+        label_count = 0;
+        const_pool_len = 0;
+        emit_capture = cache_enabled();
+        emit_len = 0;
+        if (is_cold_function(fn))
+            emit(".section .text.unlikely,\"ax\",@progbits\n");
+        else
+            emit(".text\n");
+        emit(".global %s\n", funcname);
+        emit("%s:\n", funcname);
 
-        // Prologue
-        printf("  push rbp\n");
-        printf("  mov rbp, rsp\n");
-        printf("  sub rsp, %d\n", fn->stack_size);
+        // Leaf functions don't need RBP for a debugger or unwinder to walk
+        // through them, so they go without it from -O1 on. The value stack
+        // lives below RSP, so the red zone can't hold locals here.
+        use_rbp = !opt_omit_frame_pointer && (opt_level < 1 || !is_leaf(fn));
+        stack_size = fn->stack_size;
+        if (opt_instrument_functions) stack_size += 16;
+        depth = 0;
+        nparams = 0;
+        for (VarList* vl = fn->params; vl; vl = vl->next) nparams++;
+        frame_escapes = false;
+        for (VarList* vl = fn->locals; vl; vl = vl->next)
+            if (vl->var->addr_taken || vl->var->ty->kind == TYPE_ARRAY)
+                frame_escapes = true;
+
+        // Prologue. Without RBP, 8 more bytes keep RSP 16-byte aligned.
+        if (use_rbp) {
+            emit("  push rbp\n");
+            emit("  mov rbp, rsp\n");
+            emit("  sub rsp, %d\n", stack_size);
+        } else {
+            emit("  sub rsp, %d\n", stack_size + 8);
+        }
+        if (opt_level >= 2) emit(".Lentry%s:\n", funcname);
 
         // Push arguments to stack
         int arg_offset = 0;
         for (VarList* vl = fn->params; vl; vl = vl->next) {
             Var* var = vl->var;
+            char* reg;
             if (var->ty->kind == TYPE_INT)
-                printf("  mov [rbp-%d], %s\n", var->offset,
-                       argreg4[arg_offset++]);
+                reg = argreg4[arg_offset++];
             else if (var->ty->kind == TYPE_PTR)
-                printf("  mov [rbp-%d], %s\n", var->offset,
-                       argreg8[arg_offset++]);
+                reg = argreg8[arg_offset++];
+            else
+                continue;
+
+            if (use_rbp)
+                emit("  mov [rbp-%d], %s\n", var->offset, reg);
+            else
+                emit("  mov [rsp+%d], %s\n", stack_size - var->offset, reg);
         }
 
+        if (opt_instrument_functions) emit_instrument_entry(index);
+
         for (Node* node = fn->node; node; node = node->next) gen(node);
 
         // Epilogue
-        printf(".Lreturn%s:\n", funcname);
-        printf("  mov rsp, rbp\n");
-        printf("  pop rbp\n");
-        printf("  ret\n");
+        emit(".Lreturn%s:\n", funcname);
+        if (opt_instrument_functions) emit_instrument_exit(index);
+        if (use_rbp) {
+            emit("  mov rsp, rbp\n");
+            emit("  pop rbp\n");
+        } else {
+            emit("  add rsp, %d\n", stack_size + 8);
+        }
+        emit("  ret\n");
+        emit_const_pool();
+
+        if (emit_capture) {
+            fwrite(emit_buf, 1, emit_len, stdout);
+            cache_store(fn, emit_buf, emit_len);
+            emit_capture = false;
+        }
     }
 }
 
+// Emit `str` as a string literal for the assembler.
+void emit_string(char* str) {
+    emit("  .string \"");
+    for (char* p = str; *p; p++) {
+        if (*p == '"' || *p == '\\')
+            emit("\\%c", *p);
+        else if (isprint((unsigned char)*p))
+            emit("%c", *p);
+        else
+            emit("\\%03o", (unsigned char)*p);
+    }
+    emit("\"\n");
+}
+
+// Emit the profile counters of -fprofile-generate and the code writing
+// them to the profile file at exit. Each counter has an entry of the
+// function name and the index of the counter in the function in a table,
+// which a loop passes to fprintf() with the count.
+void emit_profile() {
+    emit(".bss\n");
+    emit(".align 8\n");
+    emit(".Lprof_counts:\n");
+    emit("  .zero %d\n", (counters_len + 1) * 8);
+    emit(".data\n");
+    emit(".align 8\n");
+    emit(".Lprof_table:\n");
+    for (int i = 0; i < profile_funcs_len; i++)
+        for (int j = 0; j < profile_funcs[i].len; j++)
+            emit("  .quad .Lprof_name%d, %d\n", i, j);
+    emit(".section .rodata\n");
+    for (int i = 0; i < profile_funcs_len; i++) {
+        emit(".Lprof_name%d:\n", i);
+        emit_string(profile_funcs[i].name);
+    }
+    emit(".Lprof_path:\n");
+    emit_string(opt_profile_generate);
+    emit(".Lprof_mode:\n");
+    emit("  .string \"w\"\n");
+    emit(".Lprof_format:\n");
+    emit("  .string \"%%s %%ld %%ld\\n\"\n");
+
+    // Three pushes keep RSP 16-byte aligned for the calls.
+    emit(".text\n");
+    emit(".Lprof_dump:\n");
+    emit("  push rbx\n");
+    emit("  push r12\n");
+    emit("  push r13\n");
+    emit("  lea rdi, [rip+.Lprof_path]\n");
+    emit("  lea rsi, [rip+.Lprof_mode]\n");
+    emit("  call fopen@PLT\n");
+    emit("  cmp rax, 0\n");
+    emit("  je .Lprof_done\n");
+    emit("  mov r12, rax\n");
+    emit("  lea r13, [rip+.Lprof_table]\n");
+    emit("  mov rbx, 1\n");
+    emit(".Lprof_loop:\n");
+    emit("  cmp rbx, %d\n", counters_len);
+    emit("  jg .Lprof_close\n");
+    emit("  mov rdi, r12\n");
+    emit("  lea rsi, [rip+.Lprof_format]\n");
+    emit("  mov rdx, [r13]\n");
+    emit("  mov rcx, [r13+8]\n");
+    emit("  lea rax, [rip+.Lprof_counts]\n");
+    emit("  mov r8, [rax+rbx*8]\n");
+    emit("  mov eax, 0\n");
+    emit("  call fprintf@PLT\n");
+    emit("  add r13, 16\n");
+    emit("  add rbx, 1\n");
+    emit("  jmp .Lprof_loop\n");
+    emit(".Lprof_close:\n");
+    emit("  mov rdi, r12\n");
+    emit("  call fclose@PLT\n");
+    emit(".Lprof_done:\n");
+    emit("  pop r13\n");
+    emit("  pop r12\n");
+    emit("  pop rbx\n");
+    emit("  ret\n");
+
+    // Registered with atexit() before main() runs
+    emit(".Lprof_init:\n");
+    emit("  sub rsp, 8\n");
+    emit("  lea rdi, [rip+.Lprof_dump]\n");
+    emit("  call atexit@PLT\n");
+    emit("  add rsp, 8\n");
+    emit("  ret\n");
+    emit(".section .init_array,\"aw\"\n");
+    emit(".align 8\n");
+    emit("  .quad .Lprof_init\n");
+}
+
+// Emit the table of -finstrument-functions and the code printing it to
+// standard error at exit. Each function has 4 counters: calls, inclusive
+// cycles, exclusive cycles and activations running.
+void emit_instrument_table(Program* prog) {
+    int len = 0;
+    for (Function* fn = prog->funcs; fn; fn = fn->next) len++;
+    emit(".bss\n");
+    emit(".align 8\n");
+    emit(".Linstr_callees:\n");
+    emit("  .zero 8\n");
+    emit(".Linstr_table:\n");
+    emit("  .zero %d\n", len * 32);
+    emit(".data\n");
+    emit(".align 8\n");
+    emit(".Linstr_names:\n");
+    for (int i = 0; i < len; i++) emit("  .quad .Linstr_name%d\n", i);
+    emit(".section .rodata\n");
+    int index = 0;
+    for (Function* fn = prog->funcs; fn; fn = fn->next) {
+        emit(".Linstr_name%d:\n", index++);
+        emit_string(fn->name);
+    }
+    emit(".Linstr_header:\n");
+    emit("  .string \"%%-24s %%12s %%16s %%16s\\n\"\n");
+    emit(".Linstr_format:\n");
+    emit("  .string \"%%-24s %%12ld %%16ld %%16ld\\n\"\n");
+    emit(".Linstr_function:\n");
+    emit("  .string \"function\"\n");
+    emit(".Linstr_calls:\n");
+    emit("  .string \"calls\"\n");
+    emit(".Linstr_inclusive:\n");
+    emit("  .string \"inclusive\"\n");
+    emit(".Linstr_exclusive:\n");
+    emit("  .string \"exclusive\"\n");
+
+    // Functions never called are left out. Two pushes and the return
+    // address keep RSP 16-byte aligned for the calls.
+    emit(".text\n");
+    emit(".Linstr_dump:\n");
+    emit("  push rbx\n");
+    emit("  push r12\n");
+    emit("  sub rsp, 8\n");
+    emit("  mov edi, 2\n");
+    emit("  lea rsi, [rip+.Linstr_header]\n");
+    emit("  lea rdx, [rip+.Linstr_function]\n");
+    emit("  lea rcx, [rip+.Linstr_calls]\n");
+    emit("  lea r8, [rip+.Linstr_inclusive]\n");
+    emit("  lea r9, [rip+.Linstr_exclusive]\n");
+    emit("  mov eax, 0\n");
+    emit("  call dprintf@PLT\n");
+    emit("  mov rbx, 0\n");
+    emit(".Linstr_loop:\n");
+    emit("  cmp rbx, %d\n", len);
+    emit("  je .Linstr_done\n");
+    emit("  mov r12, rbx\n");
+    emit("  shl r12, 5\n");
+    emit("  lea rax, [rip+.Linstr_table]\n");
+    emit("  add r12, rax\n");
+    emit("  mov rcx, [r12]\n");
+    emit("  cmp rcx, 0\n");
+    emit("  je .Linstr_next\n");
+    emit("  mov edi, 2\n");
+    emit("  lea rsi, [rip+.Linstr_format]\n");
+    emit("  lea rax, [rip+.Linstr_names]\n");
+    emit("  mov rdx, [rax+rbx*8]\n");
+    emit("  mov r8, [r12+8]\n");
+    emit("  mov r9, [r12+16]\n");
+    emit("  mov eax, 0\n");
+    emit("  call dprintf@PLT\n");
+    emit(".Linstr_next:\n");
+    emit("  add rbx, 1\n");
+    emit("  jmp .Linstr_loop\n");
+    emit(".Linstr_done:\n");
+    emit("  add rsp, 8\n");
+    emit("  pop r12\n");
+    emit("  pop rbx\n");
+    emit("  ret\n");
+
+    // Registered with atexit() before main() runs
+    emit(".Linstr_init:\n");
+    emit("  sub rsp, 8\n");
+    emit("  lea rdi, [rip+.Linstr_dump]\n");
+    emit("  call atexit@PLT\n");
+    emit("  add rsp, 8\n");
+    emit("  ret\n");
+    emit(".section .init_array,\"aw\"\n");
+    emit(".align 8\n");
+    emit("  .quad .Linstr_init\n");
+}
+
 void codegen(Program* prog) {
-    printf(".intel_syntax noprefix\n");
+    emit(".intel_syntax noprefix\n");
     emit_data(prog);
     emit_text(prog);
+    if (opt_profile_generate) emit_profile();
+    if (opt_instrument_functions) emit_instrument_table(prog);
+    emit(".section .note.GNU-stack,\"\",@progbits\n");
 }
@@ -0,0 +1,550 @@
+#include "ycc.h"
+
+// Local common subexpression elimination by value numbering. Within a run
+// of expression statements without control flow between them, each
+// expression gets a number identifying its value, hashed from its kind,
+// type and the numbers of its operands. A load also depends on the
+// version of memory it reads, which changes with every store through a
+// pointer, call and assignment to a global or address-taken variable.
+// Reading a variable gives the number of its last assignment.
+//
+// When an expression is computed again with a known number, the first
+// occurrence is turned into an assignment to a fresh local, which every
+// later occurrence reads instead:
+//
+//   x = a[i * n + j] * a[i * n + j]; y = x + (i * n + j);
+//
+// becomes
+//
+//   x = (tmp1 = a[tmp2 = i * n + j]) * tmp1; y = x + tmp2;
+//
+// The language has no short-circuit operators, so every subexpression of
+// a statement is computed, and the first occurrence runs before the later
+// ones. Only statements whose single side effect is the assignment at
+// their root are rewritten; others only clobber what they may change.
+
+// Fewest nodes of an expression worth saving in a local
+#define MIN_CSE_SIZE 4
+
+// A node of the statement being numbered, in the order it is computed
+typedef struct {
+    Node* node;   // The node
+    int lhs;      // Index of the left operand, or -1
+    int rhs;      // Index of the right operand, or -1
+    int size;     // Number of nodes of the subtree
+    int vn;       // Value number
+    bool lvalue;  // Whether the node is assigned or has "&" applied
+} CseItem;
+
+CseItem* cse_items;
+int cse_items_len;
+int cse_items_cap;
+
+// Key of an expression in the value table
+typedef struct {
+    NodeKind kind;    // Node kind
+    TypeKind tykind;  // Kind of its type
+    int lhs;          // Value numbers of the operands, or 0
+    int rhs;
+    long val;         // Number, or version of memory for loads
+    Var* var;         // Variable read, or NULL
+} ValueKey;
+
+// A slot of the hash table of values
+typedef struct {
+    ValueKey key;  // Expression
+    int vn;        // Its value number
+    int gen;       // Block in which the slot is used, see `cse_gen`
+} ValueSlot;
+
+ValueSlot* value_table;
+int value_table_cap;
+int value_table_len;
+int cse_gen;  // Current block; slots of other blocks are empty
+
+// First computation of each value number of the block
+typedef struct {
+    Node* first;  // First occurrence
+    Var* temp;    // Local holding the value, or NULL
+} ValueInfo;
+
+ValueInfo* values;
+int values_cap;
+int next_vn;
+
+// Value number of the last assignment of a variable read in the block. The
+// value of a variable in memory is only known while memory doesn't change.
+typedef struct {
+    Var* var;  // Variable
+    int vn;    // Its value number
+    int mem;   // Version of memory when the number was given
+    int gen;   // Block in which the slot is used, see `cse_gen`
+} VarSlot;
+
+VarSlot* var_table;
+int var_table_cap;
+int var_table_len;
+
+int mem_version;  // Version of memory read by loads
+
+// Fresh value number
+int new_vn() {
+    if (next_vn >= values_cap) {
+        values_cap = values_cap ? values_cap * 2 : 256;
+        values = counted_realloc(values, sizeof(ValueInfo) * values_cap);
+    }
+    values[next_vn].first = NULL;
+    values[next_vn].temp = NULL;
+    return next_vn++;
+}
+
+unsigned hash_key(ValueKey* key) {
+    unsigned h = 2166136261u;
+    unsigned long parts[] = {key->kind, key->tykind, key->lhs, key->rhs,
+                             key->val, (unsigned long)key->var};
+    for (int i = 0; i < 6; i++)
+        h = (h ^ (unsigned)(parts[i] ^ parts[i] >> 32)) * 16777619u;
+    return h;
+}
+
+bool same_key(ValueKey* a, ValueKey* b) {
+    return a->kind == b->kind && a->tykind == b->tykind && a->lhs == b->lhs &&
+           a->rhs == b->rhs && a->val == b->val && a->var == b->var;
+}
+
+void grow_value_table() {
+    ValueSlot* old = value_table;
+    int old_cap = value_table_cap;
+    value_table_cap = old_cap ? old_cap * 2 : 1024;
+    value_table = counted_calloc(value_table_cap, sizeof(ValueSlot));
+    value_table_len = 0;
+    for (int i = 0; i < old_cap; i++) {
+        if (old[i].gen != cse_gen) continue;
+        unsigned h = hash_key(&old[i].key) & (value_table_cap - 1);
+        while (value_table[h].gen == cse_gen)
+            h = (h + 1) & (value_table_cap - 1);
+        value_table[h] = old[i];
+        value_table_len++;
+    }
+    free(old);
+}
+
+// Value number of the expression `key`, numbered anew if it is not known
+int lookup_value(ValueKey* key) {
+    if (value_table_len * 2 >= value_table_cap) grow_value_table();
+    unsigned h = hash_key(key) & (value_table_cap - 1);
+    while (value_table[h].gen == cse_gen) {
+        if (same_key(&value_table[h].key, key)) return value_table[h].vn;
+        h = (h + 1) & (value_table_cap - 1);
+    }
+    value_table[h].key = *key;
+    value_table[h].vn = new_vn();
+    value_table[h].gen = cse_gen;
+    value_table_len++;
+    return value_table[h].vn;
+}
+
+// Whether reads of `var` may observe stores through pointers
+bool in_memory(Var* var) {
+    return (!var->is_local || var->addr_taken) &&
+           var->ty->kind != TYPE_ARRAY;
+}
+
+unsigned hash_var(Var* var) {
+    unsigned long h = (unsigned long)var * 0x9e3779b97f4a7c15ul;
+    return h >> 32;
+}
+
+void grow_var_table() {
+    VarSlot* old = var_table;
+    int old_cap = var_table_cap;
+    var_table_cap = old_cap ? old_cap * 2 : 256;
+    var_table = counted_calloc(var_table_cap, sizeof(VarSlot));
+    var_table_len = 0;
+    for (int i = 0; i < old_cap; i++) {
+        if (old[i].gen != cse_gen) continue;
+        unsigned h = hash_var(old[i].var) & (var_table_cap - 1);
+        while (var_table[h].gen == cse_gen)
+            h = (h + 1) & (var_table_cap - 1);
+        var_table[h] = old[i];
+        var_table_len++;
+    }
+    free(old);
+}
+
+// Slot of `var` in the table, added with no value number if it is new
+VarSlot* find_var_slot(Var* var) {
+    if (var_table_len * 2 >= var_table_cap) grow_var_table();
+    unsigned h = hash_var(var) & (var_table_cap - 1);
+    while (var_table[h].gen == cse_gen) {
+        if (var_table[h].var == var) return &var_table[h];
+        h = (h + 1) & (var_table_cap - 1);
+    }
+    VarSlot* slot = &var_table[h];
+    slot->var = var;
+    slot->vn = 0;
+    slot->gen = cse_gen;
+    var_table_len++;
+    return slot;
+}
+
+// Value number of a read of `var`
+int var_vn(Var* var) {
+    VarSlot* slot = find_var_slot(var);
+    if (!slot->vn || (in_memory(var) && slot->mem != mem_version)) {
+        slot->vn = new_vn();
+        slot->mem = mem_version;
+    }
+    return slot->vn;
+}
+
+// Record that `var` is assigned the value numbered `vn`, or an unknown
+// value if `vn` is 0.
+void assign_var(Var* var, int vn) {
+    if (in_memory(var)) mem_version++;
+    VarSlot* slot = find_var_slot(var);
+    slot->vn = vn ? vn : new_vn();
+    slot->mem = mem_version;
+}
+
+// Record a store through a pointer or a call.
+void clobber_memory() { mem_version++; }
+
+// Forget everything known, at the start of a block.
+void reset_values() {
+    cse_gen++;
+    value_table_len = 0;
+    next_vn = 1;
+    var_table_len = 0;
+    mem_version = 0;
+}
+
+// Whether the statement `stmt` has no side effect other than the
+// assignment at its root
+bool is_simple_stmt(Node* stmt) {
+    if (stmt->kind != NODE_EXPR_STMT) return false;
+    walk_len = 0;
+    push_walk(stmt->lhs->kind == NODE_ASSIGN ? stmt->lhs->lhs : stmt->lhs);
+    if (stmt->lhs->kind == NODE_ASSIGN) push_walk(stmt->lhs->rhs);
+    while (walk_len > 0) {
+        Node* n = walk_stack[--walk_len];
+        switch (n->kind) {
+            case NODE_ADD:
+            case NODE_SUB:
+            case NODE_MUL:
+            case NODE_DIV:
+            case NODE_EQ:
+            case NODE_NE:
+            case NODE_LT:
+            case NODE_LE:
+            case NODE_NUM:
+            case NODE_VAR:
+            case NODE_DEREF:
+            case NODE_ADDR:
+                push_children(n);
+                break;
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+// Work list of number_expr()
+typedef struct {
+    Node* node;
+    int parent;   // Index of the parent in cse_items, or -1
+    bool is_rhs;  // Whether the node is the right operand of the parent
+    bool lvalue;  // Whether the node is assigned or has "&" applied
+} CseWork;
+
+CseWork* cse_work;
+int cse_work_len;
+int cse_work_cap;
+
+void push_cse_work(Node* node, int parent, bool is_rhs, bool lvalue) {
+    if (!node) return;
+    if (cse_work_len == cse_work_cap) {
+        cse_work_cap = cse_work_cap ? cse_work_cap * 2 : 64;
+        cse_work = counted_realloc(cse_work, sizeof(CseWork) * cse_work_cap);
+    }
+    CseWork* w = &cse_work[cse_work_len++];
+    w->node = node;
+    w->parent = parent;
+    w->is_rhs = is_rhs;
+    w->lvalue = lvalue;
+}
+
+// Value number of cse_items[i], whose operands are numbered
+int number_item(int i) {
+    CseItem* item = &cse_items[i];
+    Node* n = item->node;
+    if (item->lvalue || n->kind == NODE_ASSIGN) return 0;
+    if (n->kind == NODE_VAR && n->var->ty->kind != TYPE_ARRAY)
+        return var_vn(n->var);
+
+    ValueKey key;
+    memset(&key, 0, sizeof(ValueKey));
+    key.kind = n->kind;
+    key.tykind = n->ty->kind;
+    if (item->lhs >= 0) key.lhs = cse_items[item->lhs].vn;
+    if (item->rhs >= 0) key.rhs = cse_items[item->rhs].vn;
+    switch (n->kind) {
+        case NODE_NUM:
+            key.val = n->val;
+            break;
+        case NODE_VAR:
+            key.var = n->var;
+            break;
+        case NODE_ADDR: {
+            // &*x is x, and &var is a constant
+            CseItem* lhs = &cse_items[item->lhs];
+            if (lhs->node->kind == NODE_VAR)
+                key.var = lhs->node->var;
+            else
+                key.lhs = cse_items[lhs->lhs].vn;
+            break;
+        }
+        case NODE_DEREF:
+            if (n->ty->kind != TYPE_ARRAY) key.val = mem_version;
+            break;
+        default:
+            break;
+    }
+    return lookup_value(&key);
+}
+
+// List the nodes of the expression `expr` in cse_items in the order they
+// are computed, each before its operands.
+void list_expr(Node* expr) {
+    // The right operand is pushed first, so the left one is listed first.
+    cse_items_len = 0;
+    cse_work_len = 0;
+    push_cse_work(expr, -1, false, false);
+    while (cse_work_len > 0) {
+        CseWork w = cse_work[--cse_work_len];
+        if (cse_items_len == cse_items_cap) {
+            cse_items_cap = cse_items_cap ? cse_items_cap * 2 : 64;
+            cse_items =
+                counted_realloc(cse_items, sizeof(CseItem) * cse_items_cap);
+        }
+        int i = cse_items_len++;
+        cse_items[i].node = w.node;
+        cse_items[i].lhs = -1;
+        cse_items[i].rhs = -1;
+        cse_items[i].lvalue = w.lvalue;
+        if (w.parent >= 0) {
+            if (w.is_rhs)
+                cse_items[w.parent].rhs = i;
+            else
+                cse_items[w.parent].lhs = i;
+        }
+        Node* n = w.node;
+        push_cse_work(n->rhs, i, true, false);
+        push_cse_work(n->lhs, i, false,
+                      n->kind == NODE_ASSIGN || n->kind == NODE_ADDR);
+    }
+}
+
+// List the nodes of the expression `expr` and number their values.
+void number_expr(Node* expr) {
+    list_expr(expr);
+
+    // Operands come after their parents, so a reverse pass sees them first.
+    for (int i = cse_items_len - 1; i >= 0; i--) {
+        CseItem* item = &cse_items[i];
+        item->size = 1;
+        if (item->lhs >= 0) item->size += cse_items[item->lhs].size;
+        if (item->rhs >= 0) item->size += cse_items[item->rhs].size;
+        item->vn = number_item(i);
+    }
+}
+
+// Whether reusing the value of `item` saves computing it again. Storing
+// the value and loading it back costs about as much as an operation on a
+// variable and a number, so smaller expressions are computed again.
+bool worth_reusing(CseItem* item) {
+    if (item->lvalue || item->size < MIN_CSE_SIZE) return false;
+    switch (item->node->kind) {
+        case NODE_ADD:
+        case NODE_SUB:
+        case NODE_MUL:
+        case NODE_DIV:
+        case NODE_EQ:
+        case NODE_NE:
+        case NODE_LT:
+        case NODE_LE:
+        case NODE_DEREF:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Whether `stmt` is `var = var + x` or `var = var - x` for a number or
+// variable x, which codegen turns into one instruction
+bool is_increment(Node* stmt) {
+    Node* e = stmt->lhs;
+    return e->kind == NODE_ASSIGN && e->lhs->kind == NODE_VAR &&
+           (e->rhs->kind == NODE_ADD || e->rhs->kind == NODE_SUB) &&
+           e->rhs->lhs->kind == NODE_VAR && e->rhs->lhs->var == e->lhs->var &&
+           (e->rhs->rhs->kind == NODE_NUM || e->rhs->rhs->kind == NODE_VAR);
+}
+
+// Statements whose nodes were replaced or moved, to be typed again
+Node** cse_dirty;
+int cse_dirty_len;
+int cse_dirty_cap;
+
+void mark_dirty(Node* stmt) {
+    if (cse_dirty_len == cse_dirty_cap) {
+        cse_dirty_cap = cse_dirty_cap ? cse_dirty_cap * 2 : 16;
+        cse_dirty = counted_realloc(cse_dirty, sizeof(Node*) * cse_dirty_cap);
+    }
+    cse_dirty[cse_dirty_len++] = stmt;
+}
+
+// Function being processed and statement of each first occurrence
+Function* cse_fn;
+Node** first_stmt;
+int first_stmt_cap;
+
+// Reuse the values that the simple statement `stmt` computes again.
+void eliminate(Node* stmt) {
+    number_expr(stmt->lhs);
+    if (next_vn > first_stmt_cap) {
+        first_stmt_cap = values_cap;
+        first_stmt =
+            counted_realloc(first_stmt, sizeof(Node*) * first_stmt_cap);
+    }
+    bool rewrite = !is_increment(stmt);
+    for (int i = 0; i < cse_items_len; i++) {
+        CseItem* item = &cse_items[i];
+        if (!rewrite || !worth_reusing(item)) continue;
+        ValueInfo* v = &values[item->vn];
+        if (!v->first) {
+            v->first = item->node;
+            first_stmt[item->vn] = stmt;
+            continue;
+        }
+
+        // Save the first occurrence in a local.
+        if (!v->temp) {
+            Node* first = v->first;
+            v->temp = new_temp(cse_fn, first->ty);
+            Node* copy = new_node(first->kind);
+            *copy = *first;
+            memset(first, 0, sizeof(Node));
+            first->kind = NODE_ASSIGN;
+            first->lhs = new_var(v->temp);
+            first->rhs = copy;
+            mark_dirty(first_stmt[item->vn]);
+        }
+        Node* n = item->node;
+        memset(n, 0, sizeof(Node));
+        n->kind = NODE_VAR;
+        n->var = v->temp;
+        mark_dirty(stmt);
+        i += item->size - 1;
+    }
+
+    // The stored value is the one of the right side if no conversion
+    // happens on the way.
+    Node* e = stmt->lhs;
+    if (e->kind != NODE_ASSIGN) return;
+    if (e->lhs->kind != NODE_VAR) {
+        clobber_memory();
+        return;
+    }
+    Var* var = e->lhs->var;
+    bool same = same_type(var->ty, e->rhs->ty);
+    assign_var(var, same ? cse_items[cse_items[0].rhs].vn : 0);
+}
+
+// Record the assignments of the statement `stmt`, which may also call
+// functions.
+void clobber_stmt(Node* stmt) {
+    walk_len = 0;
+    push_walk(stmt);
+    while (walk_len > 0) {
+        Node* n = walk_stack[--walk_len];
+        if (n->kind == NODE_ASSIGN && n->lhs->kind == NODE_VAR)
+            assign_var(n->lhs->var, 0);
+        push_children(n);
+    }
+    clobber_memory();
+}
+
+// Type the expression `expr` again, operands first.
+void retype(Node* expr) {
+    list_expr(expr);
+    for (int i = cse_items_len - 1; i >= 0; i--) type_node(cse_items[i].node);
+}
+
+// Eliminate the common subexpressions of the statement list `list`.
+void cse_list(Node* list) {
+    reset_values();
+    cse_dirty_len = 0;
+    for (Node* stmt = list; stmt; stmt = stmt->next) {
+        if (is_simple_stmt(stmt)) {
+            eliminate(stmt);
+        } else if (stmt->kind == NODE_EXPR_STMT) {
+            clobber_stmt(stmt);
+        } else if (stmt->kind != NODE_NULL && stmt->kind != NODE_COUNTER) {
+            reset_values();
+        }
+    }
+    for (int i = 0; i < cse_dirty_len; i++) retype(cse_dirty[i]->lhs);
+}
+
+// Statement lists of the function being processed
+Node** cse_lists;
+int cse_lists_len;
+int cse_lists_cap;
+Node* vector_body;  // Body of the last vectorized loop seen
+
+void add_cse_list(Node* list) {
+    if (!list || list == vector_body) return;
+    if (cse_lists_len == cse_lists_cap) {
+        cse_lists_cap = cse_lists_cap ? cse_lists_cap * 2 : 16;
+        cse_lists = counted_realloc(cse_lists, sizeof(Node*) * cse_lists_cap);
+    }
+    cse_lists[cse_lists_len++] = list;
+}
+
+// Vectorized loops are left alone, so that codegen still recognizes them.
+void find_lists(Node* node, void* arg) {
+    switch (node->kind) {
+        case NODE_VECTOR_LOOP:
+            vector_body = node->then;
+            return;
+        case NODE_BLOCK:
+        case NODE_INLINE:
+            if (node != vector_body) add_cse_list(node->body);
+            return;
+        case NODE_IF:
+        case NODE_WHILE:
+        case NODE_FOR:
+            if (node->then->kind == NODE_EXPR_STMT) add_cse_list(node->then);
+            if (node->els && node->els->kind == NODE_EXPR_STMT)
+                add_cse_list(node->els);
+            return;
+        default:
+            return;
+    }
+}
+
+void cse(Program* prog) {
+    for (Function* fn = prog->funcs; fn; fn = fn->next) {
+        for (VarList* vl = fn->locals; vl; vl = vl->next)
+            vl->var->addr_taken = false;
+        visit_nodes(fn->node, find_addr, NULL);
+
+        cse_fn = fn;
+        cse_lists_len = 0;
+        vector_body = NULL;
+        add_cse_list(fn->node);
+        visit_nodes(fn->node, find_lists, NULL);
+        for (int i = 0; i < cse_lists_len; i++) cse_list(cse_lists[i]);
+    }
+}
@@ -0,0 +1,190 @@
+#include "ycc.h"
+
+// Dead code elimination. Statements after a statement that never falls
+// through are dropped, `if`, `while` and `for` with constant conditions
+// are reduced to the code that can run, and expression statements without
+// side effects are deleted. The same is done in the bodies of inlined
+// calls, and an inlined call that only returns an expression is replaced
+// by it. unused_functions() reports or removes the functions that the
+// program never calls.
+
+Node* dce_list(Node* list);
+
+// Whether control never reaches the statement after `node`. The language
+// has no break, so a loop without a condition only exits by returning.
+bool never_falls_through(Node* node) {
+    switch (node->kind) {
+        case NODE_RETURN:
+        case NODE_INLINE_RETURN:
+            return true;
+        case NODE_BLOCK:
+            for (Node* n = node->body; n; n = n->next)
+                if (never_falls_through(n)) return true;
+            return false;
+        case NODE_IF:
+            return node->els && never_falls_through(node->then) &&
+                   never_falls_through(node->els);
+        case NODE_WHILE:
+        case NODE_FOR:
+            return !node->cond;
+        default:
+            return false;
+    }
+}
+
+// Value of a constant condition. Returns -1 if `cond` is not constant.
+int const_cond(Node* cond) {
+    long val;
+    if (!eval_const(cond, &val)) return -1;
+    return val != 0;
+}
+
+// Return `node` with its dead code removed, or NULL if nothing of it needs
+// to run.
+Node* dce_stmt(Node* node) {
+    switch (node->kind) {
+        case NODE_EXPR_STMT:
+            return has_side_effects(node->lhs) ? node : NULL;
+        case NODE_NULL:
+            return NULL;
+        case NODE_BLOCK:
+            node->body = dce_list(node->body);
+            return node->body ? node : NULL;
+        case NODE_IF: {
+            int cond = const_cond(node->cond);
+            Node* then = dce_stmt(node->then);
+            Node* els = node->els ? dce_stmt(node->els) : NULL;
+            if (cond == 1) return then;
+            if (cond == 0) return els;
+            if (!then && !els && !has_side_effects(node->cond)) return NULL;
+            node->then = then ? then : new_node(NODE_NULL);
+            node->els = els;
+            return node;
+        }
+        case NODE_WHILE: {
+            int cond = node->cond ? const_cond(node->cond) : 1;
+            if (cond == 0) return NULL;
+            if (cond == 1) node->cond = NULL;
+            node->then = dce_stmt(node->then);
+            if (!node->then) node->then = new_node(NODE_NULL);
+            return node;
+        }
+        case NODE_FOR: {
+            if (node->init) node->init = dce_stmt(node->init);
+            int cond = node->cond ? const_cond(node->cond) : 1;
+            if (cond == 0) return node->init;
+            if (cond == 1) node->cond = NULL;
+            if (node->inc) node->inc = dce_stmt(node->inc);
+            node->then = dce_stmt(node->then);
+            if (!node->then) node->then = new_node(NODE_NULL);
+            return node;
+        }
+        default:
+            return node;
+    }
+}
+
+// Remove the dead code of the statement list `list` and return the new
+// list.
+Node* dce_list(Node* list) {
+    Node head;
+    head.next = NULL;
+    Node* cur = &head;
+    for (Node* n = list; n;) {
+        Node* next = n->next;
+        Node* live = dce_stmt(n);
+        if (live) {
+            live->next = NULL;
+            cur = cur->next = live;
+            if (never_falls_through(live)) break;
+        }
+        n = next;
+    }
+    return head.next;
+}
+
+// Inlined calls of the function being cleaned up
+Node** inlines;
+int inlines_len;
+int inlines_cap;
+
+void find_inline(Node* node, void* arg) {
+    if (node->kind != NODE_INLINE) return;
+    if (inlines_len == inlines_cap) {
+        inlines_cap = inlines_cap ? inlines_cap * 2 : 16;
+        inlines = counted_realloc(inlines, sizeof(Node*) * inlines_cap);
+    }
+    inlines[inlines_len++] = node;
+}
+
+void dce(Program* prog) {
+    for (Function* fn = prog->funcs; fn; fn = fn->next) {
+        fn->node = dce_list(fn->node);
+
+        // visit_nodes() visits outer nodes first, so inner inlined calls
+        // are done first here. An outer call collapsing into an inner one
+        // then copies it in its final form.
+        inlines_len = 0;
+        visit_nodes(fn->node, find_inline, NULL);
+        for (int i = inlines_len - 1; i >= 0; i--) {
+            Node* node = inlines[i];
+            node->body = dce_list(node->body);
+            if (node->body && !node->body->next &&
+                node->body->kind == NODE_INLINE_RETURN) {
+                Node* next = node->next;
+                *node = *node->body->lhs;
+                node->next = next;
+            }
+        }
+    }
+}
+
+// State of the call graph walk below
+bool* called;
+int* pending;
+int npending;
+
+void mark_called(char* name) {
+    int i = find_function(name);
+    if (i < 0 || called[i]) return;
+    called[i] = true;
+    pending[npending++] = i;
+}
+
+void visit_call(Node* node, void* arg) {
+    if (node->kind == NODE_FUNCALL) mark_called(node->funcname);
+}
+
+// Find the functions that are not reachable from main() through calls.
+// With -Wunused-function they are reported, with -fremove-unused-functions
+// they are left out of the output. Programs without main() are left alone.
+void unused_functions(Program* prog) {
+    index_functions(prog);
+    if (find_function("main") < 0) return;
+
+    called = counted_calloc(funcs_len, sizeof(bool));
+    pending = counted_calloc(funcs_len, sizeof(int));
+    npending = 0;
+    mark_called("main");
+    while (npending > 0)
+        visit_nodes(funcs[pending[--npending]]->node, visit_call, NULL);
+
+    Function head;
+    head.next = NULL;
+    Function* cur = &head;
+    for (Function* fn = prog->funcs; fn; fn = fn->next) {
+        if (called[find_function(fn->name)]) {
+            cur = cur->next = fn;
+            continue;
+        }
+        if (opt_warn_unused_function)
+            fprintf(stderr, "warning: function '%s' is never called\n",
+                    fn->name);
+        if (!opt_remove_unused_functions) cur = cur->next = fn;
+    }
+    cur->next = NULL;
+    prog->funcs = head.next;
+
+    free(called);
+    free(pending);
+}
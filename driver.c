@@ -0,0 +1,309 @@
+#include "ycc.h"
+
+bool opt_time_report;              // -ftime-report
+bool opt_time_report_json;         // -ftime-report=json
+ScanLevel opt_lexer;               // --lexer
+bool opt_dump_tokens;              // --dump-tokens
+int opt_lex_threads = 1;           // --lex-threads
+bool opt_verify_types;             // --verify-types
+int opt_level = 1;                 // -O<level>
+bool opt_warn_unused_function;     // -Wunused-function
+bool opt_remove_unused_functions;  // -fremove-unused-functions
+bool opt_omit_frame_pointer;       // -fomit-frame-pointer
+bool opt_inline = true;            // -fno-inline
+int opt_inline_limit = 40;         // -finline-limit
+int opt_unroll_factor = -1;        // -funroll-factor, -1 for the default
+bool opt_vectorize = true;         // -fno-vectorize
+bool opt_avx2;                     // -mavx2
+char* opt_profile_generate;        // -fprofile-generate, file to write
+char* opt_profile_use;             // -fprofile-use, file to read
+bool opt_instrument_functions;     // -finstrument-functions
+char* opt_server;                  // --server, socket to listen on
+int opt_workers;                   // --workers, 0 for one per core
+char* opt_cache_dir;               // --cache, directory of the cache
+int opt_cache_size = 64;           // --cache-size, in MB
+bool opt_cache_stats;              // --cache-stats
+char* opt_emit_ast;                // --emit-ast, file to write
+char* opt_load_ast;                // --load-ast, file to read
+
+void usage() {
+    fprintf(stderr,
+            "Usage: ycc [-O<0-2>] [-Wunused-function] "
+            "[-fremove-unused-functions] [-fomit-frame-pointer] "
+            "[-fno-inline] [-finline-limit=N] [-funroll-factor=N] "
+            "[-fno-vectorize] [-mavx2] "
+            "[-fprofile-generate[=FILE]] [-fprofile-use[=FILE]] "
+            "[-finstrument-functions] "
+            "[-ftime-report[=json]] "
+            "[--cache=DIR] [--cache-size=MB] [--cache-stats] "
+            "[--lexer=auto|scalar|sse2|avx2] [--lex-threads=N] "
+            "[--dump-tokens] [--verify-types] [--emit-ast=FILE] "
+            "<program | ->\n"
+            "       ycc --load-ast=FILE [options]\n"
+            "       ycc --server[=SOCKET] [--workers=N] [options]\n");
+    exit(1);
+}
+
+// Read the whole standard input. Used when the program is given as "-".
+char* read_stdin() {
+    int cap = 4096;
+    int len = 0;
+    char* buf = malloc(cap);
+
+    for (;;) {
+        int n = fread(buf + len, 1, cap - len - 1, stdin);
+        if (n == 0) break;
+        len += n;
+        if (cap - len == 1) {
+            cap *= 2;
+            buf = realloc(buf, cap);
+        }
+    }
+
+    if (ferror(stdin)) error("Cannot read standard input");
+    buf[len] = '\0';
+    return buf;
+}
+
+void parse_args(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-ftime-report")) {
+            opt_time_report = true;
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-ftime-report=json")) {
+            opt_time_report = true;
+            opt_time_report_json = true;
+            continue;
+        }
+
+        if (!strncmp(argv[i], "--lexer=", 8)) {
+            char* arg = argv[i] + 8;
+            if (!strcmp(arg, "auto"))
+                opt_lexer = SCAN_AUTO;
+            else if (!strcmp(arg, "scalar"))
+                opt_lexer = SCAN_SCALAR;
+            else if (!strcmp(arg, "sse2"))
+                opt_lexer = SCAN_SSE2;
+            else if (!strcmp(arg, "avx2"))
+                opt_lexer = SCAN_AVX2;
+            else
+                usage();
+            continue;
+        }
+
+        if (!strncmp(argv[i], "--lex-threads=", 14)) {
+            opt_lex_threads = atoi(argv[i] + 14);
+            if (opt_lex_threads < 1) usage();
+            continue;
+        }
+
+        if (!strcmp(argv[i], "--dump-tokens")) {
+            opt_dump_tokens = true;
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-O")) {
+            opt_level = 1;
+            continue;
+        }
+
+        if (!strncmp(argv[i], "-O", 2) && argv[i][2] >= '0' &&
+            argv[i][2] <= '2' && !argv[i][3]) {
+            opt_level = argv[i][2] - '0';
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-Wunused-function")) {
+            opt_warn_unused_function = true;
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-fremove-unused-functions")) {
+            opt_remove_unused_functions = true;
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-fomit-frame-pointer")) {
+            opt_omit_frame_pointer = true;
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-fno-inline")) {
+            opt_inline = false;
+            continue;
+        }
+
+        if (!strncmp(argv[i], "-finline-limit=", 15)) {
+            char* end;
+            opt_inline_limit = strtol(argv[i] + 15, &end, 10);
+            if (end == argv[i] + 15 || *end || opt_inline_limit < 0) usage();
+            continue;
+        }
+
+        if (!strncmp(argv[i], "-funroll-factor=", 16)) {
+            char* end;
+            opt_unroll_factor = strtol(argv[i] + 16, &end, 10);
+            if (end == argv[i] + 16 || *end || opt_unroll_factor < 1) usage();
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-fno-vectorize")) {
+            opt_vectorize = false;
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-mavx2")) {
+            opt_avx2 = true;
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-fprofile-generate")) {
+            opt_profile_generate = "ycc.profile";
+            continue;
+        }
+
+        if (!strncmp(argv[i], "-fprofile-generate=", 19) && argv[i][19]) {
+            opt_profile_generate = argv[i] + 19;
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-fprofile-use")) {
+            opt_profile_use = "ycc.profile";
+            continue;
+        }
+
+        if (!strncmp(argv[i], "-fprofile-use=", 14) && argv[i][14]) {
+            opt_profile_use = argv[i] + 14;
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-finstrument-functions")) {
+            opt_instrument_functions = true;
+            continue;
+        }
+
+        if (!strcmp(argv[i], "--server")) {
+            opt_server = "ycc.sock";
+            continue;
+        }
+
+        if (!strncmp(argv[i], "--server=", 9) && argv[i][9]) {
+            opt_server = argv[i] + 9;
+            continue;
+        }
+
+        if (!strncmp(argv[i], "--workers=", 10)) {
+            opt_workers = atoi(argv[i] + 10);
+            if (opt_workers < 1) usage();
+            continue;
+        }
+
+        if (!strncmp(argv[i], "--cache=", 8) && argv[i][8]) {
+            opt_cache_dir = argv[i] + 8;
+            continue;
+        }
+
+        if (!strncmp(argv[i], "--cache-size=", 13)) {
+            opt_cache_size = atoi(argv[i] + 13);
+            if (opt_cache_size < 1) usage();
+            continue;
+        }
+
+        if (!strcmp(argv[i], "--cache-stats")) {
+            opt_cache_stats = true;
+            continue;
+        }
+
+        if (!strncmp(argv[i], "--emit-ast=", 11) && argv[i][11]) {
+            opt_emit_ast = argv[i] + 11;
+            continue;
+        }
+
+        if (!strncmp(argv[i], "--load-ast=", 11) && argv[i][11]) {
+            opt_load_ast = argv[i] + 11;
+            continue;
+        }
+
+        if (!strcmp(argv[i], "--verify-types")) {
+            opt_verify_types = true;
+            continue;
+        }
+
+        if (argv[i][0] == '-' && argv[i][1] != '\0') usage();
+
+        if (user_input) usage();
+        user_input = strcmp(argv[i], "-") ? argv[i] : read_stdin();
+    }
+
+    if (opt_profile_generate && opt_profile_use) usage();
+    if (opt_load_ast && (user_input || opt_emit_ast)) usage();
+    if (opt_server ? user_input != NULL : !user_input && !opt_load_ast)
+        usage();
+}
+
+// Entry point of the compiler. This is separate from main() so that the
+// test harness can run the compiler without exec'ing ./ycc.
+int ycc_main(int argc, char** argv) {
+    parse_args(argc, argv);
+    if (opt_server) return serve(opt_server, opt_workers);
+
+    // A loaded AST is timed as parsing, the phase it replaces.
+    Program* prog;
+    if (opt_load_ast) {
+        phase_begin(PHASE_PARSE);
+        prog = load_ast(opt_load_ast);
+        phase_end(PHASE_PARSE);
+    } else {
+        phase_begin(PHASE_TOKENIZE);
+        token = tokenize();
+        phase_end(PHASE_TOKENIZE);
+
+        if (opt_dump_tokens) {
+            // One line per token: kind, offset, length and value.
+            for (int i = 0; i < tokens_len; i++) {
+                Token* tok = &tokens[i];
+                printf("%d %ld %d %d\n", tok->kind,
+                       (long)(tok->str - user_input), tok->len, tok->val);
+            }
+            return 0;
+        }
+
+        phase_begin(PHASE_PARSE);
+        prog = program();
+        phase_end(PHASE_PARSE);
+    }
+
+    // Nodes are typed as they are built, so this pass only checks them.
+    if (opt_verify_types) {
+        phase_begin(PHASE_TYPE);
+        verify_types(prog);
+        phase_end(PHASE_TYPE);
+    }
+
+    if (opt_emit_ast) {
+        emit_ast(prog, opt_emit_ast);
+        if (opt_time_report) print_time_report(stderr, opt_time_report_json);
+        return 0;
+    }
+
+    cache_lookup(prog);
+
+    phase_begin(PHASE_OPT);
+    optimize(prog);
+    phase_end(PHASE_OPT);
+
+    phase_begin(PHASE_LAYOUT);
+    for (Function* fn = prog->funcs; fn; fn = fn->next)
+        if (!fn->cached) layout_frame(fn);
+    phase_end(PHASE_LAYOUT);
+
+    phase_begin(PHASE_CODEGEN);
+    codegen(prog);
+    phase_end(PHASE_CODEGEN);
+    cache_finish();
+
+    if (opt_time_report) print_time_report(stderr, opt_time_report_json);
+    return 0;
+}
@@ -0,0 +1,318 @@
+#include "ycc.h"
+
+// Stack frame layout. Every local gets a slot aligned to its natural
+// alignment. Locals whose live ranges don't intersect share a slot (stack
+// coloring), and slots are placed in order of decreasing alignment so that
+// little padding is needed between them.
+//
+// Live ranges are intervals of statement positions, numbered in source
+// order. A local that is referenced inside a loop lives for the whole loop,
+// since its value may flow around the back edge. Parameters and arrays live
+// for the whole function. So do all locals of a function that takes the
+// address of a local, since a pointer may then reach any slot of the frame.
+
+int position;  // Position of the statement being walked
+
+// Work list of walk_expr()
+typedef struct {
+    Node* node;       // Node to walk
+    bool under_addr;  // Whether the node is an operand of "&"
+} ExprItem;
+
+ExprItem* expr_items;
+int expr_items_len;
+int expr_items_cap;
+
+void push_expr_item(Node* node, bool under_addr) {
+    if (!node) return;
+    if (expr_items_len == expr_items_cap) {
+        expr_items_cap = expr_items_cap ? expr_items_cap * 2 : 64;
+        expr_items =
+            counted_realloc(expr_items, sizeof(ExprItem) * expr_items_cap);
+    }
+    expr_items[expr_items_len].node = node;
+    expr_items[expr_items_len].under_addr = under_addr;
+    expr_items_len++;
+}
+
+void use_var(Var* var) {
+    if (var->live_start < 0 || position < var->live_start)
+        var->live_start = position;
+    if (position > var->live_end) var->live_end = position;
+}
+
+// Record the locals referenced by the expression `node` at the current
+// position. The statements of inlined calls in it share that position.
+// Expressions can be deeply nested, so this uses an explicit stack.
+void walk_expr(Node* node) {
+    push_expr_item(node, false);
+    while (expr_items_len > 0) {
+        ExprItem item = expr_items[--expr_items_len];
+        Node* n = item.node;
+        bool under_addr = item.under_addr || n->kind == NODE_ADDR;
+        if (n->kind == NODE_VAR && n->var->is_local) {
+            use_var(n->var);
+            if (under_addr) n->var->addr_taken = true;
+        }
+        push_expr_item(n->lhs, under_addr);
+        push_expr_item(n->rhs, under_addr);
+        push_expr_item(n->cond, under_addr);
+        push_expr_item(n->then, under_addr);
+        push_expr_item(n->els, under_addr);
+        push_expr_item(n->init, under_addr);
+        push_expr_item(n->inc, under_addr);
+        for (Node* b = n->body; b; b = b->next) push_expr_item(b, under_addr);
+        for (Node* a = n->args; a; a = a->next) push_expr_item(a, under_addr);
+    }
+}
+
+// Loops of the function being walked, as ranges of positions
+typedef struct {
+    int start;
+    int end;
+} Loop;
+
+Loop* loops;
+int loops_len;
+int loops_cap;
+
+void add_loop(int start, int end) {
+    if (loops_len == loops_cap) {
+        loops_cap = loops_cap ? loops_cap * 2 : 16;
+        loops = counted_realloc(loops, sizeof(Loop) * loops_cap);
+    }
+    loops[loops_len].start = start;
+    loops[loops_len].end = end;
+    loops_len++;
+}
+
+// Give each simple statement and condition of `node` a position and record
+// the locals it references.
+void walk_stmt(Node* node) {
+    switch (node->kind) {
+        case NODE_IF:
+            position++;
+            walk_expr(node->cond);
+            walk_stmt(node->then);
+            if (node->els) walk_stmt(node->els);
+            return;
+        case NODE_WHILE:
+        case NODE_VECTOR_LOOP: {
+            int start = ++position;
+            walk_expr(node->cond);
+            walk_stmt(node->then);
+            add_loop(start, position);
+            return;
+        }
+        case NODE_FOR: {
+            if (node->init) walk_stmt(node->init);
+            int start = ++position;
+            if (node->cond) walk_expr(node->cond);
+            walk_stmt(node->then);
+            if (node->inc) walk_stmt(node->inc);
+            add_loop(start, position);
+            return;
+        }
+        case NODE_BLOCK:
+            for (Node* n = node->body; n; n = n->next) walk_stmt(n);
+            return;
+        case NODE_NULL:
+        case NODE_COUNTER:
+            return;
+        default:
+            position++;
+            walk_expr(node->lhs);
+            return;
+    }
+}
+
+// Whether `var` needs its slot for the whole function
+bool lives_everywhere(Var* var, Function* fn, bool addr_taken) {
+    if (addr_taken || var->ty->kind == TYPE_ARRAY) return true;
+    for (VarList* vl = fn->params; vl; vl = vl->next)
+        if (vl->var == var) return true;
+    return false;
+}
+
+// Compute the live range of each local of `fn`.
+void compute_live_ranges(Function* fn) {
+    for (VarList* vl = fn->locals; vl; vl = vl->next) {
+        vl->var->live_start = -1;
+        vl->var->live_end = -1;
+        vl->var->addr_taken = false;
+    }
+
+    position = 0;
+    loops_len = 0;
+    for (Node* node = fn->node; node; node = node->next) walk_stmt(node);
+
+    bool addr_taken = false;
+    for (VarList* vl = fn->locals; vl; vl = vl->next)
+        if (vl->var->addr_taken) addr_taken = true;
+
+    for (VarList* vl = fn->locals; vl; vl = vl->next) {
+        Var* var = vl->var;
+        if (lives_everywhere(var, fn, addr_taken)) {
+            var->live_start = 0;
+            var->live_end = position;
+            continue;
+        }
+        if (var->live_start < 0) continue;
+
+        // Extend the range over every loop it overlaps. Extending it over
+        // one loop can make it overlap an enclosing one, so repeat until
+        // nothing changes.
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (int i = 0; i < loops_len; i++) {
+                Loop* l = &loops[i];
+                if (var->live_end < l->start || l->end < var->live_start)
+                    continue;
+                if (l->start < var->live_start) {
+                    var->live_start = l->start;
+                    changed = true;
+                }
+                if (l->end > var->live_end) {
+                    var->live_end = l->end;
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
+int align_of(Type* ty) {
+    if (ty->kind == TYPE_ARRAY) return align_of(ty->base);
+    return size_of(ty);
+}
+
+int align_to(int n, int align) { return (n + align - 1) / align * align; }
+
+// A stack slot shared by locals of the same size and alignment
+typedef struct {
+    int size;    // Size in bytes
+    int align;   // Alignment in bytes
+    int end;     // End of the live range of its last local
+    int offset;  // Offset from RBP
+} Slot;
+
+// A local in the order of layout_frame()
+typedef struct {
+    Var* var;
+    int index;  // Position in Function::locals, latest declaration first
+    int slot;   // Index of the assigned slot
+} FrameVar;
+
+// Larger alignment first, then larger size, then earlier live range, then
+// the latest declaration first as before stack coloring, so that locals
+// declared one after another keep ascending addresses.
+int compare_vars(const void* a, const void* b) {
+    const FrameVar* x = a;
+    const FrameVar* y = b;
+    int xa = align_of(x->var->ty), ya = align_of(y->var->ty);
+    if (xa != ya) return ya - xa;
+    int xs = size_of(x->var->ty), ys = size_of(y->var->ty);
+    if (xs != ys) return ys - xs;
+    if (x->var->live_start != y->var->live_start)
+        return x->var->live_start - y->var->live_start;
+    return x->index - y->index;
+}
+
+// Min-heap of slot indices ordered by the end of their live ranges
+Slot* slots;
+int* heap;
+int heap_len;
+
+void swap_heap(int i, int j) {
+    int tmp = heap[i];
+    heap[i] = heap[j];
+    heap[j] = tmp;
+}
+
+void push_heap(int slot) {
+    int i = heap_len++;
+    heap[i] = slot;
+    while (i > 0 && slots[heap[(i - 1) / 2]].end > slots[heap[i]].end) {
+        swap_heap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+int pop_heap() {
+    int top = heap[0];
+    heap[0] = heap[--heap_len];
+    for (int i = 0;;) {
+        int min = i;
+        int l = i * 2 + 1, r = i * 2 + 2;
+        if (l < heap_len && slots[heap[l]].end < slots[heap[min]].end) min = l;
+        if (r < heap_len && slots[heap[r]].end < slots[heap[min]].end) min = r;
+        if (min == i) break;
+        swap_heap(i, min);
+        i = min;
+    }
+    return top;
+}
+
+// Assign an offset from RBP to every local of `fn` and set its stack size.
+void layout_frame(Function* fn) {
+    compute_live_ranges(fn);
+
+    int nvars = 0;
+    for (VarList* vl = fn->locals; vl; vl = vl->next) nvars++;
+    FrameVar* vars = counted_calloc(nvars, sizeof(FrameVar));
+    int i = 0;
+    for (VarList* vl = fn->locals; vl; vl = vl->next, i++) {
+        vars[i].var = vl->var;
+        vars[i].index = i;
+    }
+    qsort(vars, nvars, sizeof(FrameVar), compare_vars);
+
+    // Interval partitioning within each class of locals of the same size
+    // and alignment: locals come in order of their live range starts, and
+    // each one takes the slot that was freed first if it is free by then.
+    // Unreferenced locals fit in any slot.
+    slots = counted_calloc(nvars, sizeof(Slot));
+    heap = counted_calloc(nvars, sizeof(int));
+    heap_len = 0;
+    int nslots = 0;
+    for (i = 0; i < nvars; i++) {
+        Var* var = vars[i].var;
+        int size = size_of(var->ty);
+        int align = align_of(var->ty);
+        if (i > 0 && (size != slots[vars[i - 1].slot].size ||
+                      align != slots[vars[i - 1].slot].align))
+            heap_len = 0;
+
+        int slot;
+        if (heap_len > 0 && var->live_start < 0) {
+            slot = heap[0];
+        } else if (heap_len > 0 && slots[heap[0]].end < var->live_start) {
+            slot = pop_heap();
+            slots[slot].end = var->live_end;
+            push_heap(slot);
+        } else {
+            slot = nslots++;
+            slots[slot].size = size;
+            slots[slot].align = align;
+            slots[slot].end = var->live_end;
+            push_heap(slot);
+        }
+        vars[i].slot = slot;
+    }
+
+    // Slots grow downwards from RBP, which is 16-byte aligned. They come in
+    // order of decreasing alignment, so padding is only needed where the
+    // alignment changes.
+    int offset = 0;
+    for (i = 0; i < nslots; i++) {
+        offset = align_to(offset + slots[i].size, slots[i].align);
+        slots[i].offset = offset;
+    }
+    for (i = 0; i < nvars; i++) vars[i].var->offset = slots[vars[i].slot].offset;
+    fn->stack_size = align_to(offset, 16);
+
+    free(heap);
+    free(slots);
+    free(vars);
+}
@@ -0,0 +1,269 @@
+#include "ycc.h"
+
+// Inlining of small functions. A call to a function of at most
+// -finline-limit AST nodes is replaced by a NODE_INLINE expression whose
+// body binds copies of the callee's parameters to the arguments and then
+// runs a copy of the callee's body, with each return turned into a jump to
+// the end of the inlined code. Constant arguments for int parameters that
+// the callee never assigns are substituted into the body, so that dead
+// code elimination can fold the conditions on them.
+//
+// Functions are processed callees first, so a function is measured after
+// its own small callees have been inlined into it. Functions on a cycle of
+// the call graph, or calling into one, are never inlined themselves.
+
+// A call graph edge
+typedef struct {
+    int caller;  // Index of the calling function in `funcs`
+    int callee;  // Index of the called function in `funcs`
+} CallEdge;
+
+CallEdge* edges;
+int edges_len;
+int edges_cap;
+
+// Calls of the function being walked to defined functions
+Node** calls;
+int calls_len;
+int calls_cap;
+
+void find_calls(Node* node, void* arg) {
+    if (node->kind != NODE_FUNCALL || find_function(node->funcname) < 0)
+        return;
+    if (calls_len == calls_cap) {
+        calls_cap = calls_cap ? calls_cap * 2 : 16;
+        calls = counted_realloc(calls, sizeof(Node*) * calls_cap);
+    }
+    calls[calls_len++] = node;
+}
+
+void collect_calls(Function* fn) {
+    calls_len = 0;
+    visit_nodes(fn->node, find_calls, NULL);
+}
+
+void add_edge(int caller, int callee) {
+    if (edges_len == edges_cap) {
+        edges_cap = edges_cap ? edges_cap * 2 : 64;
+        edges = counted_realloc(edges, sizeof(CallEdge) * edges_cap);
+    }
+    edges[edges_len].caller = caller;
+    edges[edges_len].callee = callee;
+    edges_len++;
+}
+
+int compare_edges(const void* a, const void* b) {
+    const CallEdge* x = a;
+    const CallEdge* y = b;
+    if (x->callee != y->callee) return x->callee - y->callee;
+    return x->caller - y->caller;
+}
+
+void count_node(Node* node, void* size) { (*(int*)size)++; }
+
+// Size of `fn` in AST nodes
+int function_size(Function* fn) {
+    int size = 0;
+    visit_nodes(fn->node, count_node, &size);
+    return size;
+}
+
+// Copies of the locals of the callee being inlined
+Var** old_vars;
+Var** new_vars;
+Node** consts;  // Constant to substitute for the local, or NULL
+int nvars;
+
+int var_index(Var* var) {
+    for (int i = 0; i < nvars; i++)
+        if (old_vars[i] == var) return i;
+    error("Unknown local '%s' in inlined code", var->name);
+    return -1;
+}
+
+Var* map_var(Var* var) {
+    return var->is_local ? new_vars[var_index(var)] : var;
+}
+
+// Locals of the callee that are assigned or have their address taken
+bool* written;
+
+void find_writes(Node* node, void* arg) {
+    if ((node->kind == NODE_ASSIGN || node->kind == NODE_ADDR) &&
+        node->lhs->kind == NODE_VAR && node->lhs->var->is_local)
+        written[var_index(node->lhs->var)] = true;
+}
+
+Node* clone_list(Node* list);
+
+// Copy of the tree `node` using the copied locals. Returns of the callee
+// jump to the end of the inlined code instead. Callees are small, so the
+// recursion is shallow.
+Node* clone_node(Node* node) {
+    if (!node) return NULL;
+    if (node->kind == NODE_VAR && node->var->is_local &&
+        consts[var_index(node->var)])
+        return new_num(consts[var_index(node->var)]->val);
+    Node* n = new_node(node->kind);
+    *n = *node;
+    n->next = NULL;
+    if (n->kind == NODE_RETURN) n->kind = NODE_INLINE_RETURN;
+    if (n->kind == NODE_VAR) n->var = map_var(n->var);
+    n->lhs = clone_node(node->lhs);
+    n->rhs = clone_node(node->rhs);
+    n->cond = clone_node(node->cond);
+    n->then = clone_node(node->then);
+    n->els = clone_node(node->els);
+    n->init = clone_node(node->init);
+    n->inc = clone_node(node->inc);
+    n->body = clone_list(node->body);
+    n->args = clone_list(node->args);
+    return n;
+}
+
+Node* clone_list(Node* list) {
+    Node head;
+    head.next = NULL;
+    Node* cur = &head;
+    for (Node* n = list; n; n = n->next) cur = cur->next = clone_node(n);
+    return head.next;
+}
+
+// Whether calls to `fn` can be replaced by its body. With a profile, cold
+// functions aren't inlined and hot ones may be twice as large.
+bool can_inline(Function* fn) {
+    for (VarList* vl = fn->params; vl; vl = vl->next)
+        if (vl->var->ty->kind == TYPE_ARRAY) return false;
+    if (is_cold_function(fn)) return false;
+    int limit = opt_inline_limit;
+    if (is_hot_function(fn)) limit *= 2;
+    return function_size(fn) <= limit;
+}
+
+// Replace the call `node` of `caller` by the body of `callee`.
+void inline_call(Function* caller, Function* callee, Node* node) {
+    nvars = 0;
+    for (VarList* vl = callee->locals; vl; vl = vl->next) nvars++;
+    old_vars = counted_calloc(nvars, sizeof(Var*));
+    new_vars = counted_calloc(nvars, sizeof(Var*));
+    consts = counted_calloc(nvars, sizeof(Node*));
+    written = counted_calloc(nvars, sizeof(bool));
+    int i = 0;
+    for (VarList* vl = callee->locals; vl; vl = vl->next, i++) {
+        Var* var = counted_calloc(1, sizeof(Var));
+        stats.vars++;
+        *var = *vl->var;
+        old_vars[i] = vl->var;
+        new_vars[i] = var;
+
+        VarList* copy = counted_calloc(1, sizeof(VarList));
+        copy->var = var;
+        copy->next = caller->locals;
+        caller->locals = copy;
+    }
+
+    visit_nodes(callee->node, find_writes, NULL);
+    Node* arg = node->args;
+    for (VarList* vl = callee->params; vl; vl = vl->next, arg = arg->next) {
+        int j = var_index(vl->var);
+        if (arg->kind == NODE_NUM && vl->var->ty->kind == TYPE_INT &&
+            !written[j])
+            consts[j] = arg;
+    }
+
+    // Bind the other parameters. Arguments are evaluated from the last
+    // one, as for a real call.
+    Node* body = clone_list(callee->node);
+    arg = node->args;
+    for (VarList* vl = callee->params; vl; vl = vl->next) {
+        Node* next = arg->next;
+        arg->next = NULL;
+        if (consts[var_index(vl->var)]) {
+            arg = next;
+            continue;
+        }
+        Node* bind = new_unary(NODE_EXPR_STMT,
+                               new_binary(NODE_ASSIGN,
+                                          new_var(map_var(vl->var)), arg));
+        bind->next = body;
+        body = bind;
+        arg = next;
+    }
+
+    node->kind = NODE_INLINE;
+    node->args = NULL;
+    node->body = body;
+    type_node(node);
+
+    free(written);
+    free(consts);
+    free(old_vars);
+    free(new_vars);
+}
+
+// Inline the calls of funcs[i] to the functions marked in `inlinable`.
+void inline_calls(int i, bool* inlinable) {
+    Function* fn = funcs[i];
+    if (is_cold_function(fn)) return;
+    collect_calls(fn);
+    for (int j = 0; j < calls_len; j++) {
+        Node* call = calls[j];
+        int callee = find_function(call->funcname);
+        int nparams = 0;
+        for (VarList* vl = funcs[callee]->params; vl; vl = vl->next)
+            nparams++;
+        if (inlinable[callee] && call->argnum == nparams)
+            inline_call(fn, funcs[callee], call);
+    }
+}
+
+void inline_functions(Program* prog) {
+    index_functions(prog);
+
+    // Build the call graph, sorted by callee, without duplicate edges.
+    edges_len = 0;
+    for (int i = 0; i < funcs_len; i++) {
+        collect_calls(funcs[i]);
+        for (int j = 0; j < calls_len; j++)
+            add_edge(i, find_function(calls[j]->funcname));
+    }
+    qsort(edges, edges_len, sizeof(CallEdge), compare_edges);
+    // Callees of each function not yet done, and first edge of each callee
+    int* out = counted_calloc(funcs_len, sizeof(int));
+    int* first = counted_calloc(funcs_len + 1, sizeof(int));
+    int len = 0;
+    for (int i = 0; i < edges_len; i++) {
+        if (i > 0 && !compare_edges(&edges[i - 1], &edges[i])) continue;
+        edges[len++] = edges[i];
+        out[edges[i].caller]++;
+        first[edges[i].callee + 1]++;
+    }
+    edges_len = len;
+    for (int i = 0; i < funcs_len; i++) first[i + 1] += first[i];
+
+    // Process functions once all their callees are done.
+    bool* inlinable = counted_calloc(funcs_len, sizeof(bool));
+    bool* done = counted_calloc(funcs_len, sizeof(bool));
+    int* ready = counted_calloc(funcs_len, sizeof(int));
+    int nready = 0;
+    for (int i = 0; i < funcs_len; i++)
+        if (out[i] == 0) ready[nready++] = i;
+    while (nready > 0) {
+        int i = ready[--nready];
+        inline_calls(i, inlinable);
+        inlinable[i] = can_inline(funcs[i]);
+        done[i] = true;
+        for (int e = first[i]; e < first[i + 1]; e++)
+            if (--out[edges[e].caller] == 0) ready[nready++] = edges[e].caller;
+    }
+
+    // The rest can still have their calls to finished functions inlined.
+    for (int i = 0; i < funcs_len; i++)
+        if (!done[i]) inline_calls(i, inlinable);
+
+    free(ready);
+    free(done);
+    free(inlinable);
+    free(first);
+    free(out);
+}
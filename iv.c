@@ -0,0 +1,210 @@
+#include "ycc.h"
+
+// Strength reduction of induction variables. In a counted loop, addresses
+// `base + (i + k)` of an invariant array or pointer `base`, counter `i`
+// and constant `k` are kept in pointers that are set before the loop and
+// advanced together with the counter, so `a[i]` no longer multiplies by
+// the element size in every iteration. If the counter is then only used
+// to test the loop condition, the condition compares one of the pointers
+// instead and the counter is no longer stepped.
+
+// Most pointers introduced for one loop
+#define MAX_POINTERS 8
+
+// A pointer standing for `base + (counter + offset)`
+typedef struct {
+    Var* base;   // Invariant array or pointer
+    int offset;  // Constant added to the counter
+    Var* ptr;    // Local holding the address
+    Type* ty;    // Type of the address expression
+} DerivedPtr;
+
+DerivedPtr ptrs[MAX_POINTERS];
+int nptrs;
+
+// If `node` is `var`, `var + k` or `var - k`, store k in `offset`.
+bool match_index(Node* node, Var* var, int* offset) {
+    if (node->kind == NODE_VAR && node->var == var) {
+        *offset = 0;
+        return true;
+    }
+    if (node->kind != NODE_ADD && node->kind != NODE_SUB) return false;
+    Node* v = node->lhs;
+    Node* k = node->rhs;
+    if (node->kind == NODE_ADD && k->kind == NODE_VAR) {
+        v = node->rhs;
+        k = node->lhs;
+    }
+    if (v->kind != NODE_VAR || v->var != var || k->kind != NODE_NUM)
+        return false;
+    *offset = node->kind == NODE_ADD ? k->val : -k->val;
+    return true;
+}
+
+// Index in `ptrs` of the pointer for `base + (counter + offset)`, or -1 if
+// there are too many.
+int find_ptr(Var* base, int offset, Type* ty) {
+    for (int i = 0; i < nptrs; i++)
+        if (ptrs[i].base == base && ptrs[i].offset == offset) return i;
+    if (nptrs == MAX_POINTERS) return -1;
+    ptrs[nptrs].base = base;
+    ptrs[nptrs].offset = offset;
+    ptrs[nptrs].ptr = NULL;
+    ptrs[nptrs].ty = ty;
+    return nptrs++;
+}
+
+// `base + (var + offset)`
+Node* new_address(Var* base, Var* var, int offset) {
+    Node* index = new_var(var);
+    if (offset) index = new_binary(NODE_ADD, index, new_num(offset));
+    return new_binary(NODE_ADD, new_var(base), index);
+}
+
+Var* counted_var;  // Variable counted by count_refs()
+
+void count_refs(Node* node, void* refs) {
+    if (node->kind == NODE_VAR && node->var == counted_var) (*(int*)refs)++;
+}
+
+// Number of references to `var` in the statement list `list`
+int refs_in(Node* list, Var* var) {
+    int refs = 0;
+    counted_var = var;
+    visit_nodes(list, count_refs, &refs);
+    return refs;
+}
+
+// Whether `stmt` assigns `var` a value computed without it, so that `var`
+// is dead before it.
+bool kills(Node* stmt, Var* var) {
+    if (stmt && stmt->kind == NODE_FOR) stmt = stmt->init;
+    while (stmt && stmt->kind == NODE_BLOCK) stmt = stmt->body;
+    return stmt && stmt->kind == NODE_EXPR_STMT &&
+           stmt->lhs->kind == NODE_ASSIGN &&
+           stmt->lhs->lhs->kind == NODE_VAR && stmt->lhs->lhs->var == var &&
+           refs_in(stmt->lhs->rhs, var) == 0;
+}
+
+Node* nested_loop;  // Loop looked for by find_nested()
+
+void find_nested(Node* node, void* found) {
+    if (node == nested_loop) *(bool*)found = true;
+}
+
+// Whether `loop` is in the body of another loop, so that it may be entered
+// more than once.
+bool is_nested(Node* loop) {
+    bool found = false;
+    nested_loop = loop;
+    for (int i = 0; i < loop_list_len && !found; i++)
+        if (loop_list[i] != loop)
+            visit_nodes(loop_list[i]->then, find_nested, &found);
+    return found;
+}
+
+// Whether the counter of `cl` is used for nothing but stepping itself and
+// testing the condition: in the loop, and after the loop unless the next
+// statement sets it again or, for a loop at the top level of the function,
+// no later statement uses it. Its initialization doesn't count. A loop
+// entered more than once must also set the counter in its initialization,
+// or the next entry would start from the value the counter was not
+// stepped to.
+bool counter_is_dead(Function* fn, Node* loop, CountedLoop* cl) {
+    if (!cl->cmp) return false;
+    Node* limit = cl->limit;
+    if (limit->kind != NODE_NUM &&
+        (limit->kind != NODE_VAR || limit->var == cl->var ||
+         !is_invariant_var(limit->var)))
+        return false;
+
+    // `var cmp limit` and `var = var + step`
+    Var* var = cl->var;
+    int in_loop = refs_in(loop->cond, var) + refs_in(loop->inc, var) +
+                  refs_in(loop->then, var);
+    if (in_loop != 3) return false;
+    if (kills(loop->next, var)) return true;
+    for (Node* n = fn->node; n; n = n->next)
+        if (n == loop) return refs_in(loop->next, var) == 0;
+    int init = loop->kind == NODE_FOR ? refs_in(loop->init, var) : 0;
+    if (refs_in(fn->node, var) != in_loop + init) return false;
+    return !is_nested(loop) || (loop->kind == NODE_FOR && kills(loop, var));
+}
+
+void reduce_loop(Function* fn, Node* loop) {
+    CountedLoop cl;
+    if (!match_counted_loop(loop, &cl)) return;
+    Var* var = cl.var;
+
+    loop_nodes_len = 0;
+    walk_loop(loop->cond);
+    walk_loop(loop->inc);
+    walk_loop(loop->then);
+
+    nptrs = 0;
+    for (int i = 0; i < loop_nodes_len; i++) {
+        Node* n = loop_nodes[i].node;
+        int offset;
+        if (n->kind != NODE_ADD || !n->ty->base || n->lhs->kind != NODE_VAR ||
+            n->lhs->var == var || !is_invariant_var(n->lhs->var) ||
+            !match_index(n->rhs, var, &offset))
+            continue;
+        int p = find_ptr(n->lhs->var, offset, n->ty);
+        if (p < 0) continue;
+        if (!ptrs[p].ptr) ptrs[p].ptr = new_temp(fn, n->ty);
+        replace_with_var(i, ptrs[p].ptr);
+    }
+    if (nptrs == 0) return;
+
+    // Set the pointers before the loop and advance them after the counter.
+    Node pre_head;
+    pre_head.next = NULL;
+    Node* pre = &pre_head;
+    Node step_head;
+    step_head.next = NULL;
+    Node* step = &step_head;
+    for (int i = 0; i < nptrs; i++) {
+        Var* ptr = ptrs[i].ptr;
+        pre = pre->next = new_assign_stmt(
+            ptr, new_address(ptrs[i].base, var, ptrs[i].offset));
+        Node* stride = cl.step ? new_num(cl.step) : new_var(cl.stride->var);
+        step = step->next = new_assign_stmt(
+            ptr, new_binary(NODE_ADD, new_var(ptr), stride));
+    }
+
+    // i cmp limit  <=>  base + (i + k) cmp base + (limit + k)
+    bool dead = counter_is_dead(fn, loop, &cl);
+    if (dead) {
+        Var* end = new_temp(fn, ptrs[0].ty);
+        Node* limit = cl.limit;
+        if (ptrs[0].offset)
+            limit = new_binary(NODE_ADD, limit, new_num(ptrs[0].offset));
+        pre = pre->next = new_assign_stmt(
+            end, new_binary(NODE_ADD, new_var(ptrs[0].base), limit));
+        loop->cond = new_binary(cl.cmp, new_var(ptrs[0].ptr), new_var(end));
+    }
+
+    Node* block = new_node(NODE_BLOCK);
+    block->body = step_head.next;
+    if (!dead) {
+        Node* copy = new_node(NODE_EXPR_STMT);
+        *copy = *cl.step_stmt;
+        copy->next = block->body;
+        block->body = copy;
+    }
+    if (loop->kind == NODE_FOR) {
+        loop->inc = block;
+    } else {
+        block->next = cl.step_stmt->next;
+        *cl.step_stmt = *block;
+    }
+    add_preheader(loop, pre_head.next);
+}
+
+void reduce_strength(Program* prog) {
+    for (Function* fn = prog->funcs; fn; fn = fn->next) {
+        collect_loops(fn);
+        for (int i = loop_list_len - 1; i >= 0; i--)
+            reduce_loop(fn, loop_list[i]);
+    }
+}
@@ -0,0 +1,74 @@
+#include <pthread.h>
+
+#include "ycc.h"
+
+// Parallel tokenizer for very large inputs. The input is cut into chunks at
+// whitespace, which never occurs inside a token, so each chunk lexes to the
+// same tokens as the sequential tokenizer produces for that range. Chunks
+// are lexed on their own threads and then concatenated in source order.
+
+// Chunks smaller than this are not worth a thread.
+#define MIN_CHUNK_SIZE 4096
+
+typedef struct {
+    TokenChunk chunk;  // Tokens of the range
+    char* start;       // Start of the range
+    char* end;         // End of the range
+} LexTask;
+
+void* lex_task(void* arg) {
+    LexTask* task = arg;
+    lex_chunk(&task->chunk, task->start, task->end);
+    return NULL;
+}
+
+// Tokenize [p, end) into `out` with up to `nthreads` threads. As with
+// lex_chunk(), out->error is the first invalid token in the whole input.
+void lex_parallel(TokenChunk* out, char* p, char* end, int nthreads) {
+    int n = (end - p) / MIN_CHUNK_SIZE;
+    if (n > nthreads) n = nthreads;
+    if (n <= 1) {
+        lex_chunk(out, p, end);
+        return;
+    }
+
+    // Move each nominal split point forward to the next whitespace. A chunk
+    // may become empty if there is none before the next split point.
+    LexTask* tasks = calloc(n, sizeof(LexTask));
+    char* start = p;
+    for (int i = 0; i < n; i++) {
+        char* split = i == n - 1 ? end : p + (end - p) / n * (i + 1);
+        if (split < start) split = start;
+        while (split < end && !isspace(*split)) split++;
+        tasks[i].start = start;
+        tasks[i].end = split;
+        start = split;
+    }
+
+    // The calling thread lexes the first chunk itself.
+    pthread_t* threads = calloc(n, sizeof(pthread_t));
+    for (int i = 1; i < n; i++)
+        if (pthread_create(&threads[i], NULL, lex_task, &tasks[i]))
+            error("Cannot create a tokenizer thread");
+    lex_task(&tasks[0]);
+    for (int i = 1; i < n; i++) pthread_join(threads[i], NULL);
+
+    // Concatenate the chunks up to the first one with an error.
+    int len = 0;
+    for (int i = 0; i < n; i++) len += tasks[i].chunk.len;
+    out->cap = len + 1;
+    out->data = malloc(sizeof(Token) * out->cap);
+    out->len = 0;
+    out->error = NULL;
+    for (int i = 0; i < n; i++) {
+        TokenChunk* c = &tasks[i].chunk;
+        if (!out->error) {
+            memcpy(out->data + out->len, c->data, sizeof(Token) * c->len);
+            out->len += c->len;
+            out->error = c->error;
+        }
+        free(c->data);
+    }
+    free(threads);
+    free(tasks);
+}
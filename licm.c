@@ -0,0 +1,88 @@
+#include "ycc.h"
+
+// Loop-invariant code motion. The largest subexpressions of a loop that
+// compute the same value in every iteration are evaluated once into fresh
+// locals before the loop, in a preheader that runs after the init clause
+// of a `for`. The loop itself uses the locals instead, one per distinct
+// expression.
+//
+// The preheader also runs when the loop body never does, so only
+// expressions that can't fault or have side effects are moved, as decided
+// by is_invariant_node().
+
+// Whether moving `node` saves work. Numbers, variables and addresses of
+// variables are as cheap to compute as to reload.
+bool worth_hoisting(Node* node) {
+    return node->kind != NODE_NUM && node->kind != NODE_VAR &&
+           node->kind != NODE_ADDR;
+}
+
+// Expressions hoisted out of the loop being processed and their locals
+Node** hoisted;
+Var** hoisted_vars;
+int hoisted_len;
+int hoisted_cap;
+
+// Local already holding the value of the invariant expression `node`, or
+// NULL. Invariant expressions have no side effects, so equal trees compute
+// equal values.
+Var* find_hoisted(Node* node) {
+    for (int i = 0; i < hoisted_len; i++)
+        if (same_tree(hoisted[i], node)) return hoisted_vars[i];
+    return NULL;
+}
+
+void add_hoisted(Node* node, Var* var) {
+    if (hoisted_len == hoisted_cap) {
+        hoisted_cap = hoisted_cap ? hoisted_cap * 2 : 16;
+        hoisted = counted_realloc(hoisted, sizeof(Node*) * hoisted_cap);
+        hoisted_vars =
+            counted_realloc(hoisted_vars, sizeof(Var*) * hoisted_cap);
+    }
+    hoisted[hoisted_len] = node;
+    hoisted_vars[hoisted_len++] = var;
+}
+
+// Move the invariant expressions of the loop `loop` of `fn` into a
+// preheader.
+void hoist_loop(Function* fn, Node* loop) {
+    scan_loop(loop);
+    loop_nodes_len = 0;
+    walk_loop(loop->cond);
+    walk_loop(loop->inc);
+    walk_loop(loop->then);
+    mark_invariants();
+
+    Node head;
+    head.next = NULL;
+    Node* cur = &head;
+    hoisted_len = 0;
+    for (int i = 0; i < loop_nodes_len; i++) {
+        LoopNode* ln = &loop_nodes[i];
+        Node* node = ln->node;
+        if (!ln->invariant || ln->lvalue || !worth_hoisting(node)) continue;
+        if (ln->parent >= 0 && loop_nodes[ln->parent].invariant) continue;
+
+        Var* var = find_hoisted(node);
+        if (!var) {
+            var = new_temp(fn, node->ty);
+            Node* expr = new_node(node->kind);
+            *expr = *node;
+            expr->next = NULL;
+            cur = cur->next = new_assign_stmt(var, expr);
+            add_hoisted(expr, var);
+        }
+        replace_with_var(i, var);
+    }
+    add_preheader(loop, head.next);
+}
+
+void licm(Program* prog) {
+    for (Function* fn = prog->funcs; fn; fn = fn->next) {
+        // Inner loops first, so that what they hoist can move further out
+        // of the enclosing loops.
+        collect_loops(fn);
+        for (int i = loop_list_len - 1; i >= 0; i--)
+            hoist_loop(fn, loop_list[i]);
+    }
+}
@@ -0,0 +1,346 @@
+#include "ycc.h"
+
+// Helpers shared by the loop optimizations: finding loops, the variables
+// a loop writes, a walk of a loop that records the parent of each node,
+// and preheaders, i.e. statements run once before a loop starts.
+
+// Loops of the function being processed
+Node** loop_list;
+int loop_list_len;
+int loop_list_cap;
+
+void find_loop(Node* node, void* arg) {
+    if (node->kind != NODE_WHILE && node->kind != NODE_FOR) return;
+    if (loop_list_len == loop_list_cap) {
+        loop_list_cap = loop_list_cap ? loop_list_cap * 2 : 16;
+        loop_list = counted_realloc(loop_list, sizeof(Node*) * loop_list_cap);
+    }
+    loop_list[loop_list_len++] = node;
+}
+
+void find_addr(Node* node, void* arg) {
+    if (node->kind == NODE_ADDR && node->lhs->kind == NODE_VAR)
+        node->lhs->var->addr_taken = true;
+}
+
+// List the loops of `fn` in loop_list, each before the loops inside it, and
+// mark the locals whose address is taken.
+void collect_loops(Function* fn) {
+    for (VarList* vl = fn->locals; vl; vl = vl->next)
+        vl->var->addr_taken = false;
+    visit_nodes(fn->node, find_addr, NULL);
+
+    loop_list_len = 0;
+    visit_nodes(fn->node, find_loop, NULL);
+}
+
+// Variables assigned in the loop being scanned, sorted by address
+Var** written_vars;
+int written_len;
+int written_cap;
+bool clobbers_globals;  // Whether the loop may change any global
+
+void find_written(Node* node, void* arg) {
+    if (node->kind == NODE_FUNCALL) clobbers_globals = true;
+    if (node->kind != NODE_ASSIGN) return;
+    if (node->lhs->kind != NODE_VAR) {
+        clobbers_globals = true;
+        return;
+    }
+    if (written_len == written_cap) {
+        written_cap = written_cap ? written_cap * 2 : 16;
+        written_vars =
+            counted_realloc(written_vars, sizeof(Var*) * written_cap);
+    }
+    written_vars[written_len++] = node->lhs->var;
+}
+
+int compare_var_ptrs(const void* a, const void* b) {
+    Var* x = *(Var**)a;
+    Var* y = *(Var**)b;
+    return x < y ? -1 : x > y;
+}
+
+// Find the variables that the loop `loop` assigns. The init clause of a
+// `for` runs before the loop and doesn't count.
+void scan_loop(Node* loop) {
+    written_len = 0;
+    clobbers_globals = false;
+    visit_nodes(loop->cond, find_written, NULL);
+    visit_nodes(loop->inc, find_written, NULL);
+    visit_nodes(loop->then, find_written, NULL);
+    qsort(written_vars, written_len, sizeof(Var*), compare_var_ptrs);
+}
+
+// Number of assignments to `var` in the scanned loop
+int count_writes(Var* var) {
+    Var** p = bsearch(&var, written_vars, written_len, sizeof(Var*),
+                      compare_var_ptrs);
+    if (!p) return 0;
+    Var** q = p;
+    while (p > written_vars && p[-1] == var) p--;
+    while (q < written_vars + written_len && *q == var) q++;
+    return q - p;
+}
+
+// Whether `var` has the same value in every iteration of the scanned loop.
+// Locals whose address is taken may change through pointers, and globals
+// through pointers or calls.
+bool is_invariant_var(Var* var) {
+    if (var->ty->kind == TYPE_ARRAY) return true;  // Its address
+    if (var->is_local && var->addr_taken) return false;
+    if (!var->is_local && clobbers_globals) return false;
+    return count_writes(var) == 0;
+}
+
+// Work list of walk_loop()
+typedef struct {
+    Node* node;
+    int parent;
+    bool lvalue;
+} LoopItem;
+
+LoopItem* loop_items;
+int loop_items_len;
+int loop_items_cap;
+
+LoopNode* loop_nodes;
+int loop_nodes_len;
+int loop_nodes_cap;
+
+void push_loop_item(Node* node, int parent, bool lvalue) {
+    if (!node) return;
+    if (loop_items_len == loop_items_cap) {
+        loop_items_cap = loop_items_cap ? loop_items_cap * 2 : 64;
+        loop_items =
+            counted_realloc(loop_items, sizeof(LoopItem) * loop_items_cap);
+    }
+    loop_items[loop_items_len].node = node;
+    loop_items[loop_items_len].parent = parent;
+    loop_items[loop_items_len].lvalue = lvalue;
+    loop_items_len++;
+}
+
+// Append the nodes under `root` to loop_nodes, each before the nodes under
+// it.
+void walk_loop(Node* root) {
+    push_loop_item(root, -1, false);
+    while (loop_items_len > 0) {
+        LoopItem item = loop_items[--loop_items_len];
+        if (loop_nodes_len == loop_nodes_cap) {
+            loop_nodes_cap = loop_nodes_cap ? loop_nodes_cap * 2 : 64;
+            loop_nodes =
+                counted_realloc(loop_nodes, sizeof(LoopNode) * loop_nodes_cap);
+        }
+        int i = loop_nodes_len++;
+        Node* n = item.node;
+        loop_nodes[i].node = n;
+        loop_nodes[i].parent = item.parent;
+        loop_nodes[i].lvalue = item.lvalue;
+        loop_nodes[i].invariant = false;
+
+        bool lvalue = n->kind == NODE_ASSIGN || n->kind == NODE_ADDR;
+        push_loop_item(n->lhs, i, lvalue);
+        push_loop_item(n->rhs, i, false);
+        push_loop_item(n->cond, i, false);
+        push_loop_item(n->then, i, false);
+        push_loop_item(n->els, i, false);
+        push_loop_item(n->init, i, false);
+        push_loop_item(n->inc, i, false);
+        for (Node* b = n->body; b; b = b->next) push_loop_item(b, i, false);
+        for (Node* a = n->args; a; a = a->next) push_loop_item(a, i, false);
+    }
+}
+
+// Whether `node` is invariant given that its children are. Expressions
+// that may fault or have side effects never are, so that invariant ones
+// can be computed before the loop even if the loop body never runs: no
+// loads through pointers, no calls, and divisions only by constants other
+// than 0 and -1. Dereferencing an array only computes an address.
+bool is_invariant_node(Node* node) {
+    long val;
+    switch (node->kind) {
+        case NODE_NUM:
+        case NODE_ADD:
+        case NODE_SUB:
+        case NODE_MUL:
+        case NODE_EQ:
+        case NODE_NE:
+        case NODE_LT:
+        case NODE_LE:
+            return true;
+        case NODE_DIV:
+            return eval_const(node->rhs, &val) && val != 0 && val != -1;
+        case NODE_VAR:
+            return is_invariant_var(node->var);
+        case NODE_ADDR:
+            return node->lhs->kind == NODE_VAR;
+        case NODE_DEREF:
+            return node->ty->kind == TYPE_ARRAY;
+        default:
+            return false;
+    }
+}
+
+// Set the `invariant` flag of loop_nodes for the scanned loop.
+void mark_invariants() {
+    // Children come after their parents, so a reverse pass sees them first.
+    for (int i = 0; i < loop_nodes_len; i++) loop_nodes[i].invariant = true;
+    for (int i = loop_nodes_len - 1; i >= 0; i--) {
+        LoopNode* ln = &loop_nodes[i];
+        ln->invariant = ln->invariant && is_invariant_node(ln->node);
+        if (!ln->invariant && ln->parent >= 0)
+            loop_nodes[ln->parent].invariant = false;
+    }
+}
+
+// Turn loop_nodes[i] into a reference to `var`. The types of the enclosing
+// expressions are recomputed, since an array operand may become a pointer.
+void replace_with_var(int i, Var* var) {
+    Node* node = loop_nodes[i].node;
+    Node* next = node->next;
+    memset(node, 0, sizeof(Node));
+    node->kind = NODE_VAR;
+    node->var = var;
+    node->next = next;
+    type_node(node);
+
+    for (int p = loop_nodes[i].parent; p >= 0; p = loop_nodes[p].parent) {
+        Node* n = loop_nodes[p].node;
+        Type* old = n->ty;
+        type_node(n);
+        if (same_type(old, n->ty)) break;
+    }
+}
+
+// A new local of `fn` holding values of type `ty`. An array decays to a
+// pointer to its first element.
+Var* new_temp(Function* fn, Type* ty) {
+    if (ty->kind == TYPE_ARRAY) ty = pointer_to(ty->base);
+    Var* var = counted_calloc(1, sizeof(Var));
+    stats.vars++;
+    var->name = "tmp";
+    var->ty = ty;
+    var->is_local = true;
+    VarList* vl = counted_calloc(1, sizeof(VarList));
+    vl->var = var;
+    vl->next = fn->locals;
+    fn->locals = vl;
+    return var;
+}
+
+// Statement `var = expr;`
+Node* new_assign_stmt(Var* var, Node* expr) {
+    return new_unary(NODE_EXPR_STMT,
+                     new_binary(NODE_ASSIGN, new_var(var), expr));
+}
+
+// Run the statement list `stmts` once before the loop `loop` starts. A
+// `for` runs it at the end of its init clause, so it sees the initialized
+// variables. A `while` becomes a block of the statements and the loop.
+void add_preheader(Node* loop, Node* stmts) {
+    if (!stmts) return;
+    Node* block = new_node(NODE_BLOCK);
+    if (loop->kind == NODE_FOR) {
+        if (loop->init) {
+            loop->init->next = stmts;
+            stmts = loop->init;
+        }
+        block->body = stmts;
+        loop->init = block;
+        return;
+    }
+
+    Node* copy = new_node(loop->kind);
+    *copy = *loop;
+    copy->next = NULL;
+    Node* last = stmts;
+    while (last->next) last = last->next;
+    last->next = copy;
+
+    Node* next = loop->next;
+    *loop = *block;
+    loop->body = stmts;
+    loop->next = next;
+}
+
+// Statement of `loop` that steps its counter: the increment of a `for`, or
+// the last statement of the body of a `while`. NULL if there is none.
+Node* step_stmt(Node* loop) {
+    if (loop->kind == NODE_FOR) return loop->inc;
+    if (loop->then->kind != NODE_BLOCK || !loop->then->body) return NULL;
+    Node* last = loop->then->body;
+    while (last->next) last = last->next;
+    return last;
+}
+
+// If `stmt` is `var = var + c` or `var = var - c` for a nonzero constant
+// c, or `var = var + v` for a variable v, return var and store c or v in
+// `cl`.
+Var* match_step(Node* stmt, CountedLoop* cl) {
+    if (!stmt || stmt->kind != NODE_EXPR_STMT ||
+        stmt->lhs->kind != NODE_ASSIGN)
+        return NULL;
+    Node* lhs = stmt->lhs->lhs;
+    Node* rhs = stmt->lhs->rhs;
+    if (lhs->kind != NODE_VAR ||
+        (rhs->kind != NODE_ADD && rhs->kind != NODE_SUB))
+        return NULL;
+    Var* var = lhs->var;
+    Node* other;
+    if (rhs->lhs->kind == NODE_VAR && rhs->lhs->var == var)
+        other = rhs->rhs;
+    else if (rhs->kind == NODE_ADD && rhs->rhs->kind == NODE_VAR &&
+             rhs->rhs->var == var)
+        other = rhs->lhs;
+    else
+        return NULL;
+    if (other->kind == NODE_VAR && rhs->kind == NODE_ADD) {
+        cl->stride = other;
+        return var;
+    }
+    if (other->kind != NODE_NUM || other->val == 0) return NULL;
+    cl->stride = other;
+    cl->step = rhs->kind == NODE_ADD ? other->val : -other->val;
+    return var;
+}
+
+// Recognize a loop with an int counter that only changes by a constant or
+// invariant step once per iteration, scanning the loop as scan_loop()
+// does. The condition and initial value are filled in if they have a
+// known form.
+bool match_counted_loop(Node* loop, CountedLoop* cl) {
+    memset(cl, 0, sizeof(CountedLoop));
+    cl->step_stmt = step_stmt(loop);
+    cl->var = match_step(cl->step_stmt, cl);
+    if (!cl->var) return false;
+    Var* var = cl->var;
+    if (!var->is_local || var->addr_taken || var->ty->kind != TYPE_INT)
+        return false;
+
+    scan_loop(loop);
+    if (count_writes(var) != 1) return false;
+    if (cl->stride->kind == NODE_VAR &&
+        (cl->stride->var == var || cl->stride->var->ty->kind != TYPE_INT ||
+         !is_invariant_var(cl->stride->var)))
+        return false;
+
+    // `var < limit`, `var <= limit` or `var != limit`
+    Node* cond = loop->cond;
+    if (cond &&
+        (cond->kind == NODE_LT || cond->kind == NODE_LE ||
+         cond->kind == NODE_NE) &&
+        cond->lhs->kind == NODE_VAR && cond->lhs->var == var) {
+        cl->cmp = cond->kind;
+        cl->limit = cond->rhs;
+    }
+
+    // `for (var = start; ...)`, possibly followed by preheaders
+    Node* init = loop->kind == NODE_FOR ? loop->init : NULL;
+    while (init && init->kind == NODE_BLOCK) init = init->body;
+    if (init && init->kind == NODE_EXPR_STMT &&
+        init->lhs->kind == NODE_ASSIGN && init->lhs->lhs->kind == NODE_VAR &&
+        init->lhs->lhs->var == var)
+        cl->start = init->lhs->rhs;
+    return true;
+}
@@ -0,0 +1,237 @@
+#include "ycc.h"
+
+// Optimization pass driver and helpers shared by the passes. -O0 runs no
+// passes and -O1, the default, removes dead code. -O2 also inlines small
+// functions, removes the dead code this exposes, hoists loop-invariant
+// expressions out of loops, vectorizes simple loops over int arrays,
+// unrolls counted loops, strength-reduces array indexing by loop counters
+// and eliminates common subexpressions. The unroll factor can be set at any
+// level. Profile counters are assigned first, so that -fprofile-generate
+// and -fprofile-use number them alike whatever the level.
+
+// Remove the functions found in the cache from the program and return
+// all functions in their order.
+Function** detach_cached(Program* prog, int* len) {
+    *len = 0;
+    for (Function* fn = prog->funcs; fn; fn = fn->next) (*len)++;
+    Function** all = counted_malloc(sizeof(Function*) * *len);
+    Function head;
+    head.next = NULL;
+    Function* cur = &head;
+    int i = 0;
+    for (Function* fn = prog->funcs; fn; fn = fn->next) {
+        all[i++] = fn;
+        if (!fn->cached) cur = cur->next = fn;
+    }
+    cur->next = NULL;
+    prog->funcs = head.next;
+    return all;
+}
+
+void attach_cached(Program* prog, Function** all, int len) {
+    for (int i = 0; i + 1 < len; i++) all[i]->next = all[i + 1];
+    if (len) all[len - 1]->next = NULL;
+    prog->funcs = len ? all[0] : NULL;
+    free(all);
+}
+
+void optimize(Program* prog) {
+    if (opt_profile_generate || opt_profile_use) profile(prog);
+    if (opt_level >= 1) dce(prog);
+    // Before inlining, after which inlined callees look uncalled
+    if (opt_warn_unused_function || opt_remove_unused_functions)
+        unused_functions(prog);
+    if (opt_level >= 2 && opt_inline) {
+        inline_functions(prog);
+        dce(prog);
+    }
+
+    // Functions found in the cache are only needed for inlining.
+    int len;
+    Function** all = detach_cached(prog, &len);
+    if (opt_level >= 2) {
+        licm(prog);
+        if (opt_vectorize) vectorize(prog);
+    }
+    if (opt_level >= 1 && unroll_factor() > 1) {
+        unroll_loops(prog);
+        dce(prog);
+    }
+    if (opt_level >= 2) {
+        reduce_strength(prog);
+        cse(prog);
+    }
+    attach_cached(prog, all, len);
+}
+
+// Functions of the program sorted by name. Passes identify functions by
+// their index in this array.
+Function** funcs;
+int funcs_len;
+
+int compare_funcs(const void* a, const void* b) {
+    return strcmp((*(Function**)a)->name, (*(Function**)b)->name);
+}
+
+void index_functions(Program* prog) {
+    funcs_len = 0;
+    for (Function* fn = prog->funcs; fn; fn = fn->next) funcs_len++;
+    funcs = counted_realloc(funcs, sizeof(Function*) * (funcs_len + 1));
+    int i = 0;
+    for (Function* fn = prog->funcs; fn; fn = fn->next) funcs[i++] = fn;
+    qsort(funcs, funcs_len, sizeof(Function*), compare_funcs);
+}
+
+// Index of the function called `name`, or -1 if it is not defined in the
+// program.
+int find_function(char* name) {
+    Function key = {.name = name};
+    Function* k = &key;
+    Function** f = bsearch(&k, funcs, funcs_len, sizeof(Function*),
+                           compare_funcs);
+    return f ? f - funcs : -1;
+}
+
+// Work list of the walkers below
+Node** walk_stack;
+int walk_len;
+int walk_cap;
+
+void push_walk(Node* node) {
+    if (!node) return;
+    if (walk_len == walk_cap) {
+        walk_cap = walk_cap ? walk_cap * 2 : 64;
+        walk_stack = counted_realloc(walk_stack, sizeof(Node*) * walk_cap);
+    }
+    walk_stack[walk_len++] = node;
+}
+
+void push_children(Node* node) {
+    push_walk(node->lhs);
+    push_walk(node->rhs);
+    push_walk(node->cond);
+    push_walk(node->then);
+    push_walk(node->els);
+    push_walk(node->init);
+    push_walk(node->inc);
+    for (Node* b = node->body; b; b = b->next) push_walk(b);
+    for (Node* a = node->args; a; a = a->next) push_walk(a);
+}
+
+// Call `visit` on every node of the statement list `list`. Each node is
+// visited before the nodes under it, otherwise the order is unspecified.
+// Trees can be deeply nested, so this uses an explicit stack.
+void visit_nodes(Node* list, void (*visit)(Node* node, void* arg),
+                 void* arg) {
+    walk_len = 0;
+    for (Node* n = list; n; n = n->next) push_walk(n);
+    while (walk_len > 0) {
+        Node* n = walk_stack[--walk_len];
+        visit(n, arg);
+        push_children(n);
+    }
+}
+
+// Whether evaluating the expression `node` may do more than compute a
+// value: call a function, store or dereference a pointer.
+bool has_side_effects(Node* node) {
+    walk_len = 0;
+    push_walk(node);
+    while (walk_len > 0) {
+        Node* n = walk_stack[--walk_len];
+        if (n->kind == NODE_FUNCALL || n->kind == NODE_ASSIGN ||
+            n->kind == NODE_DEREF)
+            return true;
+        push_children(n);
+    }
+    return false;
+}
+
+// If `node` is an integer expression of constants only, store its value
+// in `val` and return true. The value is computed in 64 bits, as the
+// generated code does.
+bool eval_const(Node* node, long* val) {
+    // Collect the nodes in reverse post order.
+    int len = 0;
+    walk_len = 0;
+    push_walk(node);
+    Node** order = NULL;
+    int cap = 0;
+    while (walk_len > 0) {
+        Node* n = walk_stack[--walk_len];
+        switch (n->kind) {
+            case NODE_NUM:
+                break;
+            case NODE_ADD:
+            case NODE_SUB:
+            case NODE_MUL:
+            case NODE_DIV:
+            case NODE_EQ:
+            case NODE_NE:
+            case NODE_LT:
+            case NODE_LE:
+                if (n->ty->kind == TYPE_INT) break;
+            default:
+                free(order);
+                return false;
+        }
+        if (len == cap) {
+            cap = cap ? cap * 2 : 16;
+            order = counted_realloc(order, sizeof(Node*) * cap);
+        }
+        order[len++] = n;
+        push_walk(n->lhs);
+        push_walk(n->rhs);
+    }
+
+    long* vals = counted_calloc(len, sizeof(long));
+    int nvals = 0;
+    bool ok = true;
+    for (int i = len - 1; i >= 0 && ok; i--) {
+        Node* n = order[i];
+        if (n->kind == NODE_NUM) {
+            vals[nvals++] = n->val;
+            continue;
+        }
+
+        unsigned long b = vals[--nvals];
+        unsigned long a = vals[--nvals];
+        long r = 0;
+        switch (n->kind) {
+            case NODE_ADD:
+                r = a + b;
+                break;
+            case NODE_SUB:
+                r = a - b;
+                break;
+            case NODE_MUL:
+                r = a * b;
+                break;
+            case NODE_DIV:
+                // Leave faults to run time.
+                if (b == 0 || ((long)a == LONG_MIN && (long)b == -1))
+                    ok = false;
+                else
+                    r = (long)a / (long)b;
+                break;
+            case NODE_EQ:
+                r = a == b;
+                break;
+            case NODE_NE:
+                r = a != b;
+                break;
+            case NODE_LT:
+                r = (long)a < (long)b;
+                break;
+            case NODE_LE:
+                r = (long)a <= (long)b;
+                break;
+        }
+        vals[nvals++] = r;
+    }
+
+    if (ok) *val = vals[0];
+    free(vals);
+    free(order);
+    return ok;
+}
@@ -23,7 +23,8 @@ Var* find_var(Token* tok) {
 }
 
 Node* new_node(NodeKind kind) {
-    Node* node = calloc(1, sizeof(Node));
+    Node* node = counted_calloc(1, sizeof(Node));
+    stats.nodes++;
     node->kind = kind;
     return node;
 }
@@ -32,33 +33,38 @@ Node* new_binary(NodeKind kind, Node* lhs, Node* rhs) {
     Node* node = new_node(kind);
     node->lhs = lhs;
     node->rhs = rhs;
+    type_node(node);
     return node;
 }
 
 Node* new_unary(NodeKind kind, Node* expr) {
     Node* node = new_node(kind);
     node->lhs = expr;
+    type_node(node);
     return node;
 }
 
 Node* new_num(int val) {
     Node* node = new_node(NODE_NUM);
     node->val = val;
+    type_node(node);
     return node;
 }
 
 Node* new_var(Var* var) {
     Node* node = new_node(NODE_VAR);
     node->var = var;
+    type_node(node);
     return node;
 }
 
 Var* push_var(char* name, Type* ty, bool is_local) {
-    Var* var = calloc(1, sizeof(Var));
+    Var* var = counted_calloc(1, sizeof(Var));
+    stats.vars++;
     var->name = name;
     var->ty = ty;
     var->is_local = is_local;
-    VarList* vl = calloc(1, sizeof(VarList));
+    VarList* vl = counted_calloc(1, sizeof(VarList));
     vl->var = var;
     if (is_local) {
         vl->next = locals;
@@ -75,21 +81,17 @@ Type* basetype();
 void global_var();
 Node* stmt();
 Node* expr();
-Node* assign();
-Node* equality();
-Node* relational();
-Node* add();
-Node* mul();
-Node* postfix();
-Node* unary();
-Node* primary();
+bool primary();
 
+// Whether the next top-level declaration is a function, i.e. basetype
+// followed by ident "(". Only looks ahead, so no tokens are consumed and no
+// types are created.
 bool is_function() {
-    Token *tok = token;
-    basetype();
-    bool is_func = consume_ident() && consume("(");
-    token = tok;
-    return is_func;
+    Token* tok = token;
+    if (!equal(tok, "int")) return false;
+    tok++;
+    while (equal(tok, "*")) tok++;
+    return tok->kind == TOKEN_IDENT && equal(tok + 1, "(");
 }
 
 /*
@@ -110,7 +112,7 @@ Program* program() {
         }
     }
 
-    Program* prog = calloc(1, sizeof(Program));
+    Program* prog = counted_calloc(1, sizeof(Program));
     prog->globals = globals;
     prog->funcs = head.next;
     return prog;
@@ -136,7 +138,7 @@ VarList* read_func_param() {
     char* name = expect_ident();
     ty = read_type_suffix(ty);
 
-    VarList* vl = calloc(1, sizeof(VarList));
+    VarList* vl = counted_calloc(1, sizeof(VarList));
     vl->var = push_var(name, ty, true);
     return vl;
 }
@@ -164,7 +166,8 @@ VarList* read_func_params() {
 Function* function() {
     locals = NULL;
 
-    Function* fn = calloc(1, sizeof(Function));
+    Function* fn = counted_calloc(1, sizeof(Function));
+    fn->tok = token;
     basetype();
     fn->name = expect_ident();
     expect("(");
@@ -182,18 +185,62 @@ Function* function() {
 
     fn->node = head.next;
     fn->locals = locals;
+    fn->ntoks = token - fn->tok;
     return fn;
 }
 
+// Value of the constant expression that follows
+int const_expr() {
+    Token* tok = token;
+    long val;
+    if (!eval_const(expr(), &val)) error_tok(tok, "Expected a constant");
+    return val;
+}
+
 /*
- * global_var = basetype ident ("[" num "]")* ";"
+ * initializer = const_expr | "{" (const_expr ("," const_expr)* ","?)? "}"
+ *
+ * An int takes a constant, and an array of ints a list of constants for its
+ * ints in order, the ones left out being zero.
+ */
+void global_init(Var* var) {
+    Token* tok = token;
+    Type* base = var->ty;
+    while (base->kind == TYPE_ARRAY) base = base->base;
+    if (base->kind != TYPE_INT) error_tok(tok, "Only ints can be initialized");
+
+    int cap = 1;
+    var->init = counted_malloc(sizeof(int));
+    if (var->ty->kind != TYPE_ARRAY) {
+        var->init[var->init_len++] = const_expr();
+        return;
+    }
+    int max = size_of(var->ty) / 4;
+    expect("{");
+    while (!consume("}")) {
+        if (var->init_len == max) error_tok(token, "Too many initializers");
+        if (var->init_len == cap) {
+            cap *= 2;
+            var->init = counted_realloc(var->init, sizeof(int) * cap);
+        }
+        var->init[var->init_len++] = const_expr();
+        if (!consume(",")) {
+            expect("}");
+            break;
+        }
+    }
+}
+
+/*
+ * global_var = basetype ident ("[" num "]")* ("=" initializer)? ";"
  */
 void global_var() {
     Type* ty = basetype();
     char* name = expect_ident();
     ty = read_type_suffix(ty);
+    Var* var = push_var(name, ty, false);
+    if (consume("=")) global_init(var);
     expect(";");
-    push_var(name, ty, false);
 }
 
 /*
@@ -252,7 +299,7 @@ Node* stmt() {
         Node* node = new_node(NODE_FOR);
         expect("(");
         if (!consume(";")) {
-            node->init = expr();
+            node->init = new_unary(NODE_EXPR_STMT, expr());
             expect(";");
         }
         if (!consume(";")) {
@@ -260,7 +307,7 @@ Node* stmt() {
             expect(";");
         }
         if (!consume(")")) {
-            node->inc = expr();
+            node->inc = new_unary(NODE_EXPR_STMT, expr());
             expect(")");
         }
         node->then = stmt();
@@ -287,183 +334,274 @@ Node* stmt() {
     return node;
 }
 
-/*
- * expr = assign
- */
-Node* expr() { return assign(); }
-
-/*
- * assign = equality ("=" assign)?
- */
-Node* assign() {
-    Node* node = equality();
-
-    if (consume("=")) {
-        node = new_binary(NODE_ASSIGN, node, assign());
+// Operators and brackets waiting on the operator stack of expr()
+typedef enum {
+    OP_BINARY,   // Binary operator
+    OP_SWAPPED,  // Binary operator with swapped operands (">" and ">=")
+    OP_NEG,      // Unary "-"
+    OP_ADDR,     // Unary "&"
+    OP_DEREF,    // Unary "*"
+    OP_SIZEOF,   // "sizeof"
+    OP_PAREN,    // "(" of a parenthesized expression
+    OP_CALL,     // "(" of a function call
+    OP_INDEX,    // "[" of a subscript
+} OpKind;
+
+typedef struct Op Op;
+struct Op {
+    OpKind kind;         // Operator kind
+    NodeKind node_kind;  // Node kind (for binary operators)
+    int prec;            // Precedence; higher binds tighter
+    Node* call;          // Function call node (for OP_CALL)
+    Node* last_arg;      // Last argument parsed so far (for OP_CALL)
+};
+
+// Precedence of prefix operators, which bind tighter than any binary one
+#define PREC_UNARY 6
+
+Op* ops;      // Operator stack
+int ops_len;  // Number of operators on the stack
+int ops_cap;  // Capacity of the operator stack
+
+Node** vals;   // Operand stack
+int vals_len;  // Number of operands on the stack
+int vals_cap;  // Capacity of the operand stack
+
+void push_op(OpKind kind, NodeKind node_kind, int prec) {
+    if (ops_len == ops_cap) {
+        ops_cap = ops_cap ? ops_cap * 2 : 64;
+        ops = counted_realloc(ops, sizeof(Op) * ops_cap);
     }
+    Op* op = &ops[ops_len++];
+    op->kind = kind;
+    op->node_kind = node_kind;
+    op->prec = prec;
+    op->call = NULL;
+    op->last_arg = NULL;
+}
 
-    return node;
+void push_val(Node* node) {
+    if (vals_len == vals_cap) {
+        vals_cap = vals_cap ? vals_cap * 2 : 64;
+        vals = counted_realloc(vals, sizeof(Node*) * vals_cap);
+    }
+    vals[vals_len++] = node;
 }
 
-/*
- * equality = relational ("==" relational | "!=" relational)*
- */
-Node* equality() {
-    Node* node = relational();
+Node* pop_val() { return vals[--vals_len]; }
 
-    for (;;) {
-        if (consume("==")) {
-            node = new_binary(NODE_EQ, node, relational());
-        } else if (consume("!=")) {
-            node = new_binary(NODE_NE, node, relational());
-        } else {
-            return node;
-        }
-    }
+bool is_bracket(Op* op) {
+    return op->kind == OP_PAREN || op->kind == OP_CALL || op->kind == OP_INDEX;
 }
 
-/*
- * relational = add ("<" add | "<=" add | ">" add | ">=" add)*
- */
-Node* relational() {
-    Node* node = add();
+// Pop the operator on top of the stack and apply it to its operands.
+void apply_op() {
+    Op* op = &ops[--ops_len];
+    Node* node = pop_val();
+
+    switch (op->kind) {
+        case OP_BINARY:
+            node = new_binary(op->node_kind, pop_val(), node);
+            break;
+        case OP_SWAPPED:
+            node = new_binary(op->node_kind, node, pop_val());
+            break;
+        case OP_NEG:
+            node = new_binary(NODE_SUB, new_num(0), node);
+            break;
+        case OP_ADDR:
+            node = new_unary(NODE_ADDR, node);
+            break;
+        case OP_DEREF:
+            node = new_unary(NODE_DEREF, node);
+            break;
+        case OP_SIZEOF:
+            node = new_unary(NODE_SIZEOF, node);
+            break;
+        default:
+            error("Unbalanced expression");
+    }
+    push_val(node);
+}
 
-    for (;;) {
-        if (consume("<")) {
-            node = new_binary(NODE_LT, node, add());
-        } else if (consume("<=")) {
-            node = new_binary(NODE_LE, node, add());
-        } else if (consume(">")) {
-            node = new_binary(NODE_LT, add(), node);
-        } else if (consume(">=")) {
-            node = new_binary(NODE_LE, add(), node);
-        } else {
-            return node;
-        }
+// Apply operators down to the innermost bracket (or `base`) as long as
+// they bind at least as tightly as an incoming operator of `prec`.
+void reduce(int base, int prec, bool right_assoc) {
+    while (ops_len > base) {
+        Op* top = &ops[ops_len - 1];
+        if (is_bracket(top) || top->prec < prec ||
+            (top->prec == prec && right_assoc))
+            return;
+        apply_op();
     }
 }
 
-/*
- * add = mul ("+" mul | "-" mul)*
- */
-Node* add() {
-    Node* node = mul();
+// Index of the innermost open bracket on the operator stack, or -1.
+int innermost_bracket(int base) {
+    for (int i = ops_len - 1; i >= base; i--)
+        if (is_bracket(&ops[i])) return i;
+    return -1;
+}
 
-    for (;;) {
-        if (consume("+")) {
-            node = new_binary(NODE_ADD, node, mul());
-        } else if (consume("-")) {
-            node = new_binary(NODE_SUB, node, mul());
-        } else {
-            return node;
-        }
+// Read a binary operator, if any.
+bool consume_binary(int base) {
+    static struct {
+        char* str;
+        OpKind kind;
+        NodeKind node_kind;
+        int prec;
+    } binops[] = {
+        {"=", OP_BINARY, NODE_ASSIGN, 1},   {"==", OP_BINARY, NODE_EQ, 2},
+        {"!=", OP_BINARY, NODE_NE, 2},      {"<", OP_BINARY, NODE_LT, 3},
+        {"<=", OP_BINARY, NODE_LE, 3},      {">", OP_SWAPPED, NODE_LT, 3},
+        {">=", OP_SWAPPED, NODE_LE, 3},     {"+", OP_BINARY, NODE_ADD, 4},
+        {"-", OP_BINARY, NODE_SUB, 4},      {"*", OP_BINARY, NODE_MUL, 5},
+        {"/", OP_BINARY, NODE_DIV, 5},
+    };
+
+    for (int i = 0; i < sizeof(binops) / sizeof(*binops); i++) {
+        if (!consume(binops[i].str)) continue;
+        // "=" is right associative; everything else is left associative.
+        reduce(base, binops[i].prec, binops[i].node_kind == NODE_ASSIGN);
+        push_op(binops[i].kind, binops[i].node_kind, binops[i].prec);
+        return true;
     }
+    return false;
 }
 
 /*
- * mul = unary ("*" unary | "/" unary)*
+ * expr       = assign
+ * assign     = equality ("=" assign)?
+ * equality   = relational ("==" relational | "!=" relational)*
+ * relational = add ("<" add | "<=" add | ">" add | ">=" add)*
+ * add        = mul ("+" mul | "-" mul)*
+ * mul        = unary ("*" unary | "/" unary)*
+ * unary      = ("+" | "-" | "&" | "*" | "sizeof") unary
+ *            | postfix
+ * postfix    = primary ("[" expr "]")*
+ * primary    = "(" expr ")"
+ *            | ident ("(" (expr ("," expr)*)? ")")?
+ *            | num
+ *
+ * The grammar above is parsed by operator precedence with explicit operator
+ * and operand stacks rather than one recursive call per level, so nesting
+ * depth is bounded by memory instead of the C stack.
  */
-Node* mul() {
-    Node* node = unary();
+Node* expr() {
+    int ops_base = ops_len;
+    bool want_operand = true;
 
     for (;;) {
-        if (consume("*")) {
-            node = new_binary(NODE_MUL, node, unary());
-        } else if (consume("/")) {
-            node = new_binary(NODE_DIV, node, unary());
-        } else {
-            return node;
+        if (want_operand) {
+            if (consume("sizeof")) {
+                push_op(OP_SIZEOF, 0, PREC_UNARY);
+            } else if (consume("+")) {
+                // Unary plus is a no-op.
+            } else if (consume("-")) {
+                push_op(OP_NEG, 0, PREC_UNARY);
+            } else if (consume("&")) {
+                push_op(OP_ADDR, 0, PREC_UNARY);
+            } else if (consume("*")) {
+                push_op(OP_DEREF, 0, PREC_UNARY);
+            } else if (consume("(")) {
+                push_op(OP_PAREN, 0, 0);
+            } else {
+                want_operand = primary();
+            }
+            continue;
         }
-    }
-}
 
-/*
- * unary = ("+" | "-" | "&" | "*") unary
- *       | postfix
- *       | "sizeof" unary
- */
-Node* unary() {
-    if (consume("sizeof")) {
-        return new_unary(NODE_SIZEOF, unary());
-    }
+        if (consume("[")) {
+            push_op(OP_INDEX, 0, 0);
+            want_operand = true;
+            continue;
+        }
 
-    if (consume("+")) {
-        return unary();
-    }
+        if (consume_binary(ops_base)) {
+            want_operand = true;
+            continue;
+        }
 
-    if (consume("-")) {
-        return new_binary(NODE_SUB, new_num(0), unary());
-    }
+        int i = innermost_bracket(ops_base);
+        if (i < 0) break;
+
+        if (ops[i].kind == OP_INDEX) {
+            expect("]");
+            reduce(ops_base, 0, false);
+            ops_len--;
+            Node* idx = pop_val();
+            Node* exp = new_binary(NODE_ADD, pop_val(), idx);
+            push_val(new_unary(NODE_DEREF, exp));
+            continue;
+        }
 
-    if (consume("&")) {
-        return new_unary(NODE_ADDR, unary());
-    }
+        if (ops[i].kind == OP_PAREN) {
+            expect(")");
+            reduce(ops_base, 0, false);
+            ops_len--;
+            continue;
+        }
 
-    if (consume("*")) {
-        return new_unary(NODE_DEREF, unary());
+        // Function call: append the argument just parsed.
+        bool last = !consume(",");
+        if (last) expect(")");
+        reduce(ops_base, 0, false);
+        Op* op = &ops[ops_len - 1];
+        Node* arg = pop_val();
+        if (op->last_arg)
+            op->last_arg->next = arg;
+        else
+            op->call->args = arg;
+        op->last_arg = arg;
+        op->call->argnum++;
+
+        if (last) {
+            ops_len--;
+            push_val(op->call);
+        } else {
+            want_operand = true;
+        }
     }
 
-    return postfix();
+    reduce(ops_base, 0, false);
+    return pop_val();
 }
 
 /*
- * postfix = primary ("[" expr "]")*
+ * primary = ident ("(" ...)? | num
+ *
+ * Parenthesized expressions and function call arguments are parsed by
+ * expr(). For a call with arguments, this pushes an OP_CALL bracket instead
+ * of an operand. Returns whether expr() still expects an operand.
  */
-Node* postfix() {
-    Node* node = primary();
-
-    while (consume("[")) {
-        Node* exp = new_binary(NODE_ADD, node, expr());
-        expect("]");
-        node = new_unary(NODE_DEREF, exp);
+bool primary() {
+    Token* tok = consume_ident();
+    if (!tok) {
+        push_val(new_num(expect_number()));
+        return false;
     }
-    return node;
-}
 
-/*
- * primary = "(" expr ")"
- *         | ident ("(" (assign ("," assign)*)? ")")?
- *         | num
- */
-Node* primary() {
     if (consume("(")) {
-        Node* node = expr();
-        expect(")");
-        return node;
-    }
-
-    Token* tok = consume_ident();
-    if (tok) {
-        if (consume("(")) {
-            Node* node = new_node(NODE_FUNCALL);
-            node->funcname = calloc(1, tok->len + 1);
-            strncpy(node->funcname, tok->str, tok->len);
-            node->argnum = 0;
-            node->args = NULL;
-
-            if (consume(")")) {
-                return node;
-            }
-
-            node->args = expr();
-            node->argnum++;
-            Node* cur = node->args;
-
-            while (consume(",")) {
-                cur->next = expr();
-                node->argnum++;
-                cur = cur->next;
-            }
-
-            expect(")");
-            return node;
+        Node* node = new_node(NODE_FUNCALL);
+        node->funcname = counted_calloc(1, tok->len + 1);
+        strncpy(node->funcname, tok->str, tok->len);
+        node->argnum = 0;
+        node->args = NULL;
+        type_node(node);
+
+        if (consume(")")) {
+            push_val(node);
+            return false;
         }
 
-        Var* var = find_var(tok);
-        if (!var) error_tok(tok, "undefined variable");
-
-        return new_var(var);
+        push_op(OP_CALL, 0, 0);
+        ops[ops_len - 1].call = node;
+        return true;
     }
 
-    return new_num(expect_number());
+    Var* var = find_var(tok);
+    if (!var) error_tok(tok, "undefined variable");
+
+    push_val(new_var(var));
+    return false;
 }
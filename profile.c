@@ -0,0 +1,194 @@
+#include "ycc.h"
+
+// Profile-guided optimization. Before any other pass, every function, `if`
+// and loop is given profile counters, numbered in the same order on every
+// compilation of the same program:
+//
+//   function  calls
+//   if        runs of the then arm, runs of the else arm
+//   loop      entries, iterations of the body
+//
+// Under -fprofile-generate, NODE_COUNTER statements incrementing them are
+// inserted at the start of each function body and arm, before each loop
+// and at the start of each loop body. Since they are inserted before the
+// other passes, inlined and unrolled copies count for the code they were
+// copied from. The program writes the counts to the profile file when it
+// exits, one line per counter: the function, the index of the counter in
+// the function and the count.
+//
+// Under -fprofile-use, the counts are read back and the passes consult
+// them: cold arms of `if` and functions never called go to .text.unlikely,
+// a hot else arm falls through from the condition, cold functions are
+// neither inlined nor inlined into while hot ones may be twice as large,
+// and loops running fewer iterations per entry than the unroll factor
+// aren't unrolled.
+
+// An arm taken in less than 1 in PROFILE_COLD_RATIO runs of its `if` is
+// cold.
+#define PROFILE_COLD_RATIO 100
+
+// A function called at least 1 in PROFILE_HOT_RATIO times as often as the
+// most called one is hot.
+#define PROFILE_HOT_RATIO 10
+
+ProfileFunc* profile_funcs;  // Counters of each function
+int profile_funcs_len;
+int profile_funcs_cap;
+int counters_len;        // Counters are numbered from 1, 0 is none.
+long* profile_counts;    // Counts read by -fprofile-use, or NULL
+long profile_max_calls;  // Calls of the most called function
+
+// The `if` and loop nodes of the function being numbered
+Node** profiled;
+int profiled_len;
+int profiled_cap;
+
+void find_profiled(Node* node, void* arg) {
+    if (node->kind != NODE_IF && node->kind != NODE_WHILE &&
+        node->kind != NODE_FOR)
+        return;
+    if (profiled_len == profiled_cap) {
+        profiled_cap = profiled_cap ? profiled_cap * 2 : 16;
+        profiled = counted_realloc(profiled, sizeof(Node*) * profiled_cap);
+    }
+    profiled[profiled_len++] = node;
+}
+
+Node* new_counter(int counter) {
+    Node* node = new_node(NODE_COUNTER);
+    node->counter = counter;
+    return node;
+}
+
+// Block of an increment of `counter` followed by the statement `stmt`
+Node* count_before(int counter, Node* stmt) {
+    Node* block = new_node(NODE_BLOCK);
+    block->body = new_counter(counter);
+    block->body->next = stmt;
+    return block;
+}
+
+// Insert the increments of the counters of the `if` or loop `node`.
+void instrument(Node* node) {
+    if (node->kind == NODE_IF) {
+        node->then = count_before(node->counter, node->then);
+        node->els = node->els ? count_before(node->counter + 1, node->els)
+                              : new_counter(node->counter + 1);
+        return;
+    }
+    node->then = count_before(node->counter + 1, node->then);
+
+    // The loop moves into a block after the increment of its entries.
+    Node* loop = new_node(node->kind);
+    *loop = *node;
+    loop->next = NULL;
+    Node* next = node->next;
+    *node = *count_before(node->counter, loop);
+    node->next = next;
+}
+
+void add_profile_func(Function* fn, int len) {
+    if (profile_funcs_len == profile_funcs_cap) {
+        profile_funcs_cap = profile_funcs_cap ? profile_funcs_cap * 2 : 16;
+        profile_funcs = counted_realloc(
+            profile_funcs, sizeof(ProfileFunc) * profile_funcs_cap);
+    }
+    ProfileFunc* pf = &profile_funcs[profile_funcs_len++];
+    pf->name = fn->name;
+    pf->counter = fn->counter;
+    pf->len = len;
+}
+
+int compare_profile_funcs(const void* a, const void* b) {
+    return strcmp(((ProfileFunc*)a)->name, ((ProfileFunc*)b)->name);
+}
+
+// Store the counts of the profile file `path` in profile_counts. Counts
+// of functions that no longer exist or have fewer counters are ignored,
+// and counters missing from the file stay unknown (-1).
+void read_profile(char* path) {
+    FILE* fp = fopen(path, "r");
+    if (!fp) error("Cannot open profile '%s'", path);
+    profile_counts = counted_malloc(sizeof(long) * (counters_len + 1));
+    for (int i = 0; i <= counters_len; i++) profile_counts[i] = -1;
+    ProfileFunc* sorted =
+        counted_malloc(sizeof(ProfileFunc) * profile_funcs_len);
+    memcpy(sorted, profile_funcs, sizeof(ProfileFunc) * profile_funcs_len);
+    qsort(sorted, profile_funcs_len, sizeof(ProfileFunc),
+          compare_profile_funcs);
+
+    char* name;
+    int index;
+    long count;
+    while (fscanf(fp, "%ms %d %ld", &name, &index, &count) == 3) {
+        ProfileFunc key = {.name = name};
+        ProfileFunc* pf = bsearch(&key, sorted, profile_funcs_len,
+                                  sizeof(ProfileFunc), compare_profile_funcs);
+        if (pf && index >= 0 && index < pf->len)
+            profile_counts[pf->counter + index] = count;
+        free(name);
+    }
+    fclose(fp);
+    free(sorted);
+
+    for (int i = 0; i < profile_funcs_len; i++) {
+        long calls = profile_counts[profile_funcs[i].counter];
+        if (calls > profile_max_calls) profile_max_calls = calls;
+    }
+}
+
+void profile(Program* prog) {
+    for (Function* fn = prog->funcs; fn; fn = fn->next) {
+        fn->counter = ++counters_len;
+        profiled_len = 0;
+        visit_nodes(fn->node, find_profiled, NULL);
+        for (int i = 0; i < profiled_len; i++) {
+            profiled[i]->counter = counters_len + 1;
+            counters_len += 2;
+        }
+        add_profile_func(fn, counters_len + 1 - fn->counter);
+
+        if (!opt_profile_generate) continue;
+        for (int i = 0; i < profiled_len; i++) instrument(profiled[i]);
+        Node* entry = new_counter(fn->counter);
+        entry->next = fn->node;
+        fn->node = entry;
+    }
+    if (opt_profile_use) read_profile(opt_profile_use);
+}
+
+// Count of `counter` in the profile, or -1 if unknown
+long profile_count(int counter) {
+    if (!profile_counts || !counter) return -1;
+    return profile_counts[counter];
+}
+
+// Whether the profile shows that `fn` is never called
+bool is_cold_function(Function* fn) { return profile_count(fn->counter) == 0; }
+
+// Whether the profile shows that `fn` is among the most called functions
+bool is_hot_function(Function* fn) {
+    long calls = profile_count(fn->counter);
+    return calls > 0 && calls * PROFILE_HOT_RATIO >= profile_max_calls;
+}
+
+// Whether the profile shows that the then arm of the `if` `node`, or its
+// else arm if `els` is set, rarely runs when the `if` does
+bool is_cold_arm(Node* node, bool els) {
+    long then = profile_count(node->counter);
+    long other = profile_count(node->counter + 1);
+    if (then < 0 || then + other == 0) return false;
+    long arm = els ? other : then;
+    return arm * PROFILE_COLD_RATIO < then + other;
+}
+
+// Average iterations of the loop `loop` per entry in the profile, or -1 if
+// unknown. A loop never entered has 0.
+int profile_trips(Node* loop) {
+    long entries = profile_count(loop->counter);
+    long iterations = profile_count(loop->counter + 1);
+    if (entries < 0) return -1;
+    if (entries == 0) return 0;
+    long trips = iterations / entries;
+    return trips > INT_MAX ? INT_MAX : trips;
+}
@@ -0,0 +1,130 @@
+#include <malloc.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "ycc.h"
+
+Stats stats;  // Counters updated by each compiler phase
+
+typedef struct PhaseReport PhaseReport;
+struct PhaseReport {
+    char* name;    // Phase name
+    bool ran;      // Whether the phase has been run
+    double wall;   // Wall clock time in seconds
+    double cpu;    // CPU time in seconds
+    Stats counts;  // Counters incremented during the phase
+};
+
+PhaseReport phases[PHASE_COUNT] = {
+    {"tokenize"}, {"parse"}, {"type"}, {"opt"}, {"layout"}, {"codegen"},
+};
+
+// Snapshot taken at phase_begin()
+double start_wall;
+double start_cpu;
+Stats start_stats;
+
+double wall_time() {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+double cpu_time() { return (double)clock() / CLOCKS_PER_SEC; }
+
+// malloc(), calloc() and realloc() for the data of the compiler, adding
+// the bytes they allocate to stats.bytes. A realloc() counts what it adds
+// to the block, so an array doubled until it holds N bytes counts about N
+// bytes. Memory freed later still counts. The tokens are counted once the
+// lexer threads are done, and the C library, the cache, the server and the
+// lexer's scratch buffers allocate without counting.
+void* counted_malloc(size_t size) {
+    stats.bytes += size;
+    return malloc(size);
+}
+
+void* counted_calloc(size_t n, size_t size) {
+    if (size && n > SIZE_MAX / size) return NULL;
+    stats.bytes += n * size;
+    return calloc(n, size);
+}
+
+void* counted_realloc(void* ptr, size_t size) {
+    size_t old = ptr ? malloc_usable_size(ptr) : 0;
+    if (size > old) stats.bytes += size - old;
+    return realloc(ptr, size);
+}
+
+void phase_begin(Phase phase) {
+    start_stats = stats;
+    start_cpu = cpu_time();
+    start_wall = wall_time();
+}
+
+void phase_end(Phase phase) {
+    PhaseReport* p = &phases[phase];
+    p->ran = true;
+    p->wall += wall_time() - start_wall;
+    p->cpu += cpu_time() - start_cpu;
+    p->counts.bytes += stats.bytes - start_stats.bytes;
+    p->counts.tokens += stats.tokens - start_stats.tokens;
+    p->counts.nodes += stats.nodes - start_stats.nodes;
+    p->counts.types += stats.types - start_stats.types;
+    p->counts.vars += stats.vars - start_stats.vars;
+    p->counts.insns += stats.insns - start_stats.insns;
+}
+
+void print_text_report(FILE* out) {
+    fprintf(out, "\nExecution times (seconds)\n");
+    fprintf(out, " %-10s %10s %10s %12s %8s %8s %8s %8s %8s\n", "phase",
+            "wall", "cpu", "bytes", "tokens", "nodes", "types", "vars",
+            "insns");
+
+    PhaseReport total = {"TOTAL"};
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        PhaseReport* p = &phases[i];
+        if (!p->ran) continue;
+        fprintf(out, " %-10s %10.6f %10.6f %12ld %8ld %8ld %8ld %8ld %8ld\n",
+                p->name, p->wall, p->cpu, p->counts.bytes, p->counts.tokens,
+                p->counts.nodes, p->counts.types, p->counts.vars,
+                p->counts.insns);
+        total.wall += p->wall;
+        total.cpu += p->cpu;
+    }
+    fprintf(out, " %-10s %10.6f %10.6f %12ld %8ld %8ld %8ld %8ld %8ld\n",
+            total.name, total.wall, total.cpu, stats.bytes, stats.tokens,
+            stats.nodes, stats.types, stats.vars, stats.insns);
+}
+
+void print_json_report(FILE* out) {
+    fprintf(out, "{\"phases\": [");
+    bool first = true;
+    double wall = 0, cpu = 0;
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        PhaseReport* p = &phases[i];
+        if (!p->ran) continue;
+        fprintf(out,
+                "%s{\"name\": \"%s\", \"wall\": %.9f, \"cpu\": %.9f, "
+                "\"bytes\": %ld, \"tokens\": %ld, \"nodes\": %ld, "
+                "\"types\": %ld, \"vars\": %ld, \"insns\": %ld}",
+                first ? "" : ", ", p->name, p->wall, p->cpu, p->counts.bytes,
+                p->counts.tokens, p->counts.nodes, p->counts.types,
+                p->counts.vars, p->counts.insns);
+        first = false;
+        wall += p->wall;
+        cpu += p->cpu;
+    }
+    fprintf(out,
+            "], \"total\": {\"wall\": %.9f, \"cpu\": %.9f, \"bytes\": %ld, "
+            "\"tokens\": %ld, \"nodes\": %ld, \"types\": %ld, \"vars\": %ld, "
+            "\"insns\": %ld}}\n",
+            wall, cpu, stats.bytes, stats.tokens, stats.nodes, stats.types,
+            stats.vars, stats.insns);
+}
+
+void print_time_report(FILE* out, bool json) {
+    if (json)
+        print_json_report(out);
+    else
+        print_text_report(out);
+}
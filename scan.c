@@ -0,0 +1,131 @@
+#include <immintrin.h>
+
+#include "ycc.h"
+
+// Fast paths of the tokenizer. Each scanner returns the first position in
+// [p, end) whose byte is not in its character class, or `end`. The SSE2 and
+// AVX2 versions classify 16 or 32 bytes at a time and never read at or
+// beyond `end`; the tail is left to the scalar versions. Since most runs in
+// real code are a byte or two long, they check the first byte before
+// loading a vector.
+
+char* (*scan_space)(char* p, char* end);   // isspace()
+char* (*scan_ident)(char* p, char* end);   // [0-9A-Za-z_]
+char* (*scan_digits)(char* p, char* end);  // [0-9]
+
+bool is_space_char(char c) { return isspace(c); }
+bool is_ident_char(char c) { return is_alnum(c); }
+bool is_digits_char(char c) { return isdigit(c); }
+
+char* scan_space_scalar(char* p, char* end) {
+    while (p < end && is_space_char(*p)) p++;
+    return p;
+}
+
+char* scan_ident_scalar(char* p, char* end) {
+    while (p < end && is_ident_char(*p)) p++;
+    return p;
+}
+
+char* scan_digits_scalar(char* p, char* end) {
+    while (p < end && is_digits_char(*p)) p++;
+    return p;
+}
+
+// Bytes are compared as signed, so non-ASCII bytes fall in no class.
+__m128i in_range_sse2(__m128i c, char lo, char hi) {
+    return _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8(lo - 1)),
+                         _mm_cmplt_epi8(c, _mm_set1_epi8(hi + 1)));
+}
+
+__m128i space_sse2(__m128i c) {
+    return _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(' ')),
+                        in_range_sse2(c, '\t', '\r'));
+}
+
+__m128i ident_sse2(__m128i c) {
+    __m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+    return _mm_or_si128(
+        _mm_or_si128(in_range_sse2(lower, 'a', 'z'), in_range_sse2(c, '0', '9')),
+        _mm_cmpeq_epi8(c, _mm_set1_epi8('_')));
+}
+
+__m128i digits_sse2(__m128i c) { return in_range_sse2(c, '0', '9'); }
+
+#define DEFINE_SCAN_SSE2(name)                                        \
+    char* scan_##name##_sse2(char* p, char* end) {                    \
+        if (p == end || !is_##name##_char(*p)) return p;              \
+        for (; end - p >= 16; p += 16) {                              \
+            __m128i c = _mm_loadu_si128((__m128i*)p);                 \
+            int mask = ~_mm_movemask_epi8(name##_sse2(c)) & 0xffff;   \
+            if (mask) return p + __builtin_ctz(mask);                 \
+        }                                                             \
+        return scan_##name##_scalar(p, end);                          \
+    }
+
+DEFINE_SCAN_SSE2(space)
+DEFINE_SCAN_SSE2(ident)
+DEFINE_SCAN_SSE2(digits)
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 __m256i in_range_avx2(__m256i c, char lo, char hi) {
+    return _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8(lo - 1)),
+                            _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), c));
+}
+
+AVX2 __m256i space_avx2(__m256i c) {
+    return _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8(' ')),
+                           in_range_avx2(c, '\t', '\r'));
+}
+
+AVX2 __m256i ident_avx2(__m256i c) {
+    __m256i lower = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+    return _mm256_or_si256(_mm256_or_si256(in_range_avx2(lower, 'a', 'z'),
+                                           in_range_avx2(c, '0', '9')),
+                           _mm256_cmpeq_epi8(c, _mm256_set1_epi8('_')));
+}
+
+AVX2 __m256i digits_avx2(__m256i c) { return in_range_avx2(c, '0', '9'); }
+
+#define DEFINE_SCAN_AVX2(name)                                             \
+    AVX2 char* scan_##name##_avx2(char* p, char* end) {                    \
+        if (p == end || !is_##name##_char(*p)) return p;                   \
+        for (; end - p >= 32; p += 32) {                                   \
+            __m256i c = _mm256_loadu_si256((__m256i*)p);                   \
+            unsigned mask = ~(unsigned)_mm256_movemask_epi8(name##_avx2(c)); \
+            if (mask) return p + __builtin_ctz(mask);                      \
+        }                                                                  \
+        return scan_##name##_sse2(p, end);                                 \
+    }
+
+DEFINE_SCAN_AVX2(space)
+DEFINE_SCAN_AVX2(ident)
+DEFINE_SCAN_AVX2(digits)
+
+// Select the scanners. SCAN_AUTO picks the best one the CPU supports.
+void init_scan(ScanLevel level) {
+    __builtin_cpu_init();
+    if (level == SCAN_AUTO)
+        level = __builtin_cpu_supports("avx2") ? SCAN_AVX2 : SCAN_SSE2;
+    if (level == SCAN_AVX2 && !__builtin_cpu_supports("avx2"))
+        error("AVX2 is not supported by this CPU");
+
+    switch (level) {
+        case SCAN_SCALAR:
+            scan_space = scan_space_scalar;
+            scan_ident = scan_ident_scalar;
+            scan_digits = scan_digits_scalar;
+            return;
+        case SCAN_SSE2:
+            scan_space = scan_space_sse2;
+            scan_ident = scan_ident_sse2;
+            scan_digits = scan_digits_sse2;
+            return;
+        default:
+            scan_space = scan_space_avx2;
+            scan_ident = scan_ident_avx2;
+            scan_digits = scan_digits_avx2;
+            return;
+    }
+}
@@ -0,0 +1,227 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "ycc.h"
+
+// Compiler server. `ycc --server` listens on a Unix socket and compiles
+// the programs that ycc-client sends it, which saves build systems running
+// ycc many times the startup of a process per compilation. A pool of
+// workers forked from the server waits for connections. The compiler keeps
+// its state in globals, so a worker saves them when it starts and puts
+// them back after each request, which gives every request the state of a
+// fresh compiler without a new process. The memory of a compilation is
+// never freed, so a worker whose heap grew past MAX_WORKER_HEAP exits after
+// its request and the server forks a new one. So does a worker whose
+// request failed, since error() exits.
+//
+// The client passes its standard input, output and error along with one
+// byte of the request, so the worker reads the program and writes the
+// assembly and the errors as ycc would. All integers are 32-bit in host
+// byte order. The rest of the request is the working directory of the
+// client, the number of arguments and each argument, each string preceded
+// by its length. The response is the exit status of the compilation.
+
+// Most arguments of a request
+#define MAX_SERVER_ARGS 256
+
+// Most bytes of heap a worker may have before it stops taking requests
+#define MAX_WORKER_HEAP (64 << 20)
+
+// Bounds of the globals of the program, which start with the initialized
+// ones and end with the zeroed ones
+extern char __data_start[];  // Defined by crt1.o
+extern char _end[];          // Defined by the linker
+
+// Whether SIGINT or SIGTERM asked the server to stop
+volatile sig_atomic_t server_stopping;
+
+// Connection and exit status of the request a worker is serving
+int server_conn = -1;
+int server_status = 1;
+
+bool read_full(int fd, void* buf, size_t len) {
+    char* p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Read a string preceded by its length.
+char* read_string(int fd) {
+    uint32_t len;
+    if (!read_full(fd, &len, sizeof(len))) return NULL;
+    char* buf = malloc((size_t)len + 1);
+    if (!read_full(fd, buf, len)) return NULL;
+    buf[len] = '\0';
+    return buf;
+}
+
+// Receive the byte that the standard input, output and error of the
+// client come with and make them ours.
+bool receive_stdio(int fd) {
+    char byte;
+    struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+    } control;
+    struct msghdr msg = {.msg_iov = &iov,
+                         .msg_iovlen = 1,
+                         .msg_control = control.buf,
+                         .msg_controllen = sizeof(control.buf)};
+    if (recvmsg(fd, &msg, 0) != 1) return false;
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+        cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int)))
+        return false;
+    int fds[3];
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    for (int i = 0; i < 3; i++) {
+        dup2(fds[i], i);
+        close(fds[i]);
+    }
+    return true;
+}
+
+// Send the exit status of the request being served. This also runs when
+// error() exits in the middle of a request.
+void send_status() {
+    if (server_conn < 0) return;
+    fflush(stdout);
+    fflush(stderr);
+    int32_t status = server_status;
+    write(server_conn, &status, sizeof(status));
+    server_conn = -1;
+}
+
+// Compile the request on the connection `conn` and return its exit status.
+int serve_request(int conn) {
+    if (!receive_stdio(conn)) _exit(1);
+    char* cwd = read_string(conn);
+    uint32_t argc;
+    if (!cwd || !read_full(conn, &argc, sizeof(argc)) || argc < 1 ||
+        argc > MAX_SERVER_ARGS)
+        _exit(1);
+    char** argv = calloc(argc + 1, sizeof(char*));
+    for (uint32_t i = 0; i < argc; i++)
+        if (!(argv[i] = read_string(conn))) _exit(1);
+    if (chdir(cwd)) _exit(1);
+
+    // A worker doesn't start servers of its own.
+    server_conn = conn;
+    for (uint32_t i = 1; i < argc; i++)
+        if (!strncmp(argv[i], "--server", 8) ||
+            !strncmp(argv[i], "--workers=", 10))
+            usage();
+    opt_server = NULL;
+    return ycc_main(argc, argv);
+}
+
+// Stop using the standard streams of the client, so that it sees the end
+// of its output once it has the status, and forget what was left of its
+// input.
+void release_stdio() {
+    int null = open("/dev/null", O_RDWR);
+    for (int i = 0; i < 3; i++) dup2(null, i);
+    close(null);
+    clearerr(stdin);
+    clearerr(stdout);
+    clearerr(stderr);
+}
+
+// Fork a worker that serves connections on the socket `sock`. The signals
+// stopping the server are blocked until the worker no longer handles them
+// like the server, or it could miss being stopped.
+pid_t spawn_worker(int sock) {
+    sigset_t stop, old;
+    sigemptyset(&stop);
+    sigaddset(&stop, SIGINT);
+    sigaddset(&stop, SIGTERM);
+    sigprocmask(SIG_BLOCK, &stop, &old);
+    pid_t pid = fork();
+    if (pid == 0) {
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+    }
+    sigprocmask(SIG_SETMASK, &old, NULL);
+    if (pid != 0) return pid;
+
+    size_t size = _end - __data_start;
+    char* fresh = malloc(size);
+    memcpy(fresh, __data_start, size);
+    atexit(send_status);
+    for (;;) {
+        int conn;
+        do {
+            conn = accept(sock, NULL, NULL);
+        } while (conn < 0 && errno == EINTR);
+        if (conn < 0) _exit(1);
+        server_status = serve_request(conn);
+        send_status();
+        close(conn);
+        release_stdio();
+
+        struct mallinfo2 mi = mallinfo2();
+        if (mi.arena + mi.hblkhd > MAX_WORKER_HEAP) _exit(0);
+        memcpy(__data_start, fresh, size);
+    }
+}
+
+void stop_server(int sig) { server_stopping = 1; }
+
+// Serve compile requests on the Unix socket `path` with `nworkers` workers,
+// or one per core if 0, waiting for connections until SIGINT or SIGTERM.
+int serve(char* path, int nworkers) {
+    if (nworkers < 1) nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nworkers < 1) nworkers = 1;
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path))
+        error("Socket path too long: %s", path);
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if (sock < 0 || bind(sock, (struct sockaddr*)&addr, sizeof(addr)) ||
+        listen(sock, SOMAXCONN))
+        error("Cannot listen on '%s': %s", path, strerror(errno));
+
+    // Without SA_RESTART, the signals interrupt wait().
+    struct sigaction sa = {.sa_handler = stop_server};
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    pid_t* workers = calloc(nworkers, sizeof(pid_t));
+    for (int i = 0; i < nworkers; i++) workers[i] = spawn_worker(sock);
+    while (!server_stopping) {
+        pid_t pid = wait(NULL);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (int i = 0; i < nworkers; i++)
+            if (workers[i] == pid) workers[i] = spawn_worker(sock);
+    }
+
+    for (int i = 0; i < nworkers; i++)
+        if (workers[i] > 0) kill(workers[i], SIGTERM);
+    while (wait(NULL) > 0) continue;
+    unlink(path);
+    free(workers);
+    return 0;
+}
@@ -14,3 +14,6 @@ void alloc4(int** ptr, int a, int b, int c, int d) {
     (*ptr)[2] = c;
     (*ptr)[3] = d;
 }
+
+// 1 if the stack was 16-byte aligned at the call, as the ABI requires.
+int stack_aligned() { return ((long)__builtin_frame_address(0) & 15) == 0; }
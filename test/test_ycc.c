@@ -1,64 +1,903 @@
+#include <fcntl.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
-// Test counter for summary
+// Compiler entry point, linked in from driver.c for --in-process.
+int ycc_main(int argc, char** argv);
+
+typedef struct {
+    int expected;       // Expected exit status
+    const char* input;  // Program source
+    const char* name;   // Shown instead of the source if set
+} TestCase;
+
+// Exit statuses of the compiled program are 0..255. Negative values tell
+// which step of a test case failed.
+enum {
+    STEP_RUN_FAILED = -1,
+    STEP_YCC_FAILED = -2,
+    STEP_CC_FAILED = -3,
+};
+
+typedef struct {
+    int index;      // Index of the test case
+    int actual;     // Exit status of the compiled program or STEP_*
+    double millis;  // Time to compile, assemble and run the test case
+} TestResult;
+
+// Registered test cases
+static TestCase* test_cases;
 static int test_count = 0;
-static int passed_count = 0;
+static int test_cap = 0;
+
+static int jobs = 0;          // Number of worker processes (-j)
+static int in_process = 0;    // Run the compiler without exec (--in-process)
+static char* ycc_flags[16];   // Extra ycc options, e.g. -O2
+static int ycc_nflags = 0;
+static char helper_dir[] = "/tmp/ycc-helper-XXXXXX";
+static char helper_obj[64];  // test_helper.c compiled once for all cases
+
+static double now_millis() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Redirect file descriptor `fd` to the file at `path`.
+static int redirect(int fd, const char* path, int flags) {
+    int f = open(path, flags, 0644);
+    if (f < 0) return -1;
+    dup2(f, fd);
+    close(f);
+    return 0;
+}
 
-// Function to execute a command and return its exit status
-int execute_command(const char* command) {
-    int status = system(command);
+// Write the source of a test case to `path`.
+static int write_file(const char* path, const char* input) {
+    FILE* fp = fopen(path, "w");
+    if (!fp) return -1;
+    fputs(input, fp);
+    return fclose(fp);
+}
+
+// Run argv[0] with stdin and stdout redirected to `in` and `out` (if given)
+// and return its exit status. No shell is involved, so nothing needs quoting.
+static int run_process(char** argv, const char* in, const char* out) {
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) {
+        if (in && redirect(0, in, O_RDONLY)) _exit(127);
+        if (out) {
+            int fd = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) _exit(127);
+            dup2(fd, 1);
+            close(fd);
+        }
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
     if (WIFEXITED(status)) {
         return WEXITSTATUS(status);
     }
     return -1;
 }
 
-// Assert function that mirrors the bash script functionality
-void assert(int expected, const char* input) {
+// Build the ycc command line for a test case. Test cases also check the
+// types built by the parser.
+static int ycc_argv(char* ycc, char** argv) {
+    int argc = 0;
+    argv[argc++] = ycc;
+    argv[argc++] = "--verify-types";
+    for (int i = 0; i < ycc_nflags; i++) argv[argc++] = ycc_flags[i];
+    argv[argc++] = "-";
+    argv[argc] = NULL;
+    return argc;
+}
+
+// Same as running ./ycc, but calls the compiler linked into this binary in
+// a forked child, which keeps the compiler's global state per test case.
+static int compile_in_process(const char* in, const char* out) {
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) {
+        if (redirect(0, in, O_RDONLY)) _exit(127);
+        if (redirect(1, out, O_WRONLY | O_CREAT | O_TRUNC)) _exit(127);
+
+        char* argv[20];
+        int argc = ycc_argv("ycc", argv);
+        int rc = ycc_main(argc, argv);
+        fflush(stdout);
+        _exit(rc);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    if (WIFEXITED(status)) {
+        return WEXITSTATUS(status);
+    }
+    return -1;
+}
+
+// Compile, assemble and run a test case in its own temporary directory.
+static void run_case(int index, TestResult* res) {
+    const char* input = test_cases[index].input;
+    double start = now_millis();
+    res->index = index;
+
+    char dir[] = "/tmp/ycc-test-XXXXXX";
+    if (!mkdtemp(dir)) {
+        res->actual = STEP_YCC_FAILED;
+        return;
+    }
+
+    // The source is passed on stdin, since it can exceed the size limit of
+    // a command line argument.
+    char src_path[64], asm_path[64], exe_path[64];
+    snprintf(src_path, sizeof(src_path), "%s/tmp.c", dir);
+    snprintf(asm_path, sizeof(asm_path), "%s/tmp.s", dir);
+    snprintf(exe_path, sizeof(exe_path), "%s/tmp", dir);
+
+    char* ycc_args[20];
+    ycc_argv("./ycc", ycc_args);
+    char* cc_argv[] = {"cc", "-o", exe_path, asm_path, helper_obj, NULL};
+    char* run_argv[] = {exe_path, NULL};
+
+    int rc = -1;
+    if (write_file(src_path, input) == 0)
+        rc = in_process ? compile_in_process(src_path, asm_path)
+                        : run_process(ycc_args, src_path, asm_path);
+    if (rc != 0)
+        res->actual = STEP_YCC_FAILED;
+    else if (run_process(cc_argv, NULL, NULL) != 0)
+        res->actual = STEP_CC_FAILED;
+    else
+        res->actual = run_process(run_argv, NULL, NULL);
+
+    unlink(src_path);
+    unlink(asm_path);
+    unlink(exe_path);
+    rmdir(dir);
+    res->millis = now_millis() - start;
+}
+
+// Register a test case shown as `name` in the results.
+static void assert_named(int expected, const char* name, const char* input) {
+    if (test_count == test_cap) {
+        test_cap = test_cap ? test_cap * 2 : 128;
+        test_cases = realloc(test_cases, sizeof(TestCase) * test_cap);
+    }
+    test_cases[test_count].expected = expected;
+    test_cases[test_count].input = input;
+    test_cases[test_count].name = name;
     test_count++;
+}
 
-    // Compile test helper
-    if (execute_command("cc -c ./test/test_helper.c -o test_helper.o") != 0) {
-        fprintf(stderr, "Failed to compile test_helper.c\n");
-        exit(1);
+// Register a test case. Test cases are run by run_tests().
+static void assert(int expected, const char* input) {
+    assert_named(expected, NULL, input);
+}
+
+// Build "int main() { return (((1+1)+1)...+1); }" with `depth` levels of
+// nesting. Generated trees are left-deep, so the compiled program itself
+// only needs a couple of stack slots.
+static char* nested_parens(int depth) {
+    char* buf = malloc(depth * 4 + 64);
+    char* p = buf + sprintf(buf, "int main() { return ");
+    memset(p, '(', depth);
+    p += depth;
+    p += sprintf(p, "1");
+    for (int i = 0; i < depth; i++) p += sprintf(p, "+1)");
+    sprintf(p, "; }");
+    return buf;
+}
+
+// Build a loop storing a[i] = ((a[i]+1)+1)...+1 with `depth` levels of
+// nesting, which -O2 tries to vectorize, returning a[3].
+static char* nested_in_loop(int depth) {
+    char* buf = malloc(depth * 4 + 128);
+    char* p = buf + sprintf(buf, "int a[10]; int main() { int i; "
+                                 "for (i=0; i<8; i=i+1) a[i] = ");
+    memset(p, '(', depth);
+    p += depth;
+    p += sprintf(p, "a[i]");
+    for (int i = 0; i < depth; i++) p += sprintf(p, "+1)");
+    sprintf(p, "; return a[3]; }");
+    return buf;
+}
+
+// Build "int main() { int x=7; return *&*&...*&x; }" with `depth` unary
+// operators.
+static char* nested_unary(int depth) {
+    char* buf = malloc(depth + 64);
+    char* p = buf + sprintf(buf, "int main() { int x=7; return ");
+    for (int i = 0; i < depth; i++) *p++ = i % 2 ? '&' : '*';
+    sprintf(p, "x; }");
+    return buf;
+}
+
+// Build a random token soup of `len` bytes or more: runs of whitespace,
+// identifiers and digits of all lengths around the vector widths and
+// operators. If `invalid` is set, one byte at a random position is replaced
+// by one that is not a valid token.
+static char* random_source(unsigned* seed, int len, int invalid) {
+    static const char space[] = " \t\n\v\f\r";
+    static const char ident[] =
+        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_0123456789";
+    static const char* ops[] = {"+", "-", "*", "/", "&", "<", ">", "(", ")",
+                                "{", "}", "[", "]", ";", "=", ",", "==", "!=",
+                                "<=", ">=", "return", "int", "sizeof"};
+    char* buf = malloc(len + 128);
+    char* p = buf;
+    while (p - buf < len) {
+        int n = rand_r(seed) % 70;
+        switch (rand_r(seed) % 5) {
+            case 0:
+                for (int i = 0; i < n; i++)
+                    *p++ = space[rand_r(seed) % (sizeof(space) - 1)];
+                break;
+            case 1:
+                *p++ = ident[rand_r(seed) % 53];
+                for (int i = 0; i < n; i++)
+                    *p++ = ident[rand_r(seed) % (sizeof(ident) - 1)];
+                break;
+            case 2:
+                for (int i = 0; i <= n % 30; i++)
+                    *p++ = '0' + rand_r(seed) % 10;
+                break;
+            case 3:
+                p = stpcpy(p, ops[rand_r(seed) % (sizeof(ops) / sizeof(*ops))]);
+                break;
+            default:
+                *p++ = ' ';
+                break;
+        }
     }
+    *p = '\0';
+    if (invalid)
+        buf[rand_r(seed) % (p - buf)] = "@$#\x80\xc3\xff"[rand_r(seed) % 6];
+    return buf;
+}
 
-    // Generate assembly with ycc compiler
-    char ycc_cmd[1024];
-    snprintf(ycc_cmd, sizeof(ycc_cmd), "./ycc \"%s\" > tmp.s", input);
-    if (execute_command(ycc_cmd) != 0) {
-        fprintf(stderr, "Failed to run ycc compiler for: %s\n", input);
-        exit(1);
+// Run `./ycc <opt> --dump-tokens -` on the file `in` with stdout and stderr
+// written to `out`.
+static int dump_tokens(char* opt, const char* in, const char* out) {
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) {
+        if (redirect(0, in, O_RDONLY)) _exit(127);
+        if (redirect(1, out, O_WRONLY | O_CREAT | O_TRUNC)) _exit(127);
+        dup2(1, 2);
+        char* argv[] = {"./ycc", opt, "--dump-tokens", "-", NULL};
+        execvp(argv[0], argv);
+        _exit(127);
     }
 
-    // Compile the generated assembly with test helper
-    if (execute_command("cc -o tmp tmp.s test_helper.o") != 0) {
-        fprintf(stderr, "Failed to compile assembly for: %s\n", input);
-        exit(1);
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static int same_file(const char* a, const char* b) {
+    FILE* fa = fopen(a, "r");
+    FILE* fb = fopen(b, "r");
+    int same = fa && fb;
+    while (same) {
+        int ca = fgetc(fa), cb = fgetc(fb);
+        if (ca != cb) same = 0;
+        if (ca == EOF) break;
     }
+    if (fa) fclose(fa);
+    if (fb) fclose(fb);
+    return same;
+}
 
-    // Run the compiled program and get exit code
-    int actual = execute_command("./tmp");
+// Check that the vectorized and multi-threaded lexers produce the same
+// tokens and errors as the scalar one on random inputs. Inputs grow large
+// enough to be split into several chunks. Returns the number of mismatching
+// inputs.
+static int check_lexers() {
+    char* lexers[] = {"--lex-threads=3", "--lexer=sse2", "--lexer=avx2"};
+    int nlexers = __builtin_cpu_supports("avx2") ? 3 : 2;
+    char src[64], want[64], got[64];
+    snprintf(src, sizeof(src), "%s/lex.c", helper_dir);
+    snprintf(want, sizeof(want), "%s/lex.scalar", helper_dir);
+    snprintf(got, sizeof(got), "%s/lex.out", helper_dir);
 
-    // Check the result
-    if (actual == expected) {
-        printf("%s => %d\n", input, actual);
-        fflush(stdout);
-        passed_count++;
-    } else {
-        printf("%s => %d expected, but got %d\n", input, expected, actual);
-        fflush(stdout);
+    int failures = 0;
+    unsigned seed = 1;
+    for (int i = 0; i < 200; i++) {
+        char* input = random_source(&seed, 1 + i * 197 % 40000, i % 4 == 0);
+        write_file(src, input);
+        int want_rc = dump_tokens("--lexer=scalar", src, want);
+        for (int j = 0; j < nlexers; j++) {
+            if (dump_tokens(lexers[j], src, got) != want_rc ||
+                !same_file(want, got)) {
+                printf("%s differs from --lexer=scalar on input #%d\n",
+                       lexers[j], i);
+                failures++;
+            }
+        }
+        free(input);
+    }
+    unlink(src);
+    unlink(want);
+    unlink(got);
+    return failures;
+}
+
+// Compile `in` to `out` with ./ycc, the flags of the run and `opt` if
+// given.
+static int compile_with(char* opt, const char* in, const char* out) {
+    char* argv[20];
+    int argc = 0;
+    argv[argc++] = "./ycc";
+    for (int i = 0; i < ycc_nflags; i++) argv[argc++] = ycc_flags[i];
+    if (opt) argv[argc++] = opt;
+    argv[argc++] = "-";
+    argv[argc] = NULL;
+    return run_process(argv, in, out);
+}
+
+// Whether the file at `path` contains `str` on one of its lines
+static int file_contains(const char* path, const char* str) {
+    FILE* fp = fopen(path, "r");
+    if (!fp) return 0;
+    char line[256];
+    int found = 0;
+    while (!found && fgets(line, sizeof(line), fp))
+        found = strstr(line, str) != NULL;
+    fclose(fp);
+    return found;
+}
+
+// Check a -fprofile-generate build counting calls, arms and iterations,
+// and a -fprofile-use build placing what never ran in .text.unlikely.
+// Returns the number of failed checks.
+static int check_profile() {
+    const char* input =
+        "int rare(int x) { return x*3; } int never(int x) { return x+1; } "
+        "int main() { int s; s=0; int i; "
+        "for (i=0; i<1000; i=i+1) { if (i==500) s=s+rare(i); else s=s+1; } "
+        "if (s<0) s=never(s); return s-2400; }";
+    char src[64], prof[64], opt[80], as[64], exe[64];
+    snprintf(src, sizeof(src), "%s/prof.c", helper_dir);
+    snprintf(prof, sizeof(prof), "%s/prof.txt", helper_dir);
+    snprintf(as, sizeof(as), "%s/prof.s", helper_dir);
+    snprintf(exe, sizeof(exe), "%s/prof", helper_dir);
+    char* cc_argv[] = {"cc", "-o", exe, as, NULL};
+    char* run_argv[] = {exe, NULL};
+    write_file(src, input);
+
+    int failures = 0;
+    snprintf(opt, sizeof(opt), "-fprofile-generate=%s", prof);
+    if (compile_with(opt, src, as) || run_process(cc_argv, NULL, NULL) ||
+        run_process(run_argv, NULL, NULL) != 99 ||
+        !file_contains(prof, "rare 0 1") ||
+        !file_contains(prof, "never 0 0") ||
+        !file_contains(prof, " 1000")) {
+        printf("-fprofile-generate failed\n");
+        failures++;
+    }
+    snprintf(opt, sizeof(opt), "-fprofile-use=%s", prof);
+    if (compile_with(opt, src, as) || !file_contains(as, ".text.unlikely") ||
+        run_process(cc_argv, NULL, NULL) ||
+        run_process(run_argv, NULL, NULL) != 99) {
+        printf("-fprofile-use failed\n");
+        failures++;
+    }
+    unlink(src);
+    unlink(prof);
+    unlink(as);
+    unlink(exe);
+    return failures;
+}
+
+// Run argv[0] with standard output discarded and standard error written to
+// `err` and return its exit status.
+static int run_stderr(char** argv, const char* err) {
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) {
+        if (redirect(1, "/dev/null", O_WRONLY) ||
+            redirect(2, err, O_WRONLY | O_CREAT | O_TRUNC))
+            _exit(127);
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Calls of `name` in the -finstrument-functions report at `path`, or -1
+static long reported_calls(const char* path, const char* name) {
+    FILE* fp = fopen(path, "r");
+    if (!fp) return -1;
+    char line[256], func[128];
+    long calls = -1, n;
+    while (calls < 0 && fgets(line, sizeof(line), fp))
+        if (sscanf(line, "%127s %ld", func, &n) == 2 && !strcmp(func, name))
+            calls = n;
+    fclose(fp);
+    return calls;
+}
+
+// Check that a -finstrument-functions build reports the calls of each
+// function called, recursive or not, and leaves out the others. Returns
+// the number of failed checks.
+static int check_instrument() {
+    const char* input =
+        "int fib(int x) { if (x<=1) return 1; return fib(x-1)+fib(x-2); } "
+        "int never() { return 0; } "
+        "int main() { return fib(10)-80; }";
+    char src[64], as[64], exe[64], err[64];
+    snprintf(src, sizeof(src), "%s/instr.c", helper_dir);
+    snprintf(as, sizeof(as), "%s/instr.s", helper_dir);
+    snprintf(exe, sizeof(exe), "%s/instr", helper_dir);
+    snprintf(err, sizeof(err), "%s/instr.txt", helper_dir);
+    char* cc_argv[] = {"cc", "-o", exe, as, NULL};
+    char* run_argv[] = {exe, NULL};
+    write_file(src, input);
+
+    int failures = 0;
+    if (compile_with("-finstrument-functions", src, as) ||
+        run_process(cc_argv, NULL, NULL) || run_stderr(run_argv, err) != 9 ||
+        reported_calls(err, "fib") != 177 ||
+        reported_calls(err, "main") != 1 ||
+        reported_calls(err, "never") != -1) {
+        printf("-finstrument-functions failed\n");
+        failures++;
+    }
+    unlink(src);
+    unlink(as);
+    unlink(exe);
+    unlink(err);
+    return failures;
+}
+
+// Check that ./ycc-client compiles through `ycc --server` to the same
+// assembly as ./ycc, also when workers serve requests with different
+// options one after the other, passes errors and exit statuses through,
+// rejects server options in requests, and that the server removes its
+// socket when stopped. Returns the number of failed checks.
+static int check_server() {
+    char sock[64], src[64], want[64], got[64], err[64];
+    snprintf(sock, sizeof(sock), "%s/ycc.sock", helper_dir);
+    snprintf(src, sizeof(src), "%s/server.c", helper_dir);
+    snprintf(want, sizeof(want), "%s/server.want", helper_dir);
+    snprintf(got, sizeof(got), "%s/server.got", helper_dir);
+    snprintf(err, sizeof(err), "%s/server.err", helper_dir);
+    char opt[80];
+    snprintf(opt, sizeof(opt), "--server=%s", sock);
+    char* server_argv[] = {"./ycc", opt, "--workers=2", NULL};
+    pid_t server = fork();
+    if (server < 0) return 1;
+    if (server == 0) {
+        execvp(server_argv[0], server_argv);
+        _exit(127);
+    }
+    for (int i = 0; i < 200 && access(sock, F_OK); i++) usleep(10000);
+    setenv("YCC_SERVER", sock, 1);
+
+    int failures = 0;
+    char* ycc_argv[] = {"./ycc", NULL, "-", NULL};
+    char* client_argv[] = {"./ycc-client", NULL, "-", NULL};
+    write_file(src,
+               "int f(int x) { return x*x; } int main() { return f(3); }");
+    for (int i = 0; i < 6; i++) {
+        ycc_argv[1] = client_argv[1] = i % 2 ? "-O0" : "-O2";
+        if (run_process(ycc_argv, src, want) ||
+            run_process(client_argv, src, got) || !same_file(want, got)) {
+            printf("ycc-client differs from ycc on request #%d\n", i);
+            failures++;
+        }
+    }
+    char* bad_argv[] = {"./ycc-client", "int main() { return 1 }", NULL};
+    char* usage_argv[] = {"./ycc-client", "-O9", "-", NULL};
+    if (run_stderr(bad_argv, err) != 1 || !file_contains(err, "Expected") ||
+        run_stderr(usage_argv, err) != 1 || !file_contains(err, "Usage")) {
+        printf("ycc-client doesn't pass errors through\n");
+        failures++;
+    }
+    char other[80];
+    snprintf(other, sizeof(other), "--server=%s.other", sock);
+    char* server_opt_argv[] = {"./ycc-client", other, NULL};
+    char* workers_argv[] = {"./ycc-client", "--workers=2", "-", NULL};
+    if (run_stderr(server_opt_argv, err) != 1 ||
+        !file_contains(err, "Usage") || !access(other + 9, F_OK) ||
+        run_stderr(workers_argv, err) != 1 || !file_contains(err, "Usage")) {
+        printf("ycc-client requests accept server options\n");
+        failures++;
+    }
+
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+    if (!access(sock, F_OK)) {
+        printf("ycc --server left its socket behind\n");
+        failures++;
+    }
+    unsetenv("YCC_SERVER");
+    unlink(src);
+    unlink(want);
+    unlink(got);
+    unlink(err);
+    return failures;
+}
+
+// Compile `in` to `out` with ./ycc, the flags of the run and the cache in
+// `cache` if given, writing the cache statistics to `err`.
+static int compile_cached(const char* cache, const char* in, const char* out,
+                          const char* err) {
+    char opt[80];
+    char* argv[20];
+    int argc = 0;
+    argv[argc++] = "./ycc";
+    for (int i = 0; i < ycc_nflags; i++) argv[argc++] = ycc_flags[i];
+    if (cache) {
+        snprintf(opt, sizeof(opt), "--cache=%s", cache);
+        argv[argc++] = opt;
+        argv[argc++] = "--cache-stats";
+    }
+    argv[argc++] = "-";
+    argv[argc] = NULL;
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) {
+        if (redirect(0, in, O_RDONLY) ||
+            redirect(1, out, O_WRONLY | O_CREAT | O_TRUNC) ||
+            redirect(2, err, O_WRONLY | O_CREAT | O_TRUNC))
+            _exit(127);
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Check that compiling through --cache gives the same assembly as without
+// it, that a second compilation finds every function in the cache, and
+// that changing a function misses for it and for its callers. Returns the
+// number of failed checks.
+static int check_cache() {
+    const char* inputs[] = {
+        "int f(int x) { return x*3; } int g(int x) { return x+1; } "
+        "int main() { return f(4); }",
+        "int f(int x) { return x*5; } int g(int x) { return x+1; } "
+        "int main() { return f(4); }",
+    };
+    // Statistics of compiling inputs[0], again, then inputs[1]
+    const char* stats[] = {"0 hits, 3 misses", "3 hits, 0 misses",
+                           "1 hits, 2 misses"};
+    char cache[64], src[64], want[64], got[64], err[64];
+    snprintf(cache, sizeof(cache), "%s/cache", helper_dir);
+    snprintf(src, sizeof(src), "%s/cache.c", helper_dir);
+    snprintf(want, sizeof(want), "%s/cache.want", helper_dir);
+    snprintf(got, sizeof(got), "%s/cache.got", helper_dir);
+    snprintf(err, sizeof(err), "%s/cache.err", helper_dir);
+
+    int failures = 0;
+    for (int i = 0; i < 3; i++) {
+        write_file(src, inputs[i / 2]);
+        if (compile_cached(NULL, src, want, err) ||
+            compile_cached(cache, src, got, err) || !same_file(want, got)) {
+            printf("--cache differs from no cache on compilation #%d\n", i);
+            failures++;
+        } else if (!file_contains(err, stats[i])) {
+            printf("--cache-stats didn't report %s on compilation #%d\n",
+                   stats[i], i);
+            failures++;
+        }
+    }
+    char* rm_argv[] = {"rm", "-rf", cache, NULL};
+    run_process(rm_argv, NULL, NULL);
+    unlink(src);
+    unlink(want);
+    unlink(got);
+    unlink(err);
+    return failures;
+}
+
+// Check that zero globals go to .bss and initialized ones to .data, with
+// large arrays aligned for vector loads, and that vector constants come
+// from .rodata. Returns the number of failed checks.
+static int check_data() {
+    const char* input =
+        "int big[64]; int zero; int init[4] = {1, 2}; "
+        "int main() { int i; for (i=0; i<64; i=i+1) big[i]=big[i]*5+2; "
+        "return big[63]+zero+init[1]; }";
+    char src[64], as[64];
+    snprintf(src, sizeof(src), "%s/data.c", helper_dir);
+    snprintf(as, sizeof(as), "%s/data.s", helper_dir);
+    write_file(src, input);
+
+    int failures = 0;
+    if (compile_with("-O2", src, as) || !file_contains(as, ".bss") ||
+        !file_contains(as, ".align 64") || !file_contains(as, ".long 1, 2") ||
+        !file_contains(as, ".rodata.cst")) {
+        printf(".data, .bss or .rodata placement failed\n");
+        failures++;
+    }
+    unlink(src);
+    unlink(as);
+    return failures;
+}
+
+// Check that -Wunused-function at -O2 reports a function never called but
+// not one inlined into every caller. Returns the number of failed checks.
+static int check_unused() {
+    char* input =
+        "int sq(int x) { return x*x; } int never() { return 0; } "
+        "int main() { return sq(3); }";
+    char err[64];
+    snprintf(err, sizeof(err), "%s/unused.txt", helper_dir);
+    char* argv[] = {"./ycc", "-O2", "-Wunused-function", input, NULL};
+
+    int failures = 0;
+    if (run_stderr(argv, err) || !file_contains(err, "'never'") ||
+        file_contains(err, "'sq'")) {
+        printf("-Wunused-function reported an inlined function\n");
+        failures++;
+    }
+    unlink(err);
+    return failures;
+}
+
+// Set the int `field` of the first type record (or node record if `node`)
+// of kind `kind` in the AST file `path` to -1. The file is a header of 8
+// magic bytes and 9 counts, then records of ints: types of 3, variables
+// of 5 and nodes of 16. Returns 0 on success.
+static int corrupt_ast(const char* path, int node, int kind, int field) {
+    FILE* fp = fopen(path, "r+b");
+    if (!fp) return -1;
+    int buf[1 << 12];
+    int len = fread(buf, sizeof(int), 1 << 12, fp);
+    int start = 11, size = 3, count = buf[2];
+    if (node) {
+        start += 3 * buf[2] + 5 * buf[3];
+        size = 16;
+        count = buf[4];
+    }
+    int found = -1;
+    for (int i = 0; i < count && found < 0; i++)
+        if (start + size * (i + 1) <= len && buf[start + size * i] == kind)
+            found = start + size * i;
+    int minus_one = -1;
+    int ok = found >= 0 && !fseek(fp, (found + field) * sizeof(int), 0) &&
+             fwrite(&minus_one, sizeof(int), 1, fp) == 1;
+    return fclose(fp) || !ok;
+}
+
+// Check that a program compiled from its --emit-ast file with --load-ast
+// gives the same assembly as compiled from source, and that truncated or
+// corrupted files are rejected. Returns the number of failed checks.
+static int check_ast() {
+    const char* input =
+        "int g[4]; int *p; int sq(int x) { return x*x; } "
+        "int main() { int a[3]; int i; p=a; "
+        "for (i=0; i<3; i=i+1) a[i]=sq(i)+g[i]; "
+        "while (i>0) { i=i-1; if (*(p+i)>1) g[0]=g[0]+a[i]; else g[1]=1; } "
+        "return g[0]+g[1]+sizeof(a); }";
+    char src[64], ast[64], want[64], got[64], err[64], opt[80];
+    snprintf(src, sizeof(src), "%s/ast.c", helper_dir);
+    snprintf(ast, sizeof(ast), "%s/ast.bin", helper_dir);
+    snprintf(want, sizeof(want), "%s/ast.want", helper_dir);
+    snprintf(got, sizeof(got), "%s/ast.got", helper_dir);
+    snprintf(err, sizeof(err), "%s/ast.err", helper_dir);
+    write_file(src, input);
+
+    int failures = 0;
+    char* load_argv[20];
+    int argc = 0;
+    load_argv[argc++] = "./ycc";
+    for (int i = 0; i < ycc_nflags; i++) load_argv[argc++] = ycc_flags[i];
+    snprintf(opt, sizeof(opt), "--load-ast=%s", ast);
+    load_argv[argc++] = opt;
+    load_argv[argc] = NULL;
+    char emit[80];
+    snprintf(emit, sizeof(emit), "--emit-ast=%s", ast);
+    if (compile_with(NULL, src, want) || compile_with(emit, src, NULL) ||
+        run_process(load_argv, NULL, got) || !same_file(want, got)) {
+        printf("--load-ast differs from compiling the source\n");
+        failures++;
+    }
+    write_file(ast, "YCCAST1\n");
+    if (run_stderr(load_argv, err) != 1 ||
+        !file_contains(err, "Invalid AST file")) {
+        printf("--load-ast accepted a truncated file\n");
+        failures++;
+    }
+
+    // An array type without a base (kind 2, field 1) and an assignment
+    // without a left-hand side (kind 9, field 1)
+    write_file(src, "int main() { int a[3]; a[1]=5; return a[1]; }");
+    for (int node = 0; node < 2; node++) {
+        if (compile_with(emit, src, NULL) ||
+            corrupt_ast(ast, node, node ? 9 : 2, 1) ||
+            run_stderr(load_argv, err) != 1 ||
+            !file_contains(err, "Invalid AST file")) {
+            printf("--load-ast accepted a corrupted %s\n",
+                   node ? "node" : "type");
+            failures++;
+        }
+    }
+    unlink(src);
+    unlink(ast);
+    unlink(want);
+    unlink(got);
+    unlink(err);
+    return failures;
+}
+
+// Run all test cases on a pool of `jobs` worker processes. Workers take
+// case indices from one pipe and send results back on another.
+static void run_tests(TestResult* results) {
+    int tasks[2], done[2];
+    if (pipe(tasks) || pipe(done)) {
+        perror("pipe");
         exit(1);
     }
+
+    fflush(stdout);
+    for (int i = 0; i < jobs; i++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            exit(1);
+        }
+        if (pid == 0) {
+            close(tasks[1]);
+            close(done[0]);
+            int index;
+            while (read(tasks[0], &index, sizeof(index)) == sizeof(index)) {
+                TestResult res;
+                run_case(index, &res);
+                write(done[1], &res, sizeof(res));
+            }
+            _exit(0);
+        }
+    }
+
+    close(tasks[0]);
+    close(done[1]);
+    for (int i = 0; i < test_count; i++) write(tasks[1], &i, sizeof(i));
+    close(tasks[1]);
+
+    TestResult res;
+    while (read(done[0], &res, sizeof(res)) == sizeof(res))
+        results[res.index] = res;
+    close(done[0]);
+
+    while (wait(NULL) > 0);
+}
+
+static void add_tests();
+
+static void parse_args(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+        } else if (!strncmp(argv[i], "-j", 2) && argv[i][2]) {
+            jobs = atoi(argv[i] + 2);
+        } else if (!strcmp(argv[i], "--in-process")) {
+            in_process = 1;
+        } else if ((!strncmp(argv[i], "-O", 2) || !strncmp(argv[i], "-f", 2) ||
+                    !strncmp(argv[i], "-m", 2)) &&
+                   ycc_nflags < 16) {
+            ycc_flags[ycc_nflags++] = argv[i];
+        } else {
+            fprintf(stderr,
+                    "Usage: %s [-j N] [--in-process] [-O<level>] [-f<flag>] "
+                    "[-m<flag>]\n",
+                    argv[0]);
+            exit(1);
+        }
+    }
+
+    if (jobs <= 0) jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    if (jobs <= 0) jobs = 1;
 }
 
-int main() {
-    printf("Running YCC Compiler Tests...\n\n");
+int main(int argc, char** argv) {
+    parse_args(argc, argv);
+    printf("Running YCC Compiler Tests...");
+    for (int i = 0; i < ycc_nflags; i++) printf(" %s", ycc_flags[i]);
+    printf("\n\n");
+
+    // Compile test helper once for all test cases
+    if (!mkdtemp(helper_dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    snprintf(helper_obj, sizeof(helper_obj), "%s/test_helper.o", helper_dir);
+    char* helper_argv[] = {"cc", "-c", "./test/test_helper.c", "-o",
+                           helper_obj, NULL};
+    if (run_process(helper_argv, NULL, NULL) != 0) {
+        fprintf(stderr, "Failed to compile test_helper.c\n");
+        return 1;
+    }
+
+    add_tests();
 
+    double start = now_millis();
+    TestResult* results = calloc(test_count, sizeof(TestResult));
+    run_tests(results);
+    double elapsed = now_millis() - start;
+    int lexer_failures = check_lexers();
+    int profile_failures = check_profile() + check_instrument();
+    int server_failures = check_server();
+    int cache_failures = check_cache();
+    int ast_failures = check_ast();
+    int data_failures = check_data();
+    int warning_failures = check_unused();
+
+    int passed_count = 0;
+    double slowest = 0;
+    for (int i = 0; i < test_count; i++) {
+        TestCase* tc = &test_cases[i];
+        TestResult* res = &results[i];
+        const char* input = tc->name ? tc->name : tc->input;
+        if (res->millis > slowest) slowest = res->millis;
+
+        if (res->actual == tc->expected) {
+            printf("%s => %d (%.1f ms)\n", input, res->actual, res->millis);
+            passed_count++;
+        } else if (res->actual == STEP_YCC_FAILED) {
+            printf("%s => failed to run ycc compiler\n", input);
+        } else if (res->actual == STEP_CC_FAILED) {
+            printf("%s => failed to compile assembly\n", input);
+        } else {
+            printf("%s => %d expected, but got %d\n", input, tc->expected,
+                   res->actual);
+        }
+    }
+
+    // Clean up temporary files
+    unlink(helper_obj);
+    rmdir(helper_dir);
+
+    // Print summary
+    printf("\n========================================\n");
+    if (passed_count != test_count || lexer_failures || profile_failures ||
+        server_failures || cache_failures || ast_failures ||
+        data_failures || warning_failures) {
+        printf("NG - %d test(s) failed! (%d/%d)\n", test_count - passed_count,
+               passed_count, test_count);
+        if (lexer_failures)
+            printf("%d lexer mismatch(es)\n", lexer_failures);
+        if (profile_failures)
+            printf("%d profile check(s) failed\n", profile_failures);
+        if (server_failures)
+            printf("%d server check(s) failed\n", server_failures);
+        if (cache_failures)
+            printf("%d cache check(s) failed\n", cache_failures);
+        if (ast_failures)
+            printf("%d AST file check(s) failed\n", ast_failures);
+        if (data_failures)
+            printf("%d data section check(s) failed\n", data_failures);
+        if (warning_failures)
+            printf("%d warning check(s) failed\n", warning_failures);
+        printf("========================================\n");
+        return 1;
+    }
+    printf("OK - All tests passed! (%d/%d)\n", passed_count, test_count);
+    printf("%d jobs%s, %.1f ms total, slowest case %.1f ms\n", jobs,
+           in_process ? " (in-process)" : "", elapsed, slowest);
+    printf("========================================\n");
+    return 0;
+}
+
+static void add_tests() {
     // Basic arithmetic tests
     assert(0, "int main() { return 0; }");
     assert(42, "int main() { return 42; }");
@@ -115,6 +954,7 @@ int main() {
     assert(2, "int main() { int i;int j;i=0;for(i=0;i<3;i=i+1)j=i;return j; }");
     assert(5, "int main() { int i;int j;i=0;for(i=0;i<3;i=i+1)j=i;return j+i; }");
     assert(19, "int main() { int i;int j;for(i=0;i<10;i=i+1)j=i;return j+i; }");
+    assert(1, "int main() { int i;int j;for(i=0;i<2000000;i=i+1)j=i;return j-1999998; }");
 
     // Function calls
     assert(5, "int main() { return foo(); }");
@@ -184,14 +1024,112 @@ int main() {
     assert(3, "int x[4]; int main() { x[0]=0; x[1]=1; x[2]=2; x[3]=3; return x[3]; }");
     assert(4, "int x; int main() { return sizeof(x); }");
     assert(16, "int x[4]; int main() { return sizeof(x); }");
+    assert(7, "int x = 7; int main() { return x; }");
+    assert(3, "int x = 0; int main() { x = x + 3; return x; }");
+    assert(8, "int x[2][3] = {1, 2, 3, 4, 5}; int main() { return x[1][1] + x[0][2] + x[1][2]; }");
+    assert(5, "int a[4] = {2*2, -1, sizeof(a)/8,}; int main() { return a[0]+a[1]+a[2]+a[3]; }");
+    assert(72, "int a[16] = {1, 2, 3, 4, 5, 6, 7, 8}; int main() { int i; int s; s=0; for (i=0; i<16; i=i+1) s=s+a[i]*2; return s; }");
 
-    // Print summary
-    printf("\n========================================\n");
-    printf("OK - All tests passed! (%d/%d)\n", passed_count, test_count);
-    printf("========================================\n");
+    // Deeply nested expressions
+    assert(65, "int main() { return ((((1+1)+1)+1)+1)+60; }");
+    assert_named(65, "(((1+1)+1)...+1) nested 200000 levels",
+                 nested_parens(200000));
+    assert_named(7, "*&*&...*&x nested 200000 levels",
+                 nested_unary(200000));
+    assert_named(64, "a[i] = ((a[i]+1)...+1) nested 200000 levels in a loop",
+                 nested_in_loop(200000));
 
-    // Clean up temporary files
-    execute_command("rm -f test_ycc tmp.s tmp test_helper.o");
+    // Locals with disjoint live ranges share stack slots
+    assert(12, "int main() { int a; a=5; int b; b=a+2; int c; c=b+5; return c; }");
+    assert(45, "int main() { int s; s=0; int i; for(i=0;i<10;i=i+1){ int t; t=i; s=s+t; } return s; }");
+    assert(13, "int main() { int x; x=3; int y; y=4; int z; z=0; int i; for(i=0;i<3;i=i+1){ z=z+1; y=y+x; } return y; }");
+    assert(10, "int main() { int i; int j; int n; n=0; for(i=0;i<2;i=i+1){ int a; a=i; for(j=0;j<5;j=j+1) n=n+1; if(a!=i) return 99; } return n; }");
+    assert(7, "int main() { int a; int* p; p=&a; int b; b=5; *p=2; return a+b; }");
+    assert(6, "int f(int x, int y) { int a; a=x*y; int b; b=a; return b; } int main() { int u; u=2; int v; v=3; return f(u, v); }");
+    assert(8, "int main() { int x; int* p; p=&x; x=8; int y[2]; y[0]=1; y[1]=2; return *p; }");
 
-    return 0;
+    // Dead code elimination
+    assert(3, "int main() { return 3; return 5; }");
+    assert(4, "int main() { if (1) return 4; return 5; }");
+    assert(6, "int main() { if (2-2) return 4; else return 6; }");
+    assert(9, "int main() { if (3*3==9) { return 9; } else { return 1; } return 2; }");
+    assert(0, "int main() { int x; x=0; while (0) x=x+1; return x; }");
+    assert(5, "int main() { int i; i=0; while (1) { i=i+1; if (i==5) return i; } return 99; }");
+    assert(7, "int main() { int i; for (i=7; 0; i=i+1) return 1; return i; }");
+    assert(3, "int main() { int i; i=0; for (;;) { i=i+1; if (i<3) i; else return i; } }");
+    assert(2, "int main() { int x; x=2; x+3; x==4; {} return x; }");
+    assert(1, "int g() { return 0; } int main() { int x; x=1; if (0) x=9; x+g(); return x; }");
+    assert(3, "int main() { int x; int *p; p=&x; x=3; *p; return x; }");
+
+    // Leaf functions without a frame pointer, calls aligned at compile time
+    assert(25, "int sq(int a) { int b; b=a*a; return b; } int main() { int x; x=sq(3)+sq(4); return x; }");
+    assert(1, "int main() { return stack_aligned(); }");
+    assert(2, "int main() { return 1+stack_aligned(); }");
+    assert(3, "int main() { return 1+(1+stack_aligned()); }");
+    assert(4, "int f(int x) { return x+stack_aligned(); } int main() { return 2+f(1); }");
+    assert(6, "int f(int x, int* p) { int y; y=*p; return x+y; } int main() { int a; a=4; return f(2, &a); }");
+
+    // Tail calls (at -O2 self calls become loops and others jumps)
+    assert(55, "int fib(int n, int a, int b) { if (n==0) return a; return fib(n-1, b, a+b); } int main() { return fib(10, 0, 1); }");
+    assert(40, "int sum(int n, int acc) { if (n==0) return acc; return sum(n-1, acc+n); } int main() { return sum(50000, 0); }");
+    assert(1, "int even(int n) { if (n==0) return 1; return odd(n-1); } int odd(int n) { if (n==0) return 0; return even(n-1); } int main() { return even(10); }");
+    assert(8, "int f(int x) { return foo()+x; } int g(int x) { return bar(x); } int main() { return g(f(3)); }");
+    assert(5, "int h(int* p, int n) { if (n==0) return *p; return h(p, n-1); } int main() { int x; x=5; return h(&x, 3); }");
+    assert(3, "int k(int n) { int a[2]; a[0]=n; if (n==3) return a[0]; return k(n+1); } int main() { return k(0); }");
+    assert(1, "int g() { return stack_aligned(); } int main() { return g(); }");
+
+    // Inlining of small functions (at -O2)
+    assert(40, "int sq(int x) { return x*x; } int add(int a, int b) { return a+b; } int mx(int a, int b) { if (a<b) return b; return a; } int sum(int n) { int s; s=0; int i; for (i=0; i<n; i=i+1) s=s+i; return s; } int fact(int n) { if (n<=1) return 1; return n*fact(n-1); } int sel(int k) { if (k==1) return 10; if (k==2) return 20; return 30; } int main() { return add(sq(3), mx(4, 7))+sum(5)+fact(4)+sel(2)-sel(9); }");
+    assert(9, "int find(int n) { int i; for (i=0;; i=i+1) if (i*i>=n) return i; } int main() { return find(50)+find(1); }");
+    assert(5, "int dec(int n) { n=n-1; return n; } int main() { return dec(5)+dec(dec(3)); }");
+    assert(248, "int g; int inc() { g=g+1; return g; } int sub(int a, int b) { return a-b; } int main() { g=0; return sub(inc(), inc()*10); }");
+    assert(9, "int set(int* p, int v) { *p=v; return 0; } int main() { int x; x=1; set(&x, 9); return x; }");
+    assert(4, "int f() { return stack_aligned(); } int main() { return 1+(2+f()); }");
+
+    // Loop-invariant code motion (at -O2)
+    assert(22, "int g[10]; int main() { int n; n=3; int s; s=0; int i; int k; k=2; for (i=0; i<n*4; i=i+1) { g[k+1]=g[k+1]+i; s=s+n*2+g[k+1]/2; } return s+g[3]; }");
+    assert(30, "int main() { int n; n=1; int s; s=0; int i; for (i=0; i<5; i=i+1) { s=s+n*2; n=n+1; } return s; }");
+    assert(60, "int main() { int n; int* p; p=&n; n=1; int s; s=0; int i; for (i=0; i<3; i=i+1) { s=s+n*10; *p=*p+1; } return s; }");
+    assert(60, "int g; int bump() { g=g+1; return 0; } int main() { int s; s=0; int i; g=1; for (i=0; i<3; i=i+1) { s=s+g*10; bump(); } return s; }");
+    assert(7, "int main() { int d; d=0; int s; s=7; while (d!=0) s=10/d; return s; }");
+    assert(72, "int main() { int a[4]; a[0]=1; a[1]=2; a[2]=3; a[3]=4; int k; k=2; int s; s=0; int i; int j; for (i=0; i<3; i=i+1) for (j=0; j<4; j=j+1) s=s+a[k]+(k+i); return s; }");
+
+    // Strength reduction of array indexing (at -O2) and increments
+    assert(45, "int a[10]; int main() { int i; for (i=0; i<10; i=i+1) a[i]=i; int s; s=0; for (i=0; i<10; i=i+1) s=s+a[i]; return s; }");
+    assert(13, "int main() { int a[5]; int i; for (i=0; i<5; i=i+1) a[i]=i*2; return i+a[4]; }");
+    assert(31, "int main() { int a[6]; int i; for (i=0; i<6; i=i+1) a[i]=i; int s; s=0; for (i=4; i>=0; i=i-1) s=s*2+a[i+1]-a[i]; return s; }");
+    assert(10, "int sum(int* p, int n) { int s; s=0; int i; i=0; while (i<n) { s=s+p[i]; i=i+1; } return s; } int main() { int a[4]; a[0]=1; a[1]=2; a[2]=3; a[3]=4; return sum(a, 4); }");
+    assert(10, "int f[30]; int main() { int i; int j; int c; c=0; for (i=2; i<30; i=i+1) { if (f[i]==0) { c=c+1; for (j=i+i; j<30; j=j+i) f[j]=1; } } return c; }");
+    assert(32, "int m[3][4]; int main() { int i; int j; for (i=0; i<3; i=i+1) for (j=0; j<4; j=j+1) m[i][j]=i*4+j; int s; s=0; for (j=0; j<4; j=j+1) s=s+m[2][j]-m[0][j]; return s; }");
+    assert(6, "int main() { int a[3]; a[0]=5; a[1]=6; a[2]=7; int* p; p=a; p=p+2; int k; k=1; p=p-k; return *p; }");
+    assert(10, "int f(int* a, int i) { int s; s=0; int j; for (j=0; j<3; j=j+1) { while (i<4) { s=s+a[i]; i=i+1; } } return s; } int main() { int a[4]; a[0]=1; a[1]=2; a[2]=3; a[3]=4; return f(a, 0); }");
+    assert(30, "int f(int* a) { int s; s=0; int i; int j; for (j=0; j<3; j=j+1) for (i=0; i<4; i=i+1) s=s+a[i]; return s; } int main() { int a[4]; a[0]=1; a[1]=2; a[2]=3; a[3]=4; return f(a); }");
+
+    // Unrolling of counted loops (at -O2)
+    assert(55, "int main() { int s; s=0; int i; for (i=1; i<=10; i=i+1) s=s+i; return s; }");
+    assert(17, "int main() { int s; s=0; int i; for (i=0; i<4; i=i+1) if (i==2) s=s+10; return s+i+3; }");
+    assert(9, "int main() { int i; int c; c=0; for (i=0; i!=9; i=i+1) c=c+1; return i; }");
+    assert(114, "int a[40]; int f(int n) { int i; int s; s=0; for (i=0; i<n; i=i+1) a[i]=i; for (i=0; i<n; i=i+1) s=s+a[i]; return s+i; } int main() { return f(0)+f(1)+f(3)+f(5)+f(6)+f(13)-f(13)+f(10)+f(11)+f(2)+f(4)+f(7)-91; }");
+    assert(30, "int main() { int s; s=0; int i; int n; n=30; for (i=2; i<=n; i=i+3) s=s+1; return s+i-12; }");
+    assert(14, "int n; int main() { int i; int s; s=0; n=40; for (i=0; i<n; i=i+1) { s=s+1; n=n-2; } return s; }");
+    assert(7, "int main() { int i; int j; int s; s=0; for (i=0; i<100; i=i+1) { if (i==7) return i; for (j=0; j<i; j=j+1) s=s+j; } return 0; }");
+
+    // Vectorization of int array loops (at -O2)
+    assert(90, "int a[50]; int b[50]; int main() { int i; for (i=0; i<50; i=i+1) b[i]=i-20; int k; k=-3; for (i=0; i<50; i=i+1) a[i]=b[i]*b[i]*k+b[i]-7; int s; s=0; for (i=0; i<50; i=i+1) s=s+a[i]; return s+5000+i; }");
+    assert(51, "int a[23]; int main() { int i; for (i=0; i<23; i=i+1) a[i]=i; int s; int t; s=1; t=0; for (i=3; i<=21; i=i+1) { s=s+a[i]; t=t-a[i]*2; } return s+t+i; }");
+    assert(38, "int f(int* d, int* x, int n) { int i; for (i=0; i<n; i=i+1) d[i]=x[i]+1; return d[n-1]; } int main() { int a[30]; int i; for (i=0; i<30; i=i+1) a[i]=i; return f(a+1, a, 20)+f(a, a, 10)+f(a, a+2, 5); }");
+    assert(8, "int f(int* d, int* x, int n) { int i; for (i=0; i<n; i=i+1) d[i]=x[i]*2; return d[n-1]; } int main() { int a[30]; int i; for (i=0; i<30; i=i+1) a[i]=1; return f(a+3, a, 6)+f(a+20, a, 5); }");
+    assert(66, "int main() { int a[16]; int b[16]; int c[16]; int i; for (i=0; i<16; i=i+1) { a[i]=i; b[i]=16-i; } int n; n=15; for (i=0; i<n; i=i+1) c[i]=a[i]*b[i]-a[i]+b[i]; return c[7]+c[14]-i; }");
+
+    // Common subexpression elimination (at -O2)
+    assert(204, "int main() { int a[10]; int i; i=4; a[i]=3; a[i+1]=5; a[i]=a[i]*a[i]+a[i+1]*a[i+1]; return a[i]+a[i]*a[i+1]; }");
+    assert(87, "int main() { int a[10]; int *p; int i; int x; int y; i=2; p=a+i; a[2]=6; x=a[i]*a[i]+1; *p=7; y=a[i]*a[i]+1; return x+y; }");
+    assert(189, "int g; int bump() { g=g+1; return 0; } int main() { int x; int y; g=3; x=(g*g+1)*(g*g+1); bump(); y=(g*g+1)*(g*g+1); return y-x; }");
+    assert(144, "int main() { int i; int j; int x; int y; int z; i=3; j=5; x=(i*j+1)*(i*j-1); i=j; y=(i*j+1)+(i*j-1); z=y; j=z+(i*j+1); return x+y+z+j; }");
+    assert(178, "int main() { int m[64]; int i; int j; int n; int s; n=8; s=0; for (i=0; i<64; i=i+1) m[i]=i; for (i=1; i<n-1; i=i+1) for (j=1; j<n-1; j=j+1) s=s+m[i*n+j]*2-m[i*n+j-1]-m[(i-1)*n+j]+m[i*n+j]; return s-s/256*256; }");
+
+    // Runs longer than a vector in the tokenizer fast paths
+    assert(3, "int main() { int abcdefghijklmnopqrstuvwxyz0123456789_ABCDEFGHIJKLMNOPQRSTUVWXYZ=3; return abcdefghijklmnopqrstuvwxyz0123456789_ABCDEFGHIJKLMNOPQRSTUVWXYZ; }");
+    assert(7, "int main() {                                                            \n\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t return 0000000000000000000000000000000000000000007; }");
+    assert(255, "int main() { return 99999999999999999999999999999999999999; }");
 }
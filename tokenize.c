@@ -3,6 +3,12 @@
 char* user_input;  // Input string
 Token* token;      // Current token
 
+// Tokens are stored in one contiguous array, so the parser moves and looks
+// ahead by pointer arithmetic without following links.
+Token* tokens;   // Token array
+int tokens_len;  // Number of tokens
+int tokens_cap;  // Capacity of the token array
+
 void error(char* fmt, ...) {
     va_list ap;
     va_start(ap, fmt);
@@ -43,54 +49,73 @@ char* strndup(char* p, int len) {
     return buf;
 }
 
+bool equal(Token* tok, char* s) {
+    return tok->kind == TOKEN_RESERVED && strlen(s) == tok->len &&
+           !memcmp(tok->str, s, tok->len);
+}
+
 Token* peek(char* s) {
-    if (token->kind != TOKEN_RESERVED || strlen(s) != token->len ||
-        memcmp(token->str, s, token->len))
-        return NULL;
+    if (!equal(token, s)) return NULL;
     return token;
 }
 
 bool consume(char* s) {
     if (!peek(s)) return false;
-    token = token->next;
+    token++;
     return true;
 }
 
 Token* consume_ident() {
     if (token->kind != TOKEN_IDENT) return NULL;
-    Token* tok = token;
-    token = token->next;
-    return tok;
+    return token++;
 }
 
 void expect(char* s) {
     if (!peek(s)) error_tok(token, "Expected '%s'", s);
-    token = token->next;
+    token++;
 }
 
 char* expect_ident() {
     if (token->kind != TOKEN_IDENT)
         error_at(token->str, "Expected an identifier");
     char* s = strndup(token->str, token->len);
-    token = token->next;
+    token++;
     return s;
 }
 
 int expect_number() {
     if (token->kind != TOKEN_NUM) error_at(token->str, "Expected a number");
     int val = token->val;
-    token = token->next;
+    token++;
     return val;
 }
 
 bool at_eof() { return token->kind == TOKEN_EOF; }
 
-Token* new_token(TokenKind kind, Token* cur, char* str, int len) {
-    Token* tok = calloc(1, sizeof(Token));
+// Append a token to `chunk`. The returned pointer is valid until the next
+// call.
+Token* push_token(TokenChunk* chunk, TokenKind kind, char* str, int len) {
+    if (chunk->len == chunk->cap) {
+        chunk->cap = chunk->cap ? chunk->cap * 2 : 1024;
+        chunk->data = realloc(chunk->data, sizeof(Token) * chunk->cap);
+    }
+    Token* tok = &chunk->data[chunk->len++];
     tok->kind = kind;
+    tok->val = 0;
     tok->str = str;
     tok->len = len;
-    cur->next = tok;
+    return tok;
+}
+
+// Append a token to the token array. The returned pointer is valid until
+// the next call.
+Token* new_token(TokenKind kind, char* str, int len) {
+    TokenChunk chunk = {tokens, tokens_len, tokens_cap};
+    Token* tok = push_token(&chunk, kind, str, len);
+    tokens = chunk.data;
+    tokens_len = chunk.len;
+    tokens_cap = chunk.cap;
+    stats.tokens++;
     return tok;
 }
 
@@ -102,13 +127,16 @@ bool is_alnum(char c) { return is_alpha(c) || ('0' <= c && c <= '9'); }
 
 bool starts_with(char* p, char* q) { return strncmp(p, q, strlen(q)) == 0; }
 
-char* starts_with_reserved(char* p) {
+bool is_keyword(char* p, int len) {
     static char* kw[] = {"return", "if",  "else",  "while",
                          "for",    "int", "sizeof"};
     for (int i = 0; i < sizeof(kw) / sizeof(*kw); i++) {
-        if (starts_with(p, kw[i]) && !is_alnum(p[strlen(kw[i])])) return kw[i];
+        if (strlen(kw[i]) == len && !memcmp(p, kw[i], len)) return true;
     }
+    return false;
+}
 
+char* starts_with_reserved(char* p) {
     static char* ops[] = {"==", "!=", "<=", ">="};
     for (int i = 0; i < sizeof(ops) / sizeof(*ops); i++) {
         if (starts_with(p, ops[i])) return ops[i];
@@ -117,55 +145,86 @@ char* starts_with_reserved(char* p) {
     return NULL;
 }
 
-Token* tokenize() {
-    Token head;
-    head.next = NULL;
-    Token* cur = &head;
-    char* p = user_input;
+// Value of the digits in [p, end) as strtol() would compute it, i.e.
+// saturated to LONG_MAX on overflow.
+long read_number(char* p, char* end) {
+    unsigned long val = 0;
+    for (; p < end; p++) {
+        int d = *p - '0';
+        if (val > (LONG_MAX - d) / 10) return LONG_MAX;
+        val = val * 10 + d;
+    }
+    return val;
+}
 
-    while (*p) {
+// Tokenize [p, end) into `chunk`. Lexing stops at the first invalid token,
+// whose position is stored in chunk->error. This touches no global state
+// except the scanners, so chunks can be lexed on several threads.
+void lex_chunk(TokenChunk* chunk, char* p, char* end) {
+    Token* cur;
+    while (p < end) {
         // Skip whitespace characters
         if (isspace(*p)) {
-            p++;
+            p = scan_space(p + 1, end);
             continue;
         }
 
-        // Multi-character operators or keywords
+        // Identifier or keyword
+        if (is_alpha(*p)) {
+            char* start = p;
+            p = scan_ident(p + 1, end);
+            int len = p - start;
+            push_token(chunk,
+                       is_keyword(start, len) ? TOKEN_RESERVED : TOKEN_IDENT,
+                       start, len);
+            continue;
+        }
+
+        // Multi-character operators
         char* kw = starts_with_reserved(p);
         if (kw) {
             int len = strlen(kw);
-            cur = new_token(TOKEN_RESERVED, cur, p, len);
+            push_token(chunk, TOKEN_RESERVED, p, len);
             p += len;
             continue;
         }
 
         // Single-character operators
         if (strchr("+-*/&<>(){}[];=,", *p)) {
-            cur = new_token(TOKEN_RESERVED, cur, p++, 1);
+            push_token(chunk, TOKEN_RESERVED, p++, 1);
             continue;
         }
 
         // Number
         if (isdigit(*p)) {
-            cur = new_token(TOKEN_NUM, cur, p, 0);
             char* start = p;
-            cur->val = strtol(p, &p, 10);
-            cur->len = p - start;
+            p = scan_digits(p + 1, end);
+            cur = push_token(chunk, TOKEN_NUM, start, p - start);
+            cur->val = read_number(start, p);
             continue;
         }
 
-        // Identifier
-        if (is_alpha(*p)) {
-            cur = new_token(TOKEN_IDENT, cur, p, 0);
-            char* start = p;
-            while (is_alnum(*p)) p++;
-            cur->len = p - start;
-            continue;
-        }
-
-        error_at(p, "Invalid token");
+        chunk->error = p;
+        return;
     }
+}
 
-    new_token(TOKEN_EOF, cur, p, 0);
-    return head.next;
+Token* tokenize() {
+    char* end = user_input + strlen(user_input);
+    init_scan(opt_lexer);
+
+    TokenChunk chunk = {0};
+    if (opt_lex_threads > 1)
+        lex_parallel(&chunk, user_input, end, opt_lex_threads);
+    else
+        lex_chunk(&chunk, user_input, end);
+    if (chunk.error) error_at(chunk.error, "Invalid token");
+
+    tokens = chunk.data;
+    tokens_len = chunk.len;
+    tokens_cap = chunk.cap;
+    stats.tokens += chunk.len;
+    stats.bytes += sizeof(Token) * chunk.cap;
+    new_token(TOKEN_EOF, end, 0);
+    return tokens;
 }
@@ -1,21 +1,22 @@
 #include "ycc.h"
 
-Type* int_type() {
-    Type* ty = calloc(1, sizeof(Type));
-    ty->kind = TYPE_INT;
+Type* new_type(TypeKind kind) {
+    Type* ty = counted_calloc(1, sizeof(Type));
+    stats.types++;
+    ty->kind = kind;
     return ty;
 }
 
+Type* int_type() { return new_type(TYPE_INT); }
+
 Type* pointer_to(Type* base) {
-    Type* ty = calloc(1, sizeof(Type));
-    ty->kind = TYPE_PTR;
+    Type* ty = new_type(TYPE_PTR);
     ty->base = base;
     return ty;
 }
 
 Type* array_of(Type* base, int size) {
-    Type* ty = calloc(1, sizeof(Type));
-    ty->kind = TYPE_ARRAY;
+    Type* ty = new_type(TYPE_ARRAY);
     ty->base = base;
     ty->array_size = size;
     return ty;
@@ -32,21 +33,9 @@ int size_of(Type* ty) {
     return -1;
 }
 
-void visit(Node* node) {
-    if (!node) return;
-
-    visit(node->lhs);
-    visit(node->rhs);
-    visit(node->cond);
-    visit(node->then);
-    visit(node->els);
-    visit(node->init);
-    visit(node->inc);
-
-    for (Node* n = node->body; n; n = n->next) visit(n);
-
-    for (Node* n = node->args; n; n = n->next) visit(n);
-
+// Type of `node` computed from the types of its children, or NULL if the
+// node is a statement.
+Type* type_of(Node* node) {
     switch (node->kind) {
         case NODE_MUL:
         case NODE_DIV:
@@ -55,51 +44,95 @@ void visit(Node* node) {
         case NODE_LT:
         case NODE_LE:
         case NODE_FUNCALL:
+        case NODE_INLINE:
         case NODE_NUM:
-            node->ty = int_type();
-            return;
+            return int_type();
         case NODE_VAR:
-            node->ty = node->var->ty;
-            return;
+            return node->var->ty;
         case NODE_ADD:
-            if (node->rhs->ty->base) {
-                Node* tmp = node->lhs;
-                node->lhs = node->rhs;
-                node->rhs = tmp;
-            }
-            if (node->rhs->ty->base) error("Invalid pointer arithmetic");
-            node->ty = node->lhs->ty;
-            return;
         case NODE_SUB:
             if (node->rhs->ty->base) error("Invalid pointer arithmetic");
-            node->ty = node->lhs->ty;
-            return;
+            return node->lhs->ty;
         case NODE_ASSIGN:
-            node->ty = node->lhs->ty;
-            return;
+            return node->lhs->ty;
         case NODE_ADDR:
             if (node->lhs->ty->kind == TYPE_ARRAY)
-                node->ty = pointer_to(node->lhs->ty->base);
-            else
-                node->ty = pointer_to(node->lhs->ty);
-            return;
+                return pointer_to(node->lhs->ty->base);
+            return pointer_to(node->lhs->ty);
         case NODE_DEREF:
             if (!node->lhs->ty->base) error("Invalid pointer dereference");
-            node->ty = node->lhs->ty->base;
-            return;
-        case NODE_SIZEOF:
-            node->kind = NODE_NUM;
-            node->ty = int_type();
-            node->val = size_of(node->lhs->ty);
-            node->lhs = NULL;
-            return;
+            return node->lhs->ty->base;
+        default:
+            return NULL;
+    }
+}
+
+// Assign a type to `node`, whose children have already been typed. This is
+// called by the node constructors of the parser, so every expression is
+// typed as soon as it is built. `ptr + int` is normalized so that the
+// pointer is on the left and sizeof is folded into a number.
+void type_node(Node* node) {
+    if (node->kind == NODE_ADD && node->rhs->ty->base) {
+        Node* tmp = node->lhs;
+        node->lhs = node->rhs;
+        node->rhs = tmp;
     }
+    if (node->kind == NODE_SIZEOF) {
+        node->kind = NODE_NUM;
+        node->val = size_of(node->lhs->ty);
+        node->lhs = NULL;
+    }
+    node->ty = type_of(node);
+}
+
+bool same_type(Type* a, Type* b) {
+    for (; a && b; a = a->base, b = b->base)
+        if (a->kind != b->kind || a->array_size != b->array_size)
+            return false;
+    return a == b;
+}
+
+// Work list of verify_types()
+Node** verify_stack;
+int verify_len;
+int verify_cap;
+
+void push_verify(Node* node) {
+    if (!node) return;
+    if (verify_len == verify_cap) {
+        verify_cap = verify_cap ? verify_cap * 2 : 64;
+        verify_stack =
+            counted_realloc(verify_stack, sizeof(Node*) * verify_cap);
+    }
+    verify_stack[verify_len++] = node;
 }
 
-void add_type(Program* prog) {
+// Check that every node has the type that type_node() gives it and that
+// no normalization was missed. This is a debugging aid for --verify-types;
+// the parser types nodes as it builds them.
+void verify_types(Program* prog) {
     for (Function* fn = prog->funcs; fn; fn = fn->next) {
-        for (Node* node = fn->node; node; node = node->next) {
-            visit(node);
+        for (Node* node = fn->node; node; node = node->next) push_verify(node);
+
+        while (verify_len > 0) {
+            Node* n = verify_stack[--verify_len];
+            if (n->kind == NODE_SIZEOF)
+                error("%s: sizeof was not folded", fn->name);
+            if (n->kind == NODE_ADD && n->rhs->ty->base)
+                error("%s: pointer operand of + is on the right", fn->name);
+            if (!same_type(n->ty, type_of(n)))
+                error("%s: node of kind %d has a wrong type", fn->name,
+                      n->kind);
+
+            push_verify(n->lhs);
+            push_verify(n->rhs);
+            push_verify(n->cond);
+            push_verify(n->then);
+            push_verify(n->els);
+            push_verify(n->init);
+            push_verify(n->inc);
+            for (Node* b = n->body; b; b = b->next) push_verify(b);
+            for (Node* a = n->args; a; a = a->next) push_verify(a);
         }
     }
 }
@@ -0,0 +1,205 @@
+#include "ycc.h"
+
+// Loop unrolling. An innermost `for` loop whose int counter is stepped by
+// a constant and compared against a number or an invariant variable runs
+// several copies of its body per test of the condition. In the copies, the
+// counter is replaced by `counter + k`, for k the steps it has made since
+// the first copy:
+//
+//   for (init; i < n; i = i + 1) body(i);
+//
+// becomes
+//
+//   for (init; i + 3 < n; i = i + 4) { body(i); ... body(i + 3); }
+//   for (; i < n; i = i + 1) body(i);
+//
+// where the second loop runs the iterations left over. A loop from one
+// constant to another that iterates only a few times is replaced by its
+// body once per iteration, with the counter replaced by its value in that
+// iteration, followed by the final assignment of the counter.
+
+// Most iterations of a fully unrolled loop
+#define MAX_FULL_TRIPS 16
+
+// Most AST nodes in the copies of the body of an unrolled loop
+#define MAX_UNROLLED_SIZE 256
+
+// Unroll factor set by -funroll-factor, or for the -O level: 4 at -O2 and
+// none below
+int unroll_factor() {
+    if (opt_unroll_factor >= 0) return opt_unroll_factor;
+    return opt_level >= 2 ? 4 : 1;
+}
+
+void find_inner_loop(Node* node, void* found) {
+    if (node->kind == NODE_WHILE || node->kind == NODE_FOR)
+        *(bool*)found = true;
+}
+
+void count_size(Node* node, void* size) { (*(int*)size)++; }
+
+// Replacement for the counter in the copy being made
+Var* copy_var;      // Counter
+bool copy_is_num;   // Whether the counter is replaced by a number
+int copy_offset;    // The number, or the constant added to the counter
+
+// Copy of the tree `node` with the counter replaced. The body has at most
+// MAX_UNROLLED_SIZE nodes, so the recursion is shallow.
+Node* copy_tree(Node* node) {
+    if (!node) return NULL;
+    if (node->kind == NODE_VAR && node->var == copy_var) {
+        if (copy_is_num) return new_num(copy_offset);
+        if (!copy_offset) return new_var(copy_var);
+        return new_binary(NODE_ADD, new_var(copy_var), new_num(copy_offset));
+    }
+    Node* n = new_node(node->kind);
+    *n = *node;
+    n->next = NULL;
+    n->lhs = copy_tree(node->lhs);
+    n->rhs = copy_tree(node->rhs);
+    n->cond = copy_tree(node->cond);
+    n->then = copy_tree(node->then);
+    n->els = copy_tree(node->els);
+    n->init = copy_tree(node->init);
+    n->inc = copy_tree(node->inc);
+    Node head;
+    head.next = NULL;
+    Node* cur = &head;
+    for (Node* b = node->body; b; b = b->next) cur = cur->next = copy_tree(b);
+    n->body = head.next;
+    head.next = NULL;
+    cur = &head;
+    for (Node* a = node->args; a; a = a->next) cur = cur->next = copy_tree(a);
+    n->args = head.next;
+    return n;
+}
+
+// Copy of `body` with `var` replaced by the number `val`, or by
+// `var + val` if `is_num` is false
+Node* copy_body(Node* body, Var* var, bool is_num, int val) {
+    copy_var = var;
+    copy_is_num = is_num;
+    copy_offset = val;
+    return copy_tree(body);
+}
+
+// Whether `x cmp limit` holds for the condition of a counted loop
+bool compare(NodeKind cmp, long x, long limit) {
+    if (cmp == NODE_LT) return x < limit;
+    if (cmp == NODE_LE) return x <= limit;
+    return x != limit;
+}
+
+// Number of iterations of the loop `cl` from the constant `start` to the
+// constant `limit`, or -1 if there are more than MAX_FULL_TRIPS. The
+// counter wraps around like the 32-bit variable it is.
+int trip_count(CountedLoop* cl, int start, int limit) {
+    int x = start;
+    for (int n = 0; n <= MAX_FULL_TRIPS; n++) {
+        if (!compare(cl->cmp, x, limit)) return n;
+        x = (int)((unsigned)x + (unsigned)cl->step);
+    }
+    return -1;
+}
+
+// Replace `loop` by its init clause, `trips` copies of its body and the
+// final assignment of the counter.
+void unroll_fully(Node* loop, CountedLoop* cl, int start, int trips) {
+    Node head;
+    head.next = NULL;
+    Node* cur = &head;
+    if (loop->init) cur = cur->next = loop->init;
+    int x = start;
+    for (int k = 0; k < trips; k++) {
+        cur = cur->next = copy_body(loop->then, cl->var, true, x);
+        x = (int)((unsigned)x + (unsigned)cl->step);
+    }
+    cur->next = new_assign_stmt(cl->var, new_num(x));
+
+    Node* next = loop->next;
+    memset(loop, 0, sizeof(Node));
+    loop->kind = NODE_BLOCK;
+    loop->body = head.next;
+    loop->next = next;
+}
+
+// Unroll `loop` by `factor`, followed by a loop for the iterations left.
+void unroll_partially(Node* loop, CountedLoop* cl, int factor) {
+    Var* var = cl->var;
+    Node* rest = new_node(NODE_FOR);
+    rest->cond = loop->cond;
+    rest->inc = loop->inc;
+    rest->then = copy_body(loop->then, var, false, 0);
+
+    // i + (factor - 1) * step < limit: the next `factor` iterations run.
+    Node* main = new_node(NODE_FOR);
+    main->init = loop->init;
+    Node* last = new_binary(NODE_ADD, new_var(var),
+                            new_num((factor - 1) * cl->step));
+    Node* limit = cl->limit->kind == NODE_NUM ? new_num(cl->limit->val)
+                                              : new_var(cl->limit->var);
+    main->cond = new_binary(cl->cmp, last, limit);
+    main->inc = new_assign_stmt(
+        var, new_binary(NODE_ADD, new_var(var), new_num(factor * cl->step)));
+    main->then = new_node(NODE_BLOCK);
+    Node* cur = main->then->body = loop->then;
+    for (int k = 1; k < factor; k++)
+        cur = cur->next = copy_body(loop->then, var, false, k * cl->step);
+    main->next = rest;
+
+    Node* next = loop->next;
+    memset(loop, 0, sizeof(Node));
+    loop->kind = NODE_BLOCK;
+    loop->body = main;
+    loop->next = next;
+}
+
+void unroll_loop(Node* loop, int factor) {
+    if (loop->kind != NODE_FOR) return;
+    CountedLoop cl;
+    if (!match_counted_loop(loop, &cl) || !cl.step || !cl.cmp) return;
+
+    bool inner = false;
+    visit_nodes(loop->then, find_inner_loop, &inner);
+    if (inner) return;
+
+    // With a profile, loops never entered or running fewer iterations than
+    // the factor aren't unrolled.
+    int trips = profile_trips(loop);
+    if (trips == 0) return;
+    int size = 0;
+    visit_nodes(loop->then, count_size, &size);
+
+    long start;
+    long limit;
+    if (cl.start && eval_const(cl.start, &start) &&
+        eval_const(cl.limit, &limit)) {
+        int trips = trip_count(&cl, start, limit);
+        if (trips >= 0 && (long)trips * size <= MAX_UNROLLED_SIZE) {
+            unroll_fully(loop, &cl, start, trips);
+            return;
+        }
+    }
+
+    // The counter must not pass the limit between two tests, so it has to
+    // go up towards a limit that doesn't change.
+    if (cl.cmp == NODE_NE || cl.step < 0) return;
+    if (cl.limit->kind != NODE_NUM &&
+        (cl.limit->kind != NODE_VAR || cl.limit->var == cl.var ||
+         !is_invariant_var(cl.limit->var)))
+        return;
+    if (trips > 0 && trips < factor) return;
+    while (factor > 1 && (long)factor * size > MAX_UNROLLED_SIZE) factor--;
+    if (factor < 2 || (long)factor * cl.step > 0x7fffffff) return;
+    unroll_partially(loop, &cl, factor);
+}
+
+void unroll_loops(Program* prog) {
+    int factor = unroll_factor();
+    if (factor < 2) return;
+    for (Function* fn = prog->funcs; fn; fn = fn->next) {
+        collect_loops(fn);
+        for (int i = loop_list_len - 1; i >= 0; i--)
+            unroll_loop(loop_list[i], factor);
+    }
+}
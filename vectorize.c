@@ -0,0 +1,266 @@
+#include "ycc.h"
+
+// Vectorization of counted loops over int arrays. An innermost `for` loop
+// whose counter goes up by 1 and whose body only stores int expressions
+// into arrays indexed by the counter, or adds them to int locals, is
+// preceded by a NODE_VECTOR_LOOP that runs 4 iterations at a time with
+// SSE2, or 8 with AVX2 under -mavx2:
+//
+//   for (init; i < n; i = i + 1) { a[i] = b[i] * k; s = s + a[i]; }
+//
+// becomes
+//
+//   init; <vector loop>; while (i < n) { { a[i] = b[i] * k; ... } i = i + 1; }
+//
+// The expressions may add, subtract and multiply array elements indexed
+// by the counter, invariant int variables and numbers. The vector loop
+// leaves the counter at the first iteration it didn't run, so the scalar
+// loop after it runs the rest. If arrays may overlap so that an iteration
+// reads an element stored by one of the iterations run together with it,
+// the vector loop runs no iteration at all.
+
+int vector_width() { return opt_avx2 ? 8 : 4; }
+
+// Whether `node` is `base[var]` for an array or pointer `base` of ints
+bool is_element(Node* node, Var* var) {
+    return node->kind == NODE_DEREF && node->ty->kind == TYPE_INT &&
+           node->lhs->kind == NODE_ADD && node->lhs->rhs->kind == NODE_VAR &&
+           node->lhs->rhs->var == var;
+}
+
+// If `stmt` is `s = s + e`, `s = e + s` or `s = s - e` for an int local
+// `s`, return `e` and store `s` in `sum` and whether `e` is subtracted in
+// `sub`.
+Node* sum_operand(Node* stmt, Var** sum, bool* sub) {
+    Node* assign = stmt->lhs;
+    if (assign->kind != NODE_ASSIGN || assign->lhs->kind != NODE_VAR)
+        return NULL;
+    Var* var = assign->lhs->var;
+    Node* rhs = assign->rhs;
+    if (!var->is_local || var->ty->kind != TYPE_INT ||
+        (rhs->kind != NODE_ADD && rhs->kind != NODE_SUB))
+        return NULL;
+    *sum = var;
+    *sub = rhs->kind == NODE_SUB;
+    if (rhs->lhs->kind == NODE_VAR && rhs->lhs->var == var) return rhs->rhs;
+    if (rhs->kind == NODE_ADD && rhs->rhs->kind == NODE_VAR &&
+        rhs->rhs->var == var)
+        return rhs->lhs;
+    return NULL;
+}
+
+// Whether `a` and `b` are the same expression without calls
+bool same_tree(Node* a, Node* b) {
+    if (!a || !b) return a == b;
+    if (a->kind != b->kind) return false;
+    if (a->kind == NODE_NUM) return a->val == b->val;
+    if (a->kind == NODE_VAR) return a->var == b->var;
+    return same_tree(a->lhs, b->lhs) && same_tree(a->rhs, b->rhs);
+}
+
+// Whether `node` computes an address without loads, calls or the counter.
+// The body it's in has at most MAX_VECTOR_SIZE nodes, so the recursion is
+// shallow.
+bool is_simple_base(Node* node, Var* var) {
+    switch (node->kind) {
+        case NODE_NUM:
+            return true;
+        case NODE_VAR:
+            return node->var != var;
+        case NODE_ADD:
+        case NODE_SUB:
+        case NODE_MUL:
+            return is_simple_base(node->lhs, var) &&
+                   is_simple_base(node->rhs, var);
+        case NODE_DEREF:
+            return node->ty->kind == TYPE_ARRAY &&
+                   is_simple_base(node->lhs, var);
+        default:
+            return false;
+    }
+}
+
+// Index of the array operand `base` in `vl`, or -1
+int vector_base(VectorLoop* vl, Node* base) {
+    for (int i = 0; i < vl->nbases; i++)
+        if (same_tree(vl->bases[i], base)) return i;
+    return -1;
+}
+
+// Index of the invariant operand `node` in `vl`, or -1
+int vector_scalar(VectorLoop* vl, Node* node) {
+    for (int i = 0; i < vl->nscalars; i++)
+        if (same_tree(vl->scalars[i], node)) return i;
+    return -1;
+}
+
+// Whether `node` is an invariant operand rather than an element or an
+// operation
+bool is_scalar_operand(Node* node) {
+    return node->kind == NODE_NUM || node->kind == NODE_VAR;
+}
+
+// Vector registers needed to compute `node` into the first one of them.
+// Without AVX2, multiplications need two scratch registers.
+int vector_regs(Node* node) {
+    if (node->kind != NODE_ADD && node->kind != NODE_SUB &&
+        node->kind != NODE_MUL)
+        return 1;
+    int lhs = vector_regs(node->lhs);
+    int rhs = 1 + vector_regs(node->rhs);
+    bool mul = node->kind == NODE_MUL && !opt_avx2;
+    if (is_scalar_operand(node->rhs) && !mul) rhs = 1;
+    int regs = lhs > rhs ? lhs : rhs;
+    return mul && regs < 3 ? 3 : regs;
+}
+
+// Add the operands of the element-wise expression `node` to `vl`.
+bool match_vector_expr(VectorLoop* vl, Node* node) {
+    if (node->ty->kind != TYPE_INT) return false;
+    if (is_element(node, vl->var)) {
+        Node* base = node->lhs->lhs;
+        if (!is_simple_base(base, vl->var)) return false;
+        if (vector_base(vl, base) >= 0) return true;
+        if (vl->nbases == MAX_VECTOR_BASES) return false;
+        vl->bases[vl->nbases] = base;
+        vl->stored[vl->nbases] = false;
+        vl->nbases++;
+        return true;
+    }
+    if (is_scalar_operand(node)) {
+        if (node->kind == NODE_VAR && node->var == vl->var) return false;
+        if (vector_scalar(vl, node) >= 0) return true;
+        if (vl->nscalars + vl->nsums == MAX_VECTOR_FIXED) return false;
+        vl->scalars[vl->nscalars++] = node;
+        return true;
+    }
+    if (node->kind != NODE_ADD && node->kind != NODE_SUB &&
+        node->kind != NODE_MUL)
+        return false;
+    return match_vector_expr(vl, node->lhs) &&
+           match_vector_expr(vl, node->rhs);
+}
+
+// Recognize the loop with condition `cond` and body `body` as one that can
+// run several iterations at a time, given that its counter goes up by 1
+// and the operands it finds are invariant, and describe it in `vl`. The
+// matching below, the copy of the body and the code generated for it
+// recurse over the expressions, so bodies of more than MAX_VECTOR_SIZE
+// nodes are rejected first.
+bool analyze_vector_loop(Node* cond, Node* body, VectorLoop* vl) {
+    memset(vl, 0, sizeof(VectorLoop));
+    if (!cond || (cond->kind != NODE_LT && cond->kind != NODE_LE) ||
+        cond->lhs->kind != NODE_VAR || cond->lhs->var->ty->kind != TYPE_INT)
+        return false;
+    vl->var = cond->lhs->var;
+    vl->limit = cond->rhs;
+    vl->inclusive = cond->kind == NODE_LE;
+    if (!is_scalar_operand(vl->limit) || vl->limit->ty->kind != TYPE_INT ||
+        (vl->limit->kind == NODE_VAR && vl->limit->var == vl->var))
+        return false;
+
+    int size = 0;
+    visit_nodes(body, count_size, &size);
+    if (size > MAX_VECTOR_SIZE) return false;
+
+    vl->stmts = body->kind == NODE_BLOCK ? body->body : body;
+    if (!vl->stmts) return false;
+    for (Node* stmt = vl->stmts; stmt; stmt = stmt->next) {
+        if (stmt->kind != NODE_EXPR_STMT) return false;
+        Var* sum;
+        bool sub;
+        Node* expr = sum_operand(stmt, &sum, &sub);
+        if (expr) {
+            if (sum == vl->var ||
+                vl->nscalars + vl->nsums == MAX_VECTOR_FIXED)
+                return false;
+            vl->nsums++;
+        } else {
+            Node* assign = stmt->lhs;
+            if (assign->kind != NODE_ASSIGN ||
+                !is_element(assign->lhs, vl->var) ||
+                !match_vector_expr(vl, assign->lhs))
+                return false;
+            vl->stored[vector_base(vl, assign->lhs->lhs->lhs)] = true;
+            expr = assign->rhs;
+        }
+        if (!match_vector_expr(vl, expr) ||
+            vector_regs(expr) > MAX_VECTOR_TEMPS)
+            return false;
+    }
+    return true;
+}
+
+// Whether the address expression `node` only reads variables that don't
+// change in the scanned loop
+bool is_invariant_base(Node* node) {
+    if (node->kind == NODE_VAR) return is_invariant_var(node->var);
+    if (node->lhs && !is_invariant_base(node->lhs)) return false;
+    return !node->rhs || is_invariant_base(node->rhs);
+}
+
+void vectorize_loop(Node* loop) {
+    if (loop->kind != NODE_FOR) return;
+    CountedLoop cl;
+    VectorLoop vl;
+    if (!match_counted_loop(loop, &cl) || cl.step != 1 ||
+        !analyze_vector_loop(loop->cond, loop->then, &vl))
+        return;
+
+    // The operands must not change, and each sum must only be updated by
+    // its own statement.
+    if (vl.limit->kind == NODE_VAR && !is_invariant_var(vl.limit->var))
+        return;
+    for (int i = 0; i < vl.nbases; i++)
+        if (!is_invariant_base(vl.bases[i])) return;
+    for (int i = 0; i < vl.nscalars; i++)
+        if (vl.scalars[i]->kind == NODE_VAR &&
+            !is_invariant_var(vl.scalars[i]->var))
+            return;
+    for (Node* stmt = vl.stmts; stmt; stmt = stmt->next) {
+        Var* sum;
+        bool sub;
+        if (sum_operand(stmt, &sum, &sub) &&
+            (sum->addr_taken || count_writes(sum) != 1 ||
+             refs_in(loop->then, sum) != 2))
+            return;
+    }
+
+    // Too few iterations to fill a vector
+    long start;
+    long limit;
+    if (cl.start && eval_const(cl.start, &start) &&
+        eval_const(vl.limit, &limit) &&
+        limit - start + vl.inclusive < vector_width())
+        return;
+
+    Node* vec = new_node(NODE_VECTOR_LOOP);
+    vec->cond = copy_body(loop->cond, cl.var, false, 0);
+    vec->then = copy_body(loop->then, cl.var, false, 0);
+
+    Node* rest = new_node(NODE_WHILE);
+    rest->cond = loop->cond;
+    rest->then = new_node(NODE_BLOCK);
+    rest->then->body = loop->then;
+    loop->then->next = loop->inc;
+    vec->next = rest;
+
+    Node* next = loop->next;
+    Node* init = loop->init;
+    memset(loop, 0, sizeof(Node));
+    loop->kind = NODE_BLOCK;
+    loop->body = vec;
+    if (init) {
+        init->next = vec;
+        loop->body = init;
+    }
+    loop->next = next;
+}
+
+void vectorize(Program* prog) {
+    for (Function* fn = prog->funcs; fn; fn = fn->next) {
+        collect_loops(fn);
+        for (int i = loop_list_len - 1; i >= 0; i--)
+            vectorize_loop(loop_list[i]);
+    }
+}
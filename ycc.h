@@ -1,4 +1,5 @@
 #include <ctype.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -15,7 +16,12 @@ struct Var {
     Type* ty;       // Type of the variable
     bool is_local;  // Local or global
 
-    int offset;  // Offset from RBP
+    int offset;       // Offset from RBP
+    int live_start;   // First statement position using it, or -1
+    int live_end;     // Last statement position using it
+    bool addr_taken;  // Whether "&" is applied to it
+    int* init;        // Initial values of the ints of a global, or NULL
+    int init_len;     // Number of initial values, the rest being zero
 };
 
 typedef struct VarList VarList;
@@ -25,28 +31,32 @@ struct VarList {
 };
 
 typedef enum {
-    NODE_ADD,        // +
-    NODE_SUB,        // -
-    NODE_MUL,        // *
-    NODE_DIV,        // /
-    NODE_NUM,        // Number
-    NODE_EQ,         // ==
-    NODE_NE,         // !=
-    NODE_LT,         // <
-    NODE_LE,         // <=
-    NODE_ASSIGN,     // =
-    NODE_VAR,        // Variable
-    NODE_RETURN,     // "return"
-    NODE_IF,         // "if"
-    NODE_WHILE,      // "while"
-    NODE_FOR,        // "for"
-    NODE_BLOCK,      // { ... }
-    NODE_FUNCALL,    // Function call
-    NODE_EXPR_STMT,  // Expression statement
-    NODE_ADDR,       // Address-of (&)
-    NODE_DEREF,      // Dereference (*)
-    NODE_NULL,       // Empty statement
-    NODE_SIZEOF,     // sizeof
+    NODE_ADD,            // +
+    NODE_SUB,            // -
+    NODE_MUL,            // *
+    NODE_DIV,            // /
+    NODE_NUM,            // Number
+    NODE_EQ,             // ==
+    NODE_NE,             // !=
+    NODE_LT,             // <
+    NODE_LE,             // <=
+    NODE_ASSIGN,         // =
+    NODE_VAR,            // Variable
+    NODE_RETURN,         // "return"
+    NODE_IF,             // "if"
+    NODE_WHILE,          // "while"
+    NODE_FOR,            // "for"
+    NODE_BLOCK,          // { ... }
+    NODE_FUNCALL,        // Function call
+    NODE_EXPR_STMT,      // Expression statement
+    NODE_ADDR,           // Address-of (&)
+    NODE_DEREF,          // Dereference (*)
+    NODE_NULL,           // Empty statement
+    NODE_SIZEOF,         // sizeof
+    NODE_INLINE,         // Inlined function call
+    NODE_INLINE_RETURN,  // "return" in inlined code
+    NODE_VECTOR_LOOP,    // Vectorized iterations of a loop
+    NODE_COUNTER,        // Increment of a profile counter
 } NodeKind;
 
 typedef struct Node Node;
@@ -63,20 +73,26 @@ struct Node {
     Node* inc;       // Increment (for for)
     Node* next;      // Next node (for block statements)
     Type* ty;        // Type, e.g. int or pointer to int
-    Node* body;      // Body (for functions)
+    Node* body;      // Body (for blocks and inlined calls)
     Node* args;      // Arguments (for function calls)
     char* funcname;  // Function name (for function calls)
     int argnum;      // Number of arguments (for function calls)
+    int counter;     // First profile counter (for if, loops and counters)
 };
 
 typedef struct Function Function;
 struct Function {
-    Function* next;   // Next function
-    VarList* params;  // Function parameters
-    char* name;       // Function name
-    Node* node;       // AST root
-    VarList* locals;  // Local variable list
-    int stack_size;   // Total stack size needed for locals
+    Function* next;     // Next function
+    VarList* params;    // Function parameters
+    char* name;         // Function name
+    Node* node;         // AST root
+    VarList* locals;    // Local variable list
+    int stack_size;     // Total stack size needed for locals
+    int counter;        // Profile counter of calls, or 0
+    struct Token* tok;  // First token of the definition
+    int ntoks;          // Number of tokens of the definition
+    unsigned long key;  // Cache key, or 0 if not looked up
+    char* cached;       // Assembly found in the cache, or NULL
 };
 
 typedef struct Program Program;
@@ -85,6 +101,11 @@ struct Program {
     Function* funcs;   // Functions
 };
 
+Node* new_node(NodeKind kind);
+Node* new_binary(NodeKind kind, Node* lhs, Node* rhs);
+Node* new_unary(NodeKind kind, Node* expr);
+Node* new_num(int val);
+Node* new_var(Var* var);
 Program* program();
 
 // tokenize.c
@@ -100,15 +121,23 @@ typedef enum {
 typedef struct Token Token;
 struct Token {
     TokenKind kind;  // Token type
-    Token* next;     // Next token
     int val;         // If kind is TOKEN_NUM, its value
     char* str;       // Token string
     int len;         // Token length
 };
 
+// Tokens lexed from a range of the input
+typedef struct {
+    Token* data;  // Token array
+    int len;      // Number of tokens
+    int cap;      // Capacity of the token array
+    char* error;  // First invalid token, or NULL
+} TokenChunk;
+
 void error(char* fmt, ...);
 void error_at(char* loc, char* fmt, ...);
 void error_tok(Token* tok, char* fmt, ...);
+bool equal(Token* tok, char* s);
 Token* peek(char* s);
 bool consume(char* op);
 char* strndup(char* p, int len);
@@ -118,12 +147,37 @@ int expect_number();
 bool expect_type();
 char* expect_ident();
 bool at_eof();
-Token* new_token(TokenKind kind, Token* cur, char* str, int len);
+Token* push_token(TokenChunk* chunk, TokenKind kind, char* str, int len);
+Token* new_token(TokenKind kind, char* str, int len);
+void lex_chunk(TokenChunk* chunk, char* p, char* end);
+bool is_alpha(char c);
+bool is_alnum(char c);
 Token* tokenize();
 
 extern Token* token;      // Current token
+extern Token* tokens;     // Token array
+extern int tokens_len;    // Number of tokens
 extern char* user_input;  // Input string
 
+/// scan.c
+
+typedef enum {
+    SCAN_AUTO,    // Best one supported by the CPU
+    SCAN_SCALAR,  // One byte at a time
+    SCAN_SSE2,    // 16 bytes at a time
+    SCAN_AVX2,    // 32 bytes at a time
+} ScanLevel;
+
+extern char* (*scan_space)(char* p, char* end);
+extern char* (*scan_ident)(char* p, char* end);
+extern char* (*scan_digits)(char* p, char* end);
+
+void init_scan(ScanLevel level);
+
+/// lex_parallel.c
+
+void lex_parallel(TokenChunk* out, char* p, char* end, int nthreads);
+
 /// type.c
 
 typedef enum { TYPE_INT, TYPE_PTR, TYPE_ARRAY } TypeKind;
@@ -138,9 +192,232 @@ Type* int_type();
 int size_of(Type* ty);
 Type* array_of(Type* base, int size);
 Type* pointer_to(Type* base);
-void add_type(Program* prog);
+bool same_type(Type* a, Type* b);
+void type_node(Node* node);
+void verify_types(Program* prog);
+
+/// opt.c
+
+extern Function** funcs;
+extern int funcs_len;
+extern Node** walk_stack;
+extern int walk_len;
+
+void optimize(Program* prog);
+void index_functions(Program* prog);
+int find_function(char* name);
+void push_walk(Node* node);
+void push_children(Node* node);
+void visit_nodes(Node* list, void (*visit)(Node* node, void* arg), void* arg);
+bool has_side_effects(Node* node);
+bool eval_const(Node* node, long* val);
+
+/// profile.c
+
+// Profile counters of a function
+typedef struct {
+    char* name;   // Function name
+    int counter;  // First counter
+    int len;      // Number of counters
+} ProfileFunc;
+
+extern ProfileFunc* profile_funcs;
+extern int profile_funcs_len;
+extern int counters_len;
+
+void profile(Program* prog);
+long profile_count(int counter);
+bool is_cold_function(Function* fn);
+bool is_hot_function(Function* fn);
+bool is_cold_arm(Node* node, bool els);
+int profile_trips(Node* loop);
+
+/// dce.c
+
+void dce(Program* prog);
+void unused_functions(Program* prog);
+
+/// inline.c
+
+void inline_functions(Program* prog);
+
+/// loop.c
+
+// A node of a loop walked by walk_loop()
+typedef struct {
+    Node* node;      // The node
+    int parent;      // Index of the parent in loop_nodes, or -1
+    bool lvalue;     // Whether the node is assigned or has "&" applied
+    bool invariant;  // Set by mark_invariants()
+} LoopNode;
+
+// A loop whose int counter changes by a constant or invariant step once
+// per iteration
+typedef struct {
+    Var* var;         // Counter
+    Node* stride;     // Number or variable added to the counter
+    int step;         // Signed step of the counter if constant, otherwise 0
+    Node* step_stmt;  // Statement stepping the counter
+    NodeKind cmp;     // NODE_LT, NODE_LE or NODE_NE if the condition is
+                      // `var cmp limit`, otherwise 0
+    Node* limit;      // Right operand of the condition
+    Node* start;      // Initial value set by the init clause, or NULL
+} CountedLoop;
+
+extern Node** loop_list;
+extern int loop_list_len;
+extern LoopNode* loop_nodes;
+extern int loop_nodes_len;
+extern bool clobbers_globals;
+
+void find_addr(Node* node, void* arg);
+void collect_loops(Function* fn);
+void scan_loop(Node* loop);
+int count_writes(Var* var);
+bool is_invariant_var(Var* var);
+void walk_loop(Node* root);
+void mark_invariants();
+void replace_with_var(int i, Var* var);
+Var* new_temp(Function* fn, Type* ty);
+Node* new_assign_stmt(Var* var, Node* expr);
+void add_preheader(Node* loop, Node* stmts);
+bool match_counted_loop(Node* loop, CountedLoop* cl);
+
+/// licm.c
+
+void licm(Program* prog);
+
+/// vectorize.c
+
+#define MAX_VECTOR_BASES 6   // General registers holding array addresses
+#define MAX_VECTOR_FIXED 8   // Vector registers for invariants and sums
+#define MAX_VECTOR_TEMPS 8   // Vector registers for intermediate values
+#define MAX_VECTOR_SIZE 256  // AST nodes in the body of a vectorized loop
+
+// A loop whose iterations can run several at a time
+typedef struct {
+    Var* var;                         // Counter, stepped by 1
+    Node* limit;                      // Number or variable it is compared to
+    bool inclusive;                   // Whether the condition is `<=`
+    Node* stmts;                      // Statements of the body
+    Node* bases[MAX_VECTOR_BASES];    // Distinct arrays indexed by the counter
+    bool stored[MAX_VECTOR_BASES];    // Whether the body stores into them
+    int nbases;                       // Number of arrays
+    Node* scalars[MAX_VECTOR_FIXED];  // Distinct invariant operands
+    int nscalars;                     // Number of invariant operands
+    int nsums;                        // Number of sums
+} VectorLoop;
+
+int vector_width();
+bool same_tree(Node* a, Node* b);
+bool is_element(Node* node, Var* var);
+Node* sum_operand(Node* stmt, Var** sum, bool* sub);
+int vector_base(VectorLoop* vl, Node* base);
+int vector_scalar(VectorLoop* vl, Node* node);
+bool is_scalar_operand(Node* node);
+bool analyze_vector_loop(Node* cond, Node* body, VectorLoop* vl);
+void vectorize(Program* prog);
+
+/// unroll.c
+
+int unroll_factor();
+void count_size(Node* node, void* size);
+Node* copy_body(Node* body, Var* var, bool is_num, int val);
+void unroll_loops(Program* prog);
+
+/// iv.c
+
+int refs_in(Node* list, Var* var);
+void reduce_strength(Program* prog);
+
+/// cse.c
+
+void cse(Program* prog);
+
+/// frame.c
+
+void layout_frame(Function* fn);
 
 /// codegen.c
 
 void codegen(Program* prog);
 void gen(Node* node);
+void emit(char* fmt, ...);
+
+/// report.c
+
+typedef enum {
+    PHASE_TOKENIZE,  // tokenize()
+    PHASE_PARSE,     // program()
+    PHASE_TYPE,      // verify_types()
+    PHASE_OPT,       // optimize()
+    PHASE_LAYOUT,    // Stack frame layout
+    PHASE_CODEGEN,   // codegen()
+    PHASE_COUNT,     // Number of phases
+} Phase;
+
+typedef struct Stats Stats;
+struct Stats {
+    long tokens;  // Tokens created
+    long nodes;   // AST nodes created
+    long types;   // Types created
+    long vars;    // Variables created
+    long insns;   // Instructions emitted
+    long bytes;   // Bytes allocated by counted_malloc() and friends
+};
+
+extern Stats stats;
+
+void* counted_malloc(size_t size);
+void* counted_calloc(size_t n, size_t size);
+void* counted_realloc(void* ptr, size_t size);
+void phase_begin(Phase phase);
+void phase_end(Phase phase);
+void print_time_report(FILE* out, bool json);
+
+/// cache.c
+
+bool cache_enabled();
+void cache_lookup(Program* prog);
+void cache_store(Function* fn, char* text, int len);
+void cache_finish();
+
+/// ast.c
+
+void emit_ast(Program* prog, char* path);
+Program* load_ast(char* path);
+
+/// server.c
+
+int serve(char* path, int nworkers);
+
+/// driver.c
+
+extern bool opt_time_report;              // -ftime-report
+extern bool opt_time_report_json;         // -ftime-report=json
+extern ScanLevel opt_lexer;               // --lexer
+extern bool opt_dump_tokens;              // --dump-tokens
+extern int opt_lex_threads;               // --lex-threads
+extern bool opt_verify_types;             // --verify-types
+extern int opt_level;                     // -O<level>
+extern bool opt_warn_unused_function;     // -Wunused-function
+extern bool opt_remove_unused_functions;  // -fremove-unused-functions
+extern bool opt_omit_frame_pointer;       // -fomit-frame-pointer
+extern bool opt_inline;                   // -fno-inline
+extern int opt_inline_limit;              // -finline-limit
+extern int opt_unroll_factor;             // -funroll-factor
+extern bool opt_vectorize;                // -fno-vectorize
+extern bool opt_avx2;                     // -mavx2
+extern char* opt_profile_generate;        // -fprofile-generate
+extern char* opt_profile_use;             // -fprofile-use
+extern bool opt_instrument_functions;     // -finstrument-functions
+extern char* opt_server;                  // --server
+extern int opt_workers;                   // --workers
+extern char* opt_cache_dir;               // --cache
+extern int opt_cache_size;                // --cache-size
+extern bool opt_cache_stats;              // --cache-stats
+extern char* opt_emit_ast;                // --emit-ast
+extern char* opt_load_ast;                // --load-ast
+
+void usage();
+int ycc_main(int argc, char** argv);